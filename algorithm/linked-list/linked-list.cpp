@@ -1,119 +1,5 @@
 #include "linked-list.h"
 
-/*======================================*/
-/*      Base class Implementation       */
-/*======================================*/
-bool LINKED_LIST::insert_node(uint64_t node) {
-    uint64_t cur_head = get_head();
-    uint64_t cur_count = get_count();
-
-    if (is_null_node(node)) {
-        return false;
-    }
-
-    if (cur_head == NULL_LIST_NODE && cur_count == 0) {
-        // 当前是一个空链表
-        // create a new head
-        set_head(node);
-        set_count(1);
-
-        // circular linked list initialization
-        set_node_prev(node, node);
-        set_node_next(node, node);
-
-        return true;
-    } else if (cur_head != NULL_LIST_NODE && cur_count != 0) {
-        // 当前链表不是空链表
-        // 头插法: insert to head
-        uint64_t head_prev = get_node_prev(cur_head);
-
-        set_node_next(node, cur_head);
-        set_node_prev(cur_head, node);
-
-        set_node_next(head_prev, node);
-        set_node_prev(node, head_prev);
-
-        set_head(node);
-        set_count(cur_count + 1);
-
-        return true;
-    } else {
-        // 非法情况
-        return false;
-    }
-}
-
-
-bool LINKED_LIST::delete_node(uint64_t node) {
-    uint64_t cur_head = get_head();
-    uint64_t cur_count = get_count();
-
-    if (cur_head == NULL_LIST_NODE || is_null_node(node)) {
-        return false;
-    }
-
-    // update the prev and next pointers
-    // !!! same for the only one node situation
-    uint64_t prev = get_node_prev(node);
-    uint64_t next = get_node_next(node);
-
-    set_node_next(prev, next);
-    set_node_prev(next, prev);
-
-    // if this node to be free is the head
-    if (is_nodes_equal(node, cur_head)) {
-        set_head(next);
-    }
-
-    destruct_node(node);
-
-    --cur_count;
-    set_count(cur_count);
-
-    // 如果只有一个节点时
-    if (cur_count == 0) {
-        set_head(NULL_LIST_NODE);
-    }
-
-    return true;
-}
-
-uint64_t LINKED_LIST::get_next() {
-    uint64_t cur_head = get_head();
-
-    if (cur_head == NULL_LIST_NODE) {
-        return NULL_LIST_NODE;
-    }
-
-    uint64_t new_head = get_node_next(cur_head);
-    set_head(new_head);
-
-    return cur_head;
-}
-
-uint64_t LINKED_LIST::get_node_by_index(uint64_t index) {
-    uint64_t cur_head = get_head();
-    uint64_t cur_count = get_count();
-
-    // index in [0, cur_count)
-    if (cur_head == NULL_LIST_NODE || index >= cur_count) {
-        return NULL_LIST_NODE;
-    }
-
-    for (int i = 0; i < index; ++i) {
-        cur_head = get_node_next(cur_head);
-    }
-
-    return cur_head;
-}
-
-bool LINKED_LIST::is_null_node(uint64_t node) {
-    if (node == NULL_LIST_NODE) {
-        return true;
-    }
-    return false;
-}
-
 /*======================================*/
 /*      Default Implementation          */
 /*======================================*/
@@ -0,0 +1,221 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "rbt.h"
+
+// ================================================ //
+//   RBT_INT (CRTP) vs. the virtual flavor of RBT   //
+// ================================================ //
+// 两棵树使用相同的节点(rbt_node_t)和相同的访问函数，唯一的区别是访问函数的调用方式:
+//  - RBT_INT: RBT_BASE<RBT_INT>，访问函数在编译期确定并内联
+//  - VIRTUAL_RBT_INT: RBT_BASE<RBT>，每一次访问都是一次虚函数调用
+
+class VIRTUAL_RBT_INT final : public RBT {
+public:
+    VIRTUAL_RBT_INT() = default;
+
+    ~VIRTUAL_RBT_INT() override {
+        // 节点在 benchmark 中全部被删除
+    }
+
+    uint64_t get_root() const override {
+        return root_;
+    }
+
+protected:
+    bool is_null_node(uint64_t node) const override {
+        return node == NULL_TREE_NODE;
+    }
+
+    bool set_root(uint64_t new_root) override {
+        root_ = new_root;
+        return true;
+    }
+
+    uint64_t construct_node() override {
+        return (uint64_t)(new RBT_INT_NODE());
+    }
+
+    bool destruct_node(uint64_t node) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+
+        delete (rbt_node_t *)node;
+        return true;
+    }
+
+    bool is_nodes_equal(uint64_t first, uint64_t second) override {
+        return first == second;
+    }
+
+    uint64_t get_parent(uint64_t node) const override {
+        return is_null_node(node) ? NULL_TREE_NODE : (uint64_t)(((rbt_node_t *)node)->parent);
+    }
+
+    bool set_parent(uint64_t node, uintptr_t parent) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+        ((rbt_node_t *)node)->parent = (rbt_node_t *)parent;
+        return true;
+    }
+
+    uint64_t get_left_child(uint64_t node) const override {
+        return is_null_node(node) ? NULL_TREE_NODE : (uint64_t)(((rbt_node_t *)node)->left);
+    }
+
+    bool set_left_child(uint64_t node, uint64_t left_child) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+        ((rbt_node_t *)node)->left = (rbt_node_t *)left_child;
+        return true;
+    }
+
+    uint64_t get_right_child(uint64_t node) const override {
+        return is_null_node(node) ? NULL_TREE_NODE : (uint64_t)(((rbt_node_t *)node)->right);
+    }
+
+    bool set_right_child(uint64_t node, uint64_t right_child) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+        ((rbt_node_t *)node)->right = (rbt_node_t *)right_child;
+        return true;
+    }
+
+    rbt_color_t get_color(uint64_t node) const override {
+        return is_null_node(node) ? COLOR_BLACK : ((rbt_node_t *)node)->color;
+    }
+
+    bool set_color(uint64_t node, rbt_color_t color) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+        ((rbt_node_t *)node)->color = color;
+        return true;
+    }
+
+    uint64_t get_key(uint64_t node) const override {
+        return is_null_node(node) ? NULL_TREE_NODE : ((rbt_node_t *)node)->key;
+    }
+
+    bool set_key(uint64_t node, uint64_t key) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+        ((rbt_node_t *)node)->key = key;
+        return true;
+    }
+
+    uint64_t get_value(uint64_t node) const override {
+        return is_null_node(node) ? NULL_TREE_NODE : ((rbt_node_t *)node)->value;
+    }
+
+    bool set_value(uint64_t node, uint64_t value) override {
+        if (is_null_node(node)) {
+            return false;
+        }
+        ((rbt_node_t *)node)->value = value;
+        return true;
+    }
+
+private:
+    uint64_t root_ = NULL_TREE_NODE;
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point begin, bench_clock::time_point end) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+}
+
+// 插入 keys.size() 个节点后再按随机顺序全部删除，返回 insert/delete 每次操作的平均耗时(ns)
+template <class Tree>
+static void bench_tree(Tree &tree, const std::vector<uint64_t> &keys, const std::vector<int> &order,
+                       double &insert_ns, double &delete_ns) {
+    size_t n = keys.size();
+    std::vector<uint64_t> nodes(n);
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i] = (uint64_t)(new RBT_INT_NODE(keys[i]));
+    }
+
+    bench_clock::time_point t0 = bench_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        tree.insert_node(nodes[i]);
+    }
+    bench_clock::time_point t1 = bench_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        // delete_node 会通过 destruct_node 释放节点
+        tree.delete_node(nodes[order[i]]);
+    }
+    bench_clock::time_point t2 = bench_clock::now();
+
+    if (tree.get_root() != NULL_TREE_NODE) {
+        printf("benchmark error: tree is not empty\n");
+        exit(1);
+    }
+
+    insert_ns = elapsed_ns(t0, t1) / n;
+    delete_ns = elapsed_ns(t1, t2) / n;
+}
+
+// 通过基类指针返回，避免编译器对虚函数调用进行去虚化
+static RBT *new_virtual_tree() __attribute__((noinline));
+static RBT *new_virtual_tree() {
+    return new VIRTUAL_RBT_INT();
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    srand(42);
+    std::vector<uint64_t> keys(n);
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i) {
+        keys[i] = ((uint64_t)rand() << 16) ^ rand();
+        order[i] = i;
+    }
+    for (int i = n - 1; i > 0; --i) {
+        int j = rand() % (i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    printf("Benchmark red-black tree insert/delete: %d nodes, %d rounds\n", n, rounds);
+
+    double crtp_insert = 0, crtp_delete = 0, virt_insert = 0, virt_delete = 0;
+    for (int r = 0; r < rounds; ++r) {
+        double i_ns, d_ns;
+
+        RBT_INT crtp(NULL_TREE_NODE);
+        bench_tree(crtp, keys, order, i_ns, d_ns);
+        crtp_insert += i_ns;
+        crtp_delete += d_ns;
+
+        std::unique_ptr<RBT> virt(new_virtual_tree());
+        bench_tree(*virt, keys, order, i_ns, d_ns);
+        virt_insert += i_ns;
+        virt_delete += d_ns;
+    }
+
+    crtp_insert /= rounds;
+    crtp_delete /= rounds;
+    virt_insert /= rounds;
+    virt_delete /= rounds;
+
+    printf("%-24s %12s %12s %14s %14s\n", "tree", "insert(ns)", "delete(ns)", "insert(Mops/s)", "delete(Mops/s)");
+    printf("%-24s %12.1f %12.1f %14.2f %14.2f\n", "RBT_BASE<RBT_INT>",
+           crtp_insert, crtp_delete, 1e3 / crtp_insert, 1e3 / crtp_delete);
+    printf("%-24s %12.1f %12.1f %14.2f %14.2f\n", "RBT (virtual)",
+           virt_insert, virt_delete, 1e3 / virt_insert, 1e3 / virt_delete);
+    printf("speedup: insert x%.2f, delete x%.2f\n", virt_insert / crtp_insert, virt_delete / crtp_delete);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "policy-allocator.h"
+
+// ================================================ //
+//      Worst-case latency of alloc and free        //
+// ================================================ //
+// 保持 live 个已分配的块，随机选择一个 free 后再分配一个新的块，记录每一次 alloc/free 的耗时
+// 请求大小是双峰分布: 90% 为 [1, 256]，10% 为 [1024, 8192]
+// 大块的请求需要越过大量的小空闲块，首次适配的链表随 live 的增长而变慢
+// TLSF 的 search/insert/delete 都只有两次 ctz + 链表头操作，最坏延迟不随 live 增长
+// 使用 ALLOCATOR<FreeIndex>，只比较空闲块的管理方式，block 格式与分配流程完全相同
+// max 还包含进程被调度出去、缺页等与算法无关的耗时，p99.9 更能反映算法本身的最坏情况
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point begin, bench_clock::time_point end) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+}
+
+static uint32_t random_size() {
+    if (rand() % 10 == 0) {
+        return 1024 + rand() % (8192 - 1024 + 1);
+    }
+    return 1 + rand() % 256;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    size_t i = (size_t)(p * (sorted.size() - 1));
+    return sorted[i];
+}
+
+static void print_latency(const char *name, int live, const char *op, std::vector<double> &ns) {
+    std::sort(ns.begin(), ns.end());
+    printf("%-20s %8d %6s %10.0f %10.0f %10.0f %12.0f\n", name, live, op,
+           percentile(ns, 0.5), percentile(ns, 0.99), percentile(ns, 0.999), ns.back());
+}
+
+template <class FreeIndex>
+static void bench_latency(const char *name, int live, int ops) {
+    ALLOCATOR<FreeIndex> a;
+    if (!a.init(1ULL << 30)) {
+        printf("benchmark error: cannot init heap\n");
+        exit(1);
+    }
+
+    srand(42);
+
+    // 先将 heap 拓展到足够大并访问一遍，避免测量期间 brk/trim 的系统调用以及首次访问的缺页
+    // pin 使大块不是最后一块，free 时不会触发 trim
+    uint32_t reserve_size = (uint32_t)live * 8192;
+    uint64_t reserve = a.alloc(reserve_size);
+    uint64_t pin = a.alloc(1);
+    memset(&heap[reserve], 0, reserve_size);
+    a.free(reserve);
+
+    std::vector<uint64_t> ptrs(live);
+    for (int i = 0; i < live; ++i) {
+        ptrs[i] = a.alloc(random_size());
+    }
+
+    // warm up: 产生碎片，并让 header/footer 所在的页都被访问过
+    for (int i = 0; i < ops; ++i) {
+        int k = rand() % live;
+        a.free(ptrs[k]);
+        ptrs[k] = a.alloc(random_size());
+    }
+
+    std::vector<double> alloc_ns(ops), free_ns(ops);
+    for (int i = 0; i < ops; ++i) {
+        int k = rand() % live;
+        uint32_t size = random_size();
+
+        bench_clock::time_point t0 = bench_clock::now();
+        a.free(ptrs[k]);
+        bench_clock::time_point t1 = bench_clock::now();
+        ptrs[k] = a.alloc(size);
+        bench_clock::time_point t2 = bench_clock::now();
+
+        if (ptrs[k] == NIL) {
+            printf("benchmark error: out of memory\n");
+            exit(1);
+        }
+
+        free_ns[i] = elapsed_ns(t0, t1);
+        alloc_ns[i] = elapsed_ns(t1, t2);
+    }
+
+    print_latency(name, live, "alloc", alloc_ns);
+    print_latency(name, live, "free", free_ns);
+
+    for (int i = 0; i < live; ++i) {
+        a.free(ptrs[i]);
+    }
+    a.free(pin);
+}
+
+int main(int argc, char **argv) {
+    int ops = argc > 1 ? atoi(argv[1]) : 200000;
+    const int lives[] = {1000, 8000, 64000};
+
+    printf("Benchmark alloc/free latency: %d ops after %d warm-up ops\n", ops, ops);
+    printf("%-20s %8s %6s %10s %10s %10s %12s\n", "index", "live", "op", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+
+    for (int live : lives) {
+        bench_latency<EXPLICIT_LIST_INDEX>("explicit free list", live, ops);
+        bench_latency<REDBLACK_TREE_INDEX>("red-black tree", live, ops);
+        bench_latency<SEGREGATED_LIST_INDEX>("segregated fit", live, ops);
+        bench_latency<TLSF_INDEX>("TLSF", live, ops);
+    }
+
+    return 0;
+}
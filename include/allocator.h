@@ -1,40 +1,231 @@
 #ifndef MALLOC_ALLOCATOR_H
 #define MALLOC_ALLOCATOR_H
 
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 
 #include "linked-list.h"
 
-// 采用数组模拟heap空间，初始给予4KB(one page)空间
+// 整个进程通过 mmap 预留(reserve)一段连续的虚拟地址(PROT_NONE)
+// 每个 heap 实例在其中占据一段互不重叠、按页对齐的区间，初始提交(commit) 4KB(one page)，之后由 extend_heap 按页提交
+// vaddr 是相对于预留区间起始地址的偏移，因此可以像数组一样使用 heap[vaddr]，并且不同 heap 实例的 vaddr 互不相同
 // heap's bytes range:
-// [heap_start_vaddr, heap_end_vaddr) or [heap_start_vaddr, heap_end_vaddr - 1]
-// [0,1,2,3] - unused(类比封面)
-// [4,5,6,7,8,9,10,11] - prologue block(类比目录)
-// [12, ..., 4096 * n - 5] - regular blocks(类比正文)
-// 4096 * n + [- 4, -3, -2, -1] - epilogue block (header only)
-extern uint64_t heap_start_vaddr;
-extern uint64_t heap_end_vaddr;
-
-// heap 区最多分配8个page，初始分配1个page
-const uint64_t HEAP_MAX_SIZE = 4096 * 8;
-extern uint8_t heap[];
+// [start_vaddr, end_vaddr) or [start_vaddr, end_vaddr - 1]
+// start_vaddr + [0,1,2,3] - unused(类比封面)
+// start_vaddr + [4,5,6,7,8,9,10,11] - prologue block(类比目录)
+// start_vaddr + [12, ..., 4096 * n - 5] - regular blocks(类比正文)
+// start_vaddr + 4096 * n + [- 4, -3, -2, -1] - epilogue block (header only)
+
+// 预留的虚拟地址空间大小
+// 空闲块中的 block ptr 是以 8 Byte 为单位的 32-bit 偏移(compress_ptr)，因此 vaddr 不能超过 32GB
+const uint64_t HEAP_MAX_SIZE = (uint64_t)1 << 35;
+// small list 的 prev/next 只有 29 bit，只能表示 4GB 以内的地址
+// 超出这一范围的 heap(wide heap)不使用 8-Byte block，最小的块为 16 Byte
+const uint64_t HEAP_NARROW_LIMIT = (uint64_t)1 << 32;
+// 默认每个 heap 实例可以使用的地址空间大小
+const uint64_t HEAP_DEFAULT_SIZE = (uint64_t)1 << 30;
+// 最多同时存在的 heap 实例个数
+const int HEAP_MAX_INSTANCES = 64;
+extern uint8_t *heap;
 
 const uint32_t FREE = 0;        // 空闲block
 const uint32_t ALLOCATED = 1;   // 已分配的block
 const uint64_t NIL = 0;         // 非法/空的虚拟地址
 
+// block size 保存在 header 的 32-bit 中，单个 block 不超过 HEAP_MAX_BLOCK_SIZE
+// 两个相邻的空闲块合并后会超出时保持分开
+const uint32_t HEAP_MAX_BLOCK_SIZE = 0xFFFFF000;
+// boundary tag allocator 能分配的最大 payload: 拓展 heap 时与末尾的空闲块合并之后也不会超过 HEAP_MAX_BLOCK_SIZE
+const uint32_t HEAP_MAX_PAYLOAD_SIZE = HEAP_MAX_BLOCK_SIZE - 8192;
+
+// ================================================ //
+//          Compressed 32-bit block pointers        //
+// ================================================ //
+// 空闲块中的 block ptr，以及各级 cache、slab、buddy system 中的链接都以 32-bit 保存
+// header(8n + 4)、payload 和页(8n) 都保存为 n，因此 32-bit 可以表示 HEAP_MAX_SIZE 的地址空间
+// NIL 保存为 0: vaddr 为 4 的 header 是第一个 heap 的 prologue，不会被链接
+inline uint32_t compress_ptr(uint64_t vaddr) {
+    assert(vaddr < HEAP_MAX_SIZE);
+    return (uint32_t)(vaddr >> 3);
+}
+
+inline uint64_t decompress_header_ptr(uint32_t value) {
+    return value == 0 ? NIL : ((uint64_t)value << 3) + 4;
+}
+
+inline uint64_t decompress_payload_ptr(uint32_t value) {
+    return (uint64_t)value << 3;
+}
+
 const uint32_t MIN_EXPLICIT_FREE_LIST_BLOCKSIZE = 16;
 //const uint64_t MIN_REDBLACK_TREE_BLOCKSIZE = 24;  // rbt使用最小条件
 const uint64_t MIN_REDBLACK_TREE_BLOCKSIZE = 40;    // 使用rbt管理 >= 40的块
 
+// mem_free 后末尾空闲块 >= HEAP_TRIM_THRESHOLD 时自动 trim，末尾空闲块保留 HEAP_TOP_PAD
+const uint32_t HEAP_TRIM_THRESHOLD = 128 * 1024;
+const uint32_t HEAP_TOP_PAD = 64 * 1024;
+
+// rbt 中 >= HEAP_PURGE_THRESHOLD 的空闲块，将其内部的整页归还给OS
+const uint32_t HEAP_PURGE_THRESHOLD = 64 * 1024;
+
+// statistics of the pages returned to OS, and of splitting & coalescing
+typedef struct {
+    uint64_t purge_count;       // 被 purge 的空闲块的次数
+    uint64_t purged_pages;      // purge 时归还给OS的page数
+    uint64_t split_count;       // 分配时分割空闲块的次数
+    uint64_t coalesce_count;    // 释放时与相邻空闲块合并的次数(两侧都空闲时计两次)
+} heap_stats_t;
+
+// ================================================ //
+//        Free block management strategies          //
+// ================================================ //
+// 空闲块的管理策略，在 heap_init 时选择，同一个程序中不同 heap 可以使用不同的策略
+typedef enum {
+    IMPLICIT_FREE_LIST_STRATEGY,    // 隐式空闲链表 + 8-Byte free block
+    EXPLICIT_FREE_LIST_STRATEGY,    // 显式空闲链表 + 8-Byte free block
+    REDBLACK_TREE_STRATEGY,         // 红黑树 + 显式空闲链表 + 8-Byte free block
+    SEGREGATED_FIT_STRATEGY,        // 分离适配: 按 size class 划分的显式空闲链表 + 8-Byte free block
+    TLSF_STRATEGY,                  // 两级分离适配(TLSF): O(1) 的 search/insert/delete + 8-Byte free block
+} free_block_strategy_t;
+
+const free_block_strategy_t HEAP_DEFAULT_STRATEGY = REDBLACK_TREE_STRATEGY;
+
+// 每种策略以 dispatch table 的形式提供其实现
+typedef struct {
+    const char *name;
+    bool (*initialize_free_block)();
+    uint64_t (*search_free_block)(uint32_t payload_size, uint32_t &alloc_block_size);
+    bool (*insert_free_block)(uint64_t free_header);
+    bool (*delete_free_block)(uint64_t free_header);
+    void (*check_free_block)();
+} free_block_policy_t;
+
+extern const free_block_policy_t implicit_list_policy;
+extern const free_block_policy_t explicit_list_policy;
+extern const free_block_policy_t redblack_tree_policy;
+extern const free_block_policy_t segregated_list_policy;
+extern const free_block_policy_t tlsf_policy;
+
+const free_block_policy_t *get_free_block_policy(free_block_strategy_t strategy);
+
+class SMALL_FREE_LINKED_LIST;
+struct SMALL_FREE_STACK;
+struct QUICK_FREE_LISTS;
+class EXPLICIT_FREE_LINKED_LIST;
+class FREE_RBT;
+struct SEGREGATED_FREE_LISTS;
+struct TLSF_FREE_LISTS;
+struct BUDDY_ALLOCATOR;
+struct SLAB_ALLOCATOR;
+struct HEAP_LOCKS;
+struct TRANSFER_CACHE;
+struct PERCPU_CACHE;
+struct SCAVENGER;
+struct ASYNC_FREER;
+struct HUGE_MAPPINGS;
+
+// ================================================ //
+//                 The heap instance                //
+// ================================================ //
+// 一个 heap 实例拥有自己的地址区间以及空闲块的管理结构，不同实例之间互不影响
+// 按 cache line 对齐，避免不同实例的状态共享同一个 cache line
+typedef struct alignas(64) HEAP_INSTANCE {
+    uint64_t start_vaddr = 0;   // 区间起始地址，4096对齐
+    uint64_t end_vaddr = 0;     // 当前的 break
+    uint64_t max_size = 0;      // 区间大小: [start_vaddr, start_vaddr + max_size)
+    // 区间超出 HEAP_NARROW_LIMIT，不使用 8-Byte block
+    bool wide = false;
+
+    heap_stats_t stats = heap_stats_t();
+
+    // free block management strategy
+    free_block_strategy_t strategy = HEAP_DEFAULT_STRATEGY;
+    const free_block_policy_t *policy = nullptr;
+
+    // free block index
+    std::shared_ptr<SMALL_FREE_LINKED_LIST> small_list;
+    std::shared_ptr<EXPLICIT_FREE_LINKED_LIST> explicit_list;
+    std::shared_ptr<FREE_RBT> rbt;
+    std::shared_ptr<SEGREGATED_FREE_LISTS> segregated_lists;
+    std::shared_ptr<TLSF_FREE_LISTS> tlsf;
+    // 8-Byte block 的无锁栈(heap_enable_small_stack)，nullptr 表示未启用
+    std::shared_ptr<SMALL_FREE_STACK> small_stack;
+    // [16, 256] Byte block 延迟合并的 quick list(heap_enable_quick_lists)，nullptr 表示未启用
+    std::shared_ptr<QUICK_FREE_LISTS> quick_lists;
+
+    // 页级请求的 buddy system，nullptr 表示未启用
+    std::shared_ptr<BUDDY_ALLOCATOR> buddy;
+    // 小对象的 slab allocator，nullptr 表示未启用
+    std::shared_ptr<SLAB_ALLOCATOR> slab;
+
+    // 多线程模式下的锁，nullptr 表示 heap 只在一个线程中使用
+    std::shared_ptr<HEAP_LOCKS> locks;
+
+    // 小请求是否先经过各线程的 tcache(heap_enable_tcache)
+    bool tcache_enabled = false;
+    // scavenger 每次扫描加 1，各线程的 tcache 发现变化时归还空闲的 bin(以 __atomic 访问)
+    uint32_t tcache_epoch = 0;
+    // 各线程 tcache 之间整批移动块的 transfer cache，heap_enable_tcache 时创建
+    std::shared_ptr<TRANSFER_CACHE> transfer_cache;
+
+    // 小请求经过的 per-CPU cache(heap_enable_percpu_cache)，取代 tcache，nullptr 表示未启用
+    std::shared_ptr<PERCPU_CACHE> percpu_cache;
+
+    // 后台归还内存的线程(heap_start_scavenger)，启用时 mem_free 不再 trim/purge，nullptr 表示未启用
+    std::shared_ptr<SCAVENGER> scavenger;
+
+    // 批量完成 mem_free_async 的后台线程(heap_start_async_free)，nullptr 表示未启用
+    std::shared_ptr<ASYNC_FREER> async_free;
+
+    // payload >= threshold 的请求单独映射(heap_enable_huge_mappings)，nullptr 表示未启用
+    std::shared_ptr<HUGE_MAPPINGS> huge;
+} heap_t;
+
+// block 操作所作用的 heap 实例，默认为 default heap
+// 每个线程各自选择操作的 heap 实例
+// 使用 __thread 而不是 thread_local: 初始值是常量，避免其他编译单元每次访问时调用 thread_local 的初始化包装函数
+extern __thread heap_t *cur_heap;
+
+// 在 h 上进行操作，结束后恢复原来的 heap 实例
+class HEAP_GUARD {
+public:
+    explicit HEAP_GUARD(heap_t *h) : saved_(cur_heap) {
+        cur_heap = h;
+    }
+
+    ~HEAP_GUARD() {
+        cur_heap = saved_;
+    }
+
+    HEAP_GUARD(const HEAP_GUARD &) = delete;
+    HEAP_GUARD& operator=(const HEAP_GUARD &) = delete;
+
+private:
+    heap_t *saved_;
+};
+
 // to allocate physical page for heap
 uint32_t extend_heap(uint32_t size);
-void os_syscall_brk();
+// release the whole pages strictly inside a free block, only header, footer
+// and the fields of free block as data structure are kept
+void purge_free_block(uint64_t header_vaddr);
+
+// move the break of cur_heap to new_end_vaddr
+// grow: commit the pages in [end_vaddr, new_end_vaddr)
+// shrink: release the pages in [new_end_vaddr, end_vaddr) to OS
+bool os_syscall_brk(uint64_t new_end_vaddr);
 
 // 将x向上对齐到n的整数倍
 uint64_t round_up(uint64_t x, uint64_t n);
 
+// the block size to allocate for payload_size, payload <= 4 is an 8-Byte block
+// 只有空闲块有 footer，已分配的块只需要 header
+uint32_t get_alloc_block_size(uint32_t payload_size);
+// 8, or 16 for a wide heap
+uint32_t get_min_block_size();
+
 // operations for all blocks
 uint32_t get_block_size(uint64_t header_vaddr);
 void set_block_size(uint64_t header_vaddr, uint32_t blocksize);
@@ -48,12 +239,14 @@ uint64_t get_footer(uint64_t vaddr);
 
 // operations for heap linked list
 uint64_t get_next_header(uint64_t vaddr);
+// return NIL if the previous block is allocated: it has no footer
 uint64_t get_prev_header(uint64_t vaddr);
 
 uint64_t get_prologue();
 uint64_t get_epilogue();
 
 uint64_t get_first_block();
+// NIL if the last block is allocated
 uint64_t get_last_block();
 
 bool is_first_block(uint64_t vaddr);
@@ -63,14 +256,55 @@ bool is_last_block(uint64_t vaddr);
 uint64_t get_field32_block_ptr(uint64_t header_vaddr, uint32_t min_block_size, uint32_t offset);
 bool set_field32_block_ptr(uint64_t header_vaddr, uint64_t block_ptr, uint32_t min_block_size, uint32_t offset);
 
+// whether the interior pages of the free block have been purged
+bool is_block_purged(uint64_t header_vaddr);
+void set_block_purged(uint64_t header_vaddr);
+
+// merge two adjacent blocks [low][high] as one free block
+uint64_t merge_blocks_as_free(uint64_t low, uint64_t high);
+
 // for debug
 void print_heap();
+void check_heap_correctness();
 
 // interface
+// 以下接口作用于 cur_heap(默认为 default heap)
+// 重新初始化时沿用 cur_heap 原来的策略
 bool heap_init();
+bool heap_init(free_block_strategy_t strategy);
 
-uint64_t mem_alloc(uint32_t size);
+// return NIL if size > HEAP_MAX_PAYLOAD_SIZE, unless it is a huge mapping
+uint64_t mem_alloc(size_t size);
 
 void mem_free(uint64_t payload_vaddr);
 
+// resize in place if possible, otherwise allocate, copy and free
+// return NIL if it fails, and the old block is kept
+uint64_t mem_realloc(uint64_t payload_vaddr, size_t size);
+
+// return the free pages at the end of heap to OS, keep at least pad bytes in the last free block
+// return true if any page is released
+bool mem_trim(uint32_t pad);
+
+// interface for heap instance
+// 为 h 划分一段 max_size 大小的地址区间并初始化，如果 h 已经初始化过则先销毁
+bool heap_init(heap_t *h, uint64_t max_size = HEAP_DEFAULT_SIZE,
+               free_block_strategy_t strategy = HEAP_DEFAULT_STRATEGY);
+// 将 h 的全部物理页归还给OS，并释放其地址区间
+void heap_destroy(heap_t *h);
+// 只划分地址区间并初始化 prologue/epilogue/第一个空闲块，不设置 policy，也不初始化空闲块的管理结构
+// 供 ALLOCATOR<FreeIndex, SmallIndex> 这类编译期确定空闲块管理方式的 allocator 使用
+bool heap_init_blocks(heap_t *h, uint64_t max_size);
+
+uint64_t mem_alloc(heap_t *h, size_t size);
+
+void mem_free(heap_t *h, uint64_t payload_vaddr);
+
+uint64_t mem_realloc(heap_t *h, uint64_t payload_vaddr, size_t size);
+
+bool mem_trim(heap_t *h, uint32_t pad);
+
+// return the heap instance which vaddr belongs to, nullptr if not found
+heap_t *heap_find(uint64_t vaddr);
+
 #endif //MALLOC_ALLOCATOR_H
@@ -0,0 +1,53 @@
+#ifndef MALLOC_ARENA_H
+#define MALLOC_ARENA_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "allocator.h"
+
+// ================================================ //
+//          Per-thread arenas with remote free      //
+// ================================================ //
+// 每个线程第一次 arena_alloc 时获得自己的 arena: 一个独立的 heap 实例(地址区间 + 空闲块管理结构)
+// arena 的 heap 只由其所属线程操作，因此 arena_alloc 与释放本线程分配的块都不需要加锁
+// 释放其他 arena 的块时，将其压入该 arena 的 remote free 队列(多生产者单消费者)，由所属线程在下一次 arena_alloc 时统一释放
+//  - 队列是一个 Treiber 栈: 生产者以 CAS 压入，消费者一次取走整个栈，因此不存在 ABA 问题
+//  - 队列中的块以 payload 的前 4 字节保存下一个块的 vaddr(至少有 4 字节的 payload)
+// 线程退出时 arena 被放弃(但不销毁，其中的块可能仍在被其他线程使用)，之后新的线程会接管它
+// arena 的个数达到上限时，之后的线程共享一个多线程模式(heap_enable_thread_safe)的 arena
+const uint64_t ARENA_DEFAULT_SIZE = (uint64_t)1 << 26;
+const int ARENA_MAX_NUM = 32;
+
+typedef struct {
+    uint64_t remote_free_count;     // 被其他线程压入 remote free 队列的块数
+    uint64_t remote_drain_count;    // 所属线程从 remote free 队列中释放的块数
+} arena_stats_t;
+
+struct alignas(64) ARENA {
+    heap_t heap;
+
+    // 所属线程是否存在，被放弃的 arena 可以被新的线程接管
+    std::atomic<bool> owned{false};
+    // 多个线程共享的 arena，heap 处于多线程模式，释放时直接 mem_free
+    bool shared = false;
+
+    // remote free 队列的栈顶，NIL 表示为空
+    alignas(64) std::atomic<uint64_t> remote_free_head{NIL};
+    std::atomic<uint64_t> remote_free_count{0};
+    uint64_t remote_drain_count = 0;
+};
+
+// 在当前线程的 arena 中分配，第一次调用时为当前线程创建或接管一个 arena
+uint64_t arena_alloc(uint32_t size);
+// payload_vaddr 可以是任意线程从 arena 中分配的块
+void arena_free(uint64_t payload_vaddr);
+
+// return the arena which vaddr belongs to, nullptr if not found
+ARENA *arena_find(uint64_t vaddr);
+// the arena of the calling thread, nullptr if it has not called arena_alloc
+ARENA *arena_self();
+int arena_count();
+arena_stats_t arena_stats(const ARENA *a);
+
+#endif //MALLOC_ARENA_H
@@ -0,0 +1,83 @@
+#ifndef MALLOC_ASYNC_FREE_H
+#define MALLOC_ASYNC_FREE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "allocator.h"
+
+// ================================================ //
+//      Asynchronous free offloaded to a worker     //
+// ================================================ //
+// heap_start_async_free 之后，mem_free_async 只是将 payload 放入当前线程的环形缓冲区，
+// 真正的释放(合并、空闲链表/rbt 的删除与插入、trim)由后台线程批量完成，从而不在请求线程的关键路径上:
+//  - 每个线程对每个 heap 一个单生产者单消费者的环形缓冲区，生产者与后台线程之间只有 acquire/release
+//  - 缓冲区达到一半时唤醒后台线程，否则后台线程每隔 interval_ms 检查一次
+//  - 后台线程将取出的一批块按地址排序之后再 mem_free，地址相邻的块连续合并
+//  - 缓冲区已满时 mem_free_async 退化为同步的 mem_free
+//  - 线程退出后其缓冲区由之后的线程复用，其中剩余的块仍由后台线程释放
+// 后台线程与其他线程同时访问 heap，因此 heap 需要处于多线程模式(heap_enable_thread_safe)
+// 与 heap_enable_* 相同，heap_start_async_free/heap_stop_async_free 不能与其他线程对 h 的操作同时进行
+const uint32_t ASYNC_FREE_RING_CAPACITY = 1024;
+const uint32_t ASYNC_FREE_DEFAULT_INTERVAL_MS = 10;
+
+// 以 posix_memalign 分配(async-free.cpp 中的 new_ring)
+struct ASYNC_FREE_RING {
+    // 生产者(所属线程)写 tail，后台线程写 head，二者不共享 cache line
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    // 是否有线程在使用，线程退出时置为 false，之后的线程可以复用
+    std::atomic<bool> owned{true};
+    uint32_t items[ASYNC_FREE_RING_CAPACITY] = {0};    // compress_ptr(payload)
+};
+
+typedef struct {
+    uint64_t freed;         // 后台线程(或 async_free_drain)释放的块数
+    uint64_t batches;       // 取出并释放的批数
+    uint64_t overflows;     // 缓冲区已满，同步释放的块数
+} async_free_stats_t;
+
+struct ASYNC_FREER {
+    heap_t *heap = nullptr;
+    uint32_t interval_ms = ASYNC_FREE_DEFAULT_INTERVAL_MS;
+    // 区分不同的 ASYNC_FREER 实例，线程缓存的缓冲区属于哪一个
+    uint64_t id = 0;
+
+    // 全部线程的缓冲区，线程缓存 shared_ptr，ASYNC_FREER 先销毁时缓冲区仍然有效
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<ASYNC_FREE_RING>> rings;
+
+    // 后台线程与 async_free_drain 的释放互斥
+    std::mutex drain_mutex;
+    std::vector<uint64_t> batch;
+    uint64_t freed = 0;
+    uint64_t batches = 0;
+    std::atomic<uint64_t> overflows{0};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread thread;
+
+    // 释放缓冲区中剩余的块之后返回
+    ~ASYNC_FREER();
+};
+
+bool heap_start_async_free(heap_t *h, uint32_t interval_ms = ASYNC_FREE_DEFAULT_INTERVAL_MS);
+// 释放全部缓冲区中的块并等待后台线程结束，heap_destroy 时自动调用
+void heap_stop_async_free(heap_t *h);
+
+// 没有启动后台线程时等同于 mem_free
+void mem_free_async(uint64_t payload_vaddr);
+void mem_free_async(heap_t *h, uint64_t payload_vaddr);
+
+// 在调用线程中立即释放全部缓冲区中已经放入的块
+void async_free_drain(heap_t *h);
+async_free_stats_t async_free_stats(heap_t *h);
+
+#endif //MALLOC_ASYNC_FREE_H
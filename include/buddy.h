@@ -0,0 +1,149 @@
+#ifndef MYMALLOC_BUDDY_H
+#define MYMALLOC_BUDDY_H
+
+#include <map>
+
+#include "linked-list.h"
+#include "allocator.h"
+
+// ================================================ //
+//        The implementation of buddy system        //
+// ================================================ //
+// payload >= BUDDY_MIN_PAYLOAD 且 <= BUDDY_MAX_BLOCKSIZE 的请求向上取整到 2 的幂次(至少一页)，由 buddy system 分配
+// buddy system 以 chunk 为单位向 boundary tag allocator 申请内存: 一个 chunk 是一个已分配的普通 block，
+// 其 payload 中按页对齐的 BUDDY_MAX_BLOCKSIZE 字节被切分为 2^order 页的 buddy block
+//  - 大小为 2^k 的 block 在 chunk 中的偏移 off 是 2^k 的整数倍，其 buddy 的偏移为 off ^ 2^k
+//  - 释放时只要 buddy 也是同样大小的空闲块就合并，合并到整个 chunk 时将 chunk 归还给 boundary tag allocator
+// buddy block 没有 header/footer，每一页的 order 以及分配/空闲状态记录在 chunk 之外(BUDDY_CHUNK::pages)
+// 同一 order 的空闲块组成一个显式链表，prev/next 保存在空闲块第一页的 [+0, +4) 与 [+4, +8)
+const uint32_t BUDDY_PAGE_SHIFT = 12;
+const uint32_t BUDDY_MAX_ORDER = 8;         // 2^8 pages = 1MB
+const uint32_t BUDDY_ORDER_NUM = BUDDY_MAX_ORDER + 1;
+const uint32_t BUDDY_CHUNK_PAGES = 1 << BUDDY_MAX_ORDER;
+const uint32_t BUDDY_MAX_BLOCKSIZE = BUDDY_CHUNK_PAGES << BUDDY_PAGE_SHIFT;
+const uint32_t BUDDY_MIN_PAYLOAD = 1 << BUDDY_PAGE_SHIFT;
+// 从 boundary tag allocator 申请的 payload 大小，保证其中存在一段按页对齐的 BUDDY_MAX_BLOCKSIZE 字节
+const uint32_t BUDDY_CHUNK_PAYLOAD = BUDDY_MAX_BLOCKSIZE + (1 << BUDDY_PAGE_SHIFT) - 8;
+
+// BUDDY_CHUNK::pages 中 block 第一页的记录: 低 7 bit 为 order，最高位表示空闲
+const uint8_t BUDDY_PAGE_FREE = 0x80;
+const uint8_t BUDDY_PAGE_ORDER_MASK = 0x7f;
+
+class BUDDY_FREE_LIST final : public LINKED_LIST_BASE<BUDDY_FREE_LIST> {
+    friend class LINKED_LIST_BASE<BUDDY_FREE_LIST>;
+public:
+    BUDDY_FREE_LIST() = default;
+    ~BUDDY_FREE_LIST() = default;
+
+protected:
+    uint64_t get_head() const {
+        return head_;
+    }
+
+    bool set_head(uint64_t new_head) {
+        head_ = new_head;
+        return true;
+    }
+
+    uint64_t get_count() const {
+        return count_;
+    }
+
+    bool set_count(uint64_t new_count) {
+        count_ = new_count;
+        return true;
+    }
+
+    bool destruct_node(uint64_t) {
+        return true;
+    }
+
+    bool is_nodes_equal(uint64_t first, uint64_t second) {
+        return first == second;
+    }
+
+    uint64_t get_node_prev(uint64_t block_vaddr) {
+        return get_field(block_vaddr, 0);
+    }
+
+    bool set_node_prev(uint64_t block_vaddr, uint64_t prev_vaddr) {
+        return set_field(block_vaddr, prev_vaddr, 0);
+    }
+
+    uint64_t get_node_next(uint64_t block_vaddr) {
+        return get_field(block_vaddr, 4);
+    }
+
+    bool set_node_next(uint64_t block_vaddr, uint64_t next_vaddr) {
+        return set_field(block_vaddr, next_vaddr, 4);
+    }
+
+private:
+    // 32-bit compressed block ptr at the beginning of the first page
+    static uint64_t get_field(uint64_t block_vaddr, uint32_t offset) {
+        if (block_vaddr == NIL) {
+            return NIL;
+        }
+
+        assert(block_vaddr % 4096 == 0);
+        return decompress_payload_ptr(*reinterpret_cast<uint32_t *>(&heap[block_vaddr + offset]));
+    }
+
+    static bool set_field(uint64_t block_vaddr, uint64_t block_ptr, uint32_t offset) {
+        if (block_vaddr == NIL) {
+            return false;
+        }
+
+        assert(block_vaddr % 4096 == 0);
+        assert(block_ptr % 4096 == 0);
+        *reinterpret_cast<uint32_t *>(&heap[block_vaddr + offset]) = compress_ptr(block_ptr);
+        return true;
+    }
+
+    uint64_t head_ = NIL;
+    uint64_t count_ = 0;
+};
+
+struct BUDDY_CHUNK {
+    uint64_t payload_vaddr = NIL;               // 向 boundary tag allocator 申请的 block
+    uint8_t pages[BUDDY_CHUNK_PAGES] = {0};     // 每个 buddy block 第一页的 order | BUDDY_PAGE_FREE
+    uint32_t requested[BUDDY_CHUNK_PAGES] = {0};// 已分配 buddy block 的请求大小，用于统计内部碎片
+};
+
+// internal fragmentation = 1 - requested_bytes / allocated_bytes
+typedef struct {
+    uint64_t chunk_count;       // 当前持有的 chunk 个数
+    uint64_t block_count;       // 已分配的 buddy block 个数
+    uint64_t requested_bytes;   // 已分配的 buddy block 的请求大小之和
+    uint64_t allocated_bytes;   // 已分配的 buddy block 的大小之和
+} buddy_stats_t;
+
+struct BUDDY_ALLOCATOR {
+    uint32_t bitmap = 0;    // bit k is set if free_lists[k] is not empty
+    BUDDY_FREE_LIST free_lists[BUDDY_ORDER_NUM];
+    std::map<uint64_t, BUDDY_CHUNK> chunks;     // key: chunk 中按页对齐的起始地址
+    buddy_stats_t stats = buddy_stats_t();
+};
+
+// 为 h 启用 buddy system，之后 h 上的页级请求由 buddy system 分配
+bool heap_enable_buddy();
+bool heap_enable_buddy(heap_t *h);
+// return nullptr if buddy system is not enabled
+const buddy_stats_t *heap_buddy_stats(heap_t *h);
+double buddy_internal_fragmentation(const buddy_stats_t *stats);
+
+// The buddy system of cur_heap
+// whether the request of payload_size should be allocated by the buddy system
+bool buddy_is_suitable(uint32_t payload_size);
+// return NIL if there is no free buddy block large enough
+uint64_t buddy_alloc(uint32_t payload_size);
+// add the payload of a block allocated from boundary tag allocator as a new chunk
+void buddy_add_chunk(uint64_t chunk_payload_vaddr);
+// return false if vaddr is not allocated by the buddy system
+// if a whole chunk becomes free, its payload is returned by released_chunk, otherwise NIL
+bool buddy_free(uint64_t payload_vaddr, uint64_t &released_chunk);
+// the size of the buddy block, 0 if vaddr is not allocated by the buddy system
+uint32_t buddy_get_block_size(uint64_t payload_vaddr);
+void buddy_check();
+
+#endif //MYMALLOC_BUDDY_H
@@ -8,35 +8,90 @@
 //   The implementation of the explict linked list  //
 // ================================================ //
 // 我们采用数组模拟heap，数组的index就是virtual address，从而直接定位到相应的块
-class EXPLICIT_FREE_LINKED_LIST final : public LINKED_LIST  {
+// prev 和 next 在空闲块中占 4 Byte(32 bits)，访问函数直接读写 heap 上的字段，可以被内联
+//  - prev 处于 块起始位置 偏移 4 Byte的位置
+//  - next 处于 块起始位置 偏移 8 Byte的位置
+class EXPLICIT_FREE_LINKED_LIST final : public LINKED_LIST_BASE<EXPLICIT_FREE_LINKED_LIST>  {
+    friend class LINKED_LIST_BASE<EXPLICIT_FREE_LINKED_LIST>;
 public:
     // construct function
+    EXPLICIT_FREE_LINKED_LIST() = default;
     EXPLICIT_FREE_LINKED_LIST(uint64_t head, uint64_t count)
         : head_(head), count_(count) {}
 
     // 由于heap上的空闲块，如果全部释放掉那么就变成了隐式空闲链表
     // 但是EXPLICIT FREE BLOCK 兼容 隐式空闲块
-    ~EXPLICIT_FREE_LINKED_LIST() override = default;
+    ~EXPLICIT_FREE_LINKED_LIST() = default;
 
 protected:
-    // EXPLICIT_FREE_LINKED_LIST中需要override的函数
-    uint64_t get_head() const override;
-    bool set_head(uint64_t new_head) override;
+    // EXPLICIT_FREE_LINKED_LIST中需要提供的访问函数
+    uint64_t get_head() const {
+        return head_;
+    }
 
-    uint64_t get_count() const override;
-    bool set_count(uint64_t new_count) override;
+    bool set_head(uint64_t new_head) {
+        head_ = new_head;
+        return true;
+    }
 
-    bool destruct_node(uint64_t node) override;
+    uint64_t get_count() const {
+        return count_;
+    }
 
-    bool is_nodes_equal(uint64_t first, uint64_t second) override;
+    bool set_count(uint64_t new_count) {
+        count_ = new_count;
+        return true;
+    }
 
-    uint64_t get_node_prev(uint64_t header_vaddr) override;
-    bool set_node_prev(uint64_t header_vaddr, uint64_t prev_vaddr) override;
+    // 没有额外分配内存，通过数组模拟链表，因此无需销毁
+    bool destruct_node(uint64_t node) {
+        return true;
+    }
 
-    uint64_t get_node_next(uint64_t header_vaddr) override;
-    bool set_node_next(uint64_t header_vaddr, uint64_t next_vaddr) override;
+    bool is_nodes_equal(uint64_t first, uint64_t second) {
+        return first == second;
+    }
+
+    uint64_t get_node_prev(uint64_t header_vaddr) {
+        return get_field(header_vaddr, 4);
+    }
+
+    bool set_node_prev(uint64_t header_vaddr, uint64_t prev_vaddr) {
+        return set_field(header_vaddr, prev_vaddr, 4);
+    }
+
+    uint64_t get_node_next(uint64_t header_vaddr) {
+        return get_field(header_vaddr, 8);
+    }
+
+    bool set_node_next(uint64_t header_vaddr, uint64_t next_vaddr) {
+        return set_field(header_vaddr, next_vaddr, 8);
+    }
 
 private:
+    // 32-bit compressed block ptr
+    static uint64_t get_field(uint64_t header_vaddr, uint32_t offset) {
+        if (header_vaddr == NIL) {
+            return NIL;
+        }
+
+        assert(header_vaddr % 8 == 4);
+        assert(get_block_size(header_vaddr) >= MIN_EXPLICIT_FREE_LIST_BLOCKSIZE);
+        return decompress_header_ptr(*reinterpret_cast<uint32_t *>(&heap[header_vaddr + offset]));
+    }
+
+    static bool set_field(uint64_t header_vaddr, uint64_t block_ptr, uint32_t offset) {
+        if (header_vaddr == NIL) {
+            return false;
+        }
+
+        assert(header_vaddr % 8 == 4);
+        assert(get_block_size(header_vaddr) >= MIN_EXPLICIT_FREE_LIST_BLOCKSIZE);
+        assert(block_ptr == NIL || (block_ptr % 8 == 4));
+        *reinterpret_cast<uint32_t *>(&heap[header_vaddr + offset]) = compress_ptr(block_ptr);
+        return true;
+    }
+
     uint64_t head_ = NIL;
     uint64_t count_ = 0;
 };
@@ -46,6 +101,5 @@ uint64_t explicit_list_search(uint32_t free_block_size);
 void explicit_list_insert(uint64_t free_header);
 void explicit_list_delete(uint64_t free_header);
 void explicit_list_check_free_block();
-extern std::shared_ptr<EXPLICIT_FREE_LINKED_LIST> explicit_list;
 
 #endif //MYMALLOC_EXPLICIT_LIST_H
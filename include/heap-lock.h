@@ -0,0 +1,162 @@
+#ifndef MALLOC_HEAP_LOCK_H
+#define MALLOC_HEAP_LOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "allocator.h"
+
+// ================================================ //
+//             Locks of a thread-safe heap          //
+// ================================================ //
+// heap_enable_thread_safe 之后，heap 上的操作可以在多个线程中同时进行，锁按照以下顺序获取:
+//  1. extend: heap 的拓展与 trim(移动 break，改变末尾块和 epilogue)
+//  2. stripes: header/footer 所在地址区间的锁，每 2^HEAP_LOCK_STRIPE_SHIFT 字节一个，按地址升序获取
+//     读写一个 header/footer(包括修改下一个 header 的 PA bit)前需要持有其所在区间的锁
+//     分割与合并需要的全部 stripe 一次性按升序获取，因此相邻 block 的合并不会死锁
+//  3. index: 空闲块管理结构的锁，small list / 每个 size class / rbt / buddy system / slab allocator 各一个
+//     index 锁只保护其管理结构本身，持有 index 锁时不会再获取其他锁
+// 空闲块从 index 中删除时一定持有其 header 的 stripe，因此 search 在 index 锁内记录候选块 stripe 的版本(heap_lock_observe)，
+// 之后获取 stripe 时版本没有变化，就说明候选块仍然在 index 中并且没有被修改过
+const uint32_t HEAP_LOCK_STRIPE_SHIFT = 12;
+const int HEAP_LOCK_CLASS_NUM = 64;
+
+struct HEAP_LOCKS {
+    std::mutex extend;
+    std::mutex small_list;
+    std::mutex classes[HEAP_LOCK_CLASS_NUM];    // explicit list: 0, segregated list: size class, TLSF: first level
+    std::mutex tree;
+    std::mutex buddy;
+    std::mutex slab;
+
+    // 版本号: 偶数为空闲，奇数为被持有
+    uint64_t stripe_count = 0;
+    std::unique_ptr<std::atomic<uint32_t>[]> stripes;
+};
+
+// 启用后不能关闭，需要在 heap 被多个线程使用之前调用，隐式空闲链表不支持多线程
+bool heap_enable_thread_safe();
+bool heap_enable_thread_safe(heap_t *h);
+
+// index 锁，单线程的 heap 返回 nullptr
+inline std::mutex *heap_small_list_lock() {
+    return cur_heap->locks != nullptr ? &cur_heap->locks->small_list : nullptr;
+}
+
+inline std::mutex *heap_class_lock(int c) {
+    return cur_heap->locks != nullptr ? &cur_heap->locks->classes[c] : nullptr;
+}
+
+inline std::mutex *heap_tree_lock() {
+    return cur_heap->locks != nullptr ? &cur_heap->locks->tree : nullptr;
+}
+
+inline std::mutex *heap_buddy_lock() {
+    return cur_heap->locks != nullptr ? &cur_heap->locks->buddy : nullptr;
+}
+
+inline std::mutex *heap_slab_lock() {
+    return cur_heap->locks != nullptr ? &cur_heap->locks->slab : nullptr;
+}
+
+// lock is nullptr for a single-threaded heap
+class HEAP_INDEX_GUARD {
+public:
+    explicit HEAP_INDEX_GUARD(std::mutex *lock) : lock_(lock) {
+        if (lock_ != nullptr) {
+            lock_->lock();
+        }
+    }
+
+    ~HEAP_INDEX_GUARD() {
+        if (lock_ != nullptr) {
+            lock_->unlock();
+        }
+    }
+
+    HEAP_INDEX_GUARD(const HEAP_INDEX_GUARD &) = delete;
+    HEAP_INDEX_GUARD& operator=(const HEAP_INDEX_GUARD &) = delete;
+
+private:
+    std::mutex *lock_;
+};
+
+// search 在 index 锁内对返回的候选块调用，记录其 stripe 的版本
+void heap_lock_observe(uint64_t header_vaddr);
+// 持有 header_vaddr 的 stripe 之后调用: 最近一次 observe 的是 header_vaddr，并且之后没有其他线程持有过其 stripe
+bool heap_lock_is_observed(uint64_t header_vaddr);
+
+// 一次操作需要的 stripe 集合，按升序获取
+class STRIPE_SET {
+public:
+    explicit STRIPE_SET(HEAP_LOCKS *locks) : locks_(locks) {}
+
+    ~STRIPE_SET() {
+        assert(!locked_);
+    }
+
+    STRIPE_SET(const STRIPE_SET &) = delete;
+    STRIPE_SET& operator=(const STRIPE_SET &) = delete;
+
+    // the stripe of the 4-byte word at vaddr, ignored if out of cur_heap
+    void add(uint64_t vaddr);
+    void clear();
+    // whether every stripe of other is in this set
+    bool covers(const STRIPE_SET &other) const;
+
+    void lock();
+    void unlock();
+
+private:
+    static const int MAX_STRIPES = 16;
+
+    HEAP_LOCKS *locks_;
+    uint64_t stripes_[MAX_STRIPES];
+    int count_ = 0;
+    bool locked_ = false;
+};
+
+// 以下函数不加锁地读取 header/footer，结果可能已经过时，只用于确定需要获取的 stripe
+// 获取之后需要在锁内重新计算一次，直到两次的结果一致
+// split the free block b found by search into [request][block_size - request]
+void heap_lock_alloc_footprint(STRIPE_SET &s, uint64_t b, uint32_t request);
+// free the allocated block req and merge it with prev and next
+void heap_lock_free_footprint(STRIPE_SET &s, uint64_t req);
+// extend the heap and allocate block_size from the last block (try_extend_heap_to_alloc)
+void heap_lock_extend_footprint(STRIPE_SET &s, uint32_t block_size);
+// shorten the last block (trim)
+void heap_lock_trim_footprint(STRIPE_SET &s, uint32_t pad);
+// resize the allocated block req to request in place, absorbing the next free block or extending the heap
+void heap_lock_resize_footprint(STRIPE_SET &s, uint64_t req, uint32_t request);
+
+// 获取 footprint 所需的全部 stripe，并确认在锁内重新计算的结果没有超出已经获取的部分
+template <class Footprint>
+void heap_lock_footprint(STRIPE_SET &s, Footprint footprint) {
+    for (;;) {
+        s.clear();
+        footprint(s);
+        s.lock();
+
+        STRIPE_SET check(cur_heap->locks.get());
+        footprint(check);
+        if (s.covers(check)) {
+            return;
+        }
+        s.unlock();
+    }
+}
+
+// 不加锁地读取末尾块是否为 >= min_size 的空闲块，用于判断是否需要进行 trim
+bool heap_lock_peek_last_free(uint32_t min_size);
+
+// 逐块遍历 heap 时使用(hand-over-hand): 持有一个 header 的 stripe 时，该块不会被合并到前一个块中，
+// 其下一个 header 也不会被合并掉，因此先获取下一个 header 的 stripe 再释放当前的，就可以逐块前进
+// 新获取的 stripe 不能低于已经持有的 stripe
+void heap_lock_stripe(uint64_t vaddr);
+void heap_unlock_stripe(uint64_t vaddr);
+// vaddr1 与 vaddr2 位于同一个 stripe
+bool heap_lock_same_stripe(uint64_t vaddr1, uint64_t vaddr2);
+
+#endif //MALLOC_HEAP_LOCK_H
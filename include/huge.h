@@ -0,0 +1,64 @@
+#ifndef MALLOC_HUGE_H
+#define MALLOC_HUGE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "allocator.h"
+
+// ================================================ //
+//      Direct mmap for huge allocations            //
+// ================================================ //
+// heap_enable_huge_mappings 之后，payload >= threshold 的请求不经过 boundary tag allocator，而是单独映射一段内存:
+//  - 与 brk 从低地址向上增长、mmap 区域从高地址向下增长相同，mapping 位于 heap 区间的顶端 [low, start_vaddr + max_size)，
+//    break 不能超过 low，新的 mapping 也不能低于 break
+//  - mapping 按页对齐，payload 就是 mapping 的起始地址，没有 header/footer，大小记录在 HUGE_MAPPINGS::mappings
+//  - mem_free 直接解除映射，物理页立即归还给OS，不会因为位于 heap 中间而挡住 trim
+//  - huge_realloc 增长时优先原地映射上方的空闲区间，否则以 mremap 将页表移动到新的区间，不复制数据
+// 多线程模式下 mappings 由一把锁保护；改变 low 时先持有 extend 锁，因此 break 与 low 不会同时移动
+const uint64_t HUGE_DEFAULT_THRESHOLD = 128 * 1024;
+const uint64_t HUGE_MIN_THRESHOLD = 4096;
+
+typedef struct {
+    uint64_t mapping_count;     // 当前的 mapping 个数
+    uint64_t mapped_bytes;      // 当前映射的字节数
+    uint64_t remap_count;       // 以 mremap 移动 mapping 的次数
+} huge_stats_t;
+
+struct HUGE_MAPPINGS {
+    // 多线程模式下使用
+    std::mutex lock;
+    uint64_t threshold = HUGE_DEFAULT_THRESHOLD;
+    // 全部 mapping 都位于 [low, start_vaddr + max_size)，没有 mapping 时为 start_vaddr + max_size
+    // 在锁内修改，huge_owns 不加锁地读取
+    std::atomic<uint64_t> low{0};
+    std::map<uint64_t, uint64_t> mappings;      // payload vaddr -> mapping size(页对齐)
+    huge_stats_t stats = huge_stats_t();
+
+    // 解除全部的 mapping
+    ~HUGE_MAPPINGS();
+};
+
+// 与其他 heap_enable_* 相同，不能与其他线程对 h 的操作同时进行
+bool heap_enable_huge_mappings(uint64_t threshold = HUGE_DEFAULT_THRESHOLD);
+bool heap_enable_huge_mappings(heap_t *h, uint64_t threshold = HUGE_DEFAULT_THRESHOLD);
+huge_stats_t heap_huge_stats(heap_t *h);
+
+// The huge mappings of cur_heap
+bool huge_is_suitable(size_t payload_size);
+// return NIL if there is no address range large enough or mmap fails
+uint64_t huge_alloc(size_t payload_size);
+// 不加锁，vaddr 是否可能属于一个 mapping
+bool huge_owns(uint64_t vaddr);
+// return false if payload_vaddr is not a mapping
+bool huge_free(uint64_t payload_vaddr);
+// the mapping size of payload_vaddr, 0 if it is not a mapping
+uint64_t huge_get_size(uint64_t payload_vaddr);
+// resize the mapping to hold new_size bytes, the payload may move
+// return NIL if it cannot be resized, and the old mapping is kept
+uint64_t huge_realloc(uint64_t payload_vaddr, size_t new_size);
+
+#endif //MALLOC_HUGE_H
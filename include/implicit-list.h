@@ -0,0 +1,9 @@
+#ifndef MYMALLOC_IMPLICIT_LIST_H
+#define MYMALLOC_IMPLICIT_LIST_H
+
+#include "allocator.h"
+
+// 遍历整个heap，返回第一块 >= free_block_size 的空闲块(首次适应)，不存在则返回NIL
+uint64_t implicit_list_search(uint32_t free_block_size);
+
+#endif //MYMALLOC_IMPLICIT_LIST_H
@@ -17,35 +17,35 @@
 // 但是不可以对 `(uint64_t)node_ptr`赋值，需要 `*(uint64_t *)&node_ptr` 这样赋值
 const int NULL_LIST_NODE = 0;
 
-class LINKED_LIST {
+// ================================================ //
+//     The CRTP base class of the linked list       //
+// ================================================ //
+// 链表的插入、删除、遍历只依赖于节点的访问函数(get_node_next/set_node_prev/set_count ...)
+// 派生类以 `class X : public LINKED_LIST_BASE<X>` 的形式继承(CRTP)，并提供这些访问函数
+// 算法通过 derived() 静态地调用派生类的访问函数，可以被内联，没有虚函数的开销
+// 派生类中的访问函数可以是 protected，但需要将 LINKED_LIST_BASE<X> 声明为友元
+template <class Derived>
+class LINKED_LIST_BASE {
 public:
-    // ========== 拷贝控制 ========== //
-    LINKED_LIST() = default;
-
-    // 继承体系中，我们只需要删除相应的成员即可
-    // 因此，虽然析构函数都是调用delete_list私有成员函数
-    // delete_list调用其余纯虚函数提供的接口来实现，可以屏蔽下层数据结构所带来的差异
-    // ⭐⭐⭐ 但是运行到基类时，子类已经不存在了，因此调用的是基类的delete_list以及基类的纯虚函数，这是错误的！！！
-    virtual ~LINKED_LIST() = default;
-
     // ========== 通用函数 ========== //
-    // 下面的纯虚函数屏蔽了struct node在底层结构上的差异
-    // 通过调用下面的纯虚函数使得此部分提供的函数变得更加通用
+    // 通过调用派生类的访问函数屏蔽了struct node在底层结构上的差异，使得此部分提供的函数变得更加通用
     bool insert_node(uint64_t node);
     bool delete_node(uint64_t node);
+    // 将 other 的全部节点接到链表的末尾，other 变为空链表，O(1)
+    bool splice(Derived &other);
     uint64_t count() const {
-        return get_count();
+        return derived().get_count();
     }
 
     uint64_t head() const {
-        return get_head();
+        return derived().get_head();
     }
 
     uint64_t get_next_node(uint64_t node) {
-        return get_node_next(node);
+        return derived().get_node_next(node);
     }
     uint64_t get_prev_node(uint64_t node) {
-        return get_node_prev(node);
+        return derived().get_node_prev(node);
     }
 
     // for traverse the linked list
@@ -53,9 +53,41 @@ public:
     uint64_t get_node_by_index(uint64_t index);
 
 protected:
+    // 只能作为基类使用
+    LINKED_LIST_BASE() = default;
+    ~LINKED_LIST_BASE() = default;
+
+    Derived &derived() {
+        return *static_cast<Derived *>(this);
+    }
+
+    const Derived &derived() const {
+        return *static_cast<const Derived *>(this);
+    }
+
     // return true if node is null
-    bool is_null_node(uint64_t node);
+    bool is_null_node(uint64_t node) const {
+        return node == NULL_LIST_NODE;
+    }
+};
 
+// ================================================ //
+//      The virtual flavor of the linked list       //
+// ================================================ //
+// 节点的访问函数为虚函数，LINKED_LIST_BASE<LINKED_LIST> 中的每一次访问都是一次虚函数调用
+class LINKED_LIST : public LINKED_LIST_BASE<LINKED_LIST> {
+    friend class LINKED_LIST_BASE<LINKED_LIST>;
+public:
+    // ========== 拷贝控制 ========== //
+    LINKED_LIST() = default;
+
+    // 继承体系中，我们只需要删除相应的成员即可
+    // 因此，虽然析构函数都是调用delete_list私有成员函数
+    // delete_list调用其余纯虚函数提供的接口来实现，可以屏蔽下层数据结构所带来的差异
+    // ⭐⭐⭐ 但是运行到基类时，子类已经不存在了，因此调用的是基类的delete_list以及基类的纯虚函数，这是错误的！！！
+    virtual ~LINKED_LIST() = default;
+
+protected:
     // ========== 纯虚函数 ========== //
     // 由于不同的struct node的结构不同，因此这些函数的具体实现也尽不相同
     // 故设置为纯虚函数，让子类去实现
@@ -101,7 +133,8 @@ typedef struct INT_LINKED_LIST_NODE {
     INT_LINKED_LIST_NODE(int v) : value(v) {}
 } int_linked_list_node_t;
 
-class INT_LINKED_LIST final : public LINKED_LIST  {
+class INT_LINKED_LIST final : public LINKED_LIST_BASE<INT_LINKED_LIST>  {
+    friend class LINKED_LIST_BASE<INT_LINKED_LIST>;
 public:
     // construct function
     INT_LINKED_LIST(uint64_t head, uint64_t count)
@@ -109,27 +142,27 @@ public:
 
     // 派生类中没有自己的成员变量需要被管理，因此设置为default即可
     // 然后调用父类的析构函数释放相关内存
-    ~INT_LINKED_LIST() override {
+    ~INT_LINKED_LIST() {
         delete_list();
     };
 
 protected:
-    // INT_LINKED_LIST中需要override的函数
-    inline uint64_t get_head() const override;
-    inline bool set_head(uint64_t new_head) override;
+    // INT_LINKED_LIST中需要提供的访问函数
+    uint64_t get_head() const;
+    bool set_head(uint64_t new_head);
 
-    inline uint64_t get_count() const override;
-    inline bool set_count(uint64_t new_count) override;
+    uint64_t get_count() const;
+    bool set_count(uint64_t new_count);
 
-    bool destruct_node(uint64_t node) override;
+    bool destruct_node(uint64_t node);
 
-    bool is_nodes_equal(uint64_t first, uint64_t second) override;
+    bool is_nodes_equal(uint64_t first, uint64_t second);
 
-    uint64_t get_node_prev(uint64_t node) override;
-    bool set_node_prev(uint64_t node, uint64_t prev) override;
+    uint64_t get_node_prev(uint64_t node);
+    bool set_node_prev(uint64_t node, uint64_t prev);
 
-    uint64_t get_node_next(uint64_t node) override;
-    bool set_node_next(uint64_t node, uint64_t next) override;
+    uint64_t get_node_next(uint64_t node);
+    bool set_node_next(uint64_t node, uint64_t next);
 
 private:
     void delete_list();
@@ -138,4 +171,150 @@ private:
     uint64_t count_;
 };
 
-#endif //MALLOC_LINKED_LIST_H
\ No newline at end of file
+/*======================================*/
+/*      Base class Implementation       */
+/*======================================*/
+template <class Derived>
+bool LINKED_LIST_BASE<Derived>::insert_node(uint64_t node) {
+    uint64_t cur_head = derived().get_head();
+    uint64_t cur_count = derived().get_count();
+
+    if (is_null_node(node)) {
+        return false;
+    }
+
+    if (cur_head == NULL_LIST_NODE && cur_count == 0) {
+        // 当前是一个空链表
+        // create a new head
+        derived().set_head(node);
+        derived().set_count(1);
+
+        // circular linked list initialization
+        derived().set_node_prev(node, node);
+        derived().set_node_next(node, node);
+
+        return true;
+    } else if (cur_head != NULL_LIST_NODE && cur_count != 0) {
+        // 当前链表不是空链表
+        // 头插法: insert to head
+        uint64_t head_prev = derived().get_node_prev(cur_head);
+
+        derived().set_node_next(node, cur_head);
+        derived().set_node_prev(cur_head, node);
+
+        derived().set_node_next(head_prev, node);
+        derived().set_node_prev(node, head_prev);
+
+        derived().set_head(node);
+        derived().set_count(cur_count + 1);
+
+        return true;
+    } else {
+        // 非法情况
+        return false;
+    }
+}
+
+
+template <class Derived>
+bool LINKED_LIST_BASE<Derived>::delete_node(uint64_t node) {
+    uint64_t cur_head = derived().get_head();
+    uint64_t cur_count = derived().get_count();
+
+    if (cur_head == NULL_LIST_NODE || is_null_node(node)) {
+        return false;
+    }
+
+    // update the prev and next pointers
+    // !!! same for the only one node situation
+    uint64_t prev = derived().get_node_prev(node);
+    uint64_t next = derived().get_node_next(node);
+
+    derived().set_node_next(prev, next);
+    derived().set_node_prev(next, prev);
+
+    // if this node to be free is the head
+    if (derived().is_nodes_equal(node, cur_head)) {
+        derived().set_head(next);
+    }
+
+    derived().destruct_node(node);
+
+    --cur_count;
+    derived().set_count(cur_count);
+
+    // 如果只有一个节点时
+    if (cur_count == 0) {
+        derived().set_head(NULL_LIST_NODE);
+    }
+
+    return true;
+}
+
+template <class Derived>
+bool LINKED_LIST_BASE<Derived>::splice(Derived &other) {
+    uint64_t other_head = other.get_head();
+    uint64_t other_count = other.get_count();
+
+    if (other_head == NULL_LIST_NODE) {
+        // 空链表，无需移动
+        return other_count == 0;
+    }
+
+    uint64_t cur_head = derived().get_head();
+    uint64_t cur_count = derived().get_count();
+
+    if (cur_head == NULL_LIST_NODE) {
+        // 当前是一个空链表，直接接管 other 的节点
+        derived().set_head(other_head);
+    } else {
+        // [cur_head ... cur_tail][other_head ... other_tail]，两个环合并为一个环
+        uint64_t cur_tail = derived().get_node_prev(cur_head);
+        uint64_t other_tail = other.get_node_prev(other_head);
+
+        derived().set_node_next(cur_tail, other_head);
+        derived().set_node_prev(other_head, cur_tail);
+
+        derived().set_node_next(other_tail, cur_head);
+        derived().set_node_prev(cur_head, other_tail);
+    }
+    derived().set_count(cur_count + other_count);
+
+    other.set_head(NULL_LIST_NODE);
+    other.set_count(0);
+
+    return true;
+}
+
+template <class Derived>
+uint64_t LINKED_LIST_BASE<Derived>::get_next() {
+    uint64_t cur_head = derived().get_head();
+
+    if (cur_head == NULL_LIST_NODE) {
+        return NULL_LIST_NODE;
+    }
+
+    uint64_t new_head = derived().get_node_next(cur_head);
+    derived().set_head(new_head);
+
+    return cur_head;
+}
+
+template <class Derived>
+uint64_t LINKED_LIST_BASE<Derived>::get_node_by_index(uint64_t index) {
+    uint64_t cur_head = derived().get_head();
+    uint64_t cur_count = derived().get_count();
+
+    // index in [0, cur_count)
+    if (cur_head == NULL_LIST_NODE || index >= cur_count) {
+        return NULL_LIST_NODE;
+    }
+
+    for (int i = 0; i < index; ++i) {
+        cur_head = derived().get_node_next(cur_head);
+    }
+
+    return cur_head;
+}
+
+#endif //MALLOC_LINKED_LIST_H
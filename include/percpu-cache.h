@@ -0,0 +1,70 @@
+#ifndef MALLOC_PERCPU_CACHE_H
+#define MALLOC_PERCPU_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+
+#include "allocator.h"
+#include "tcache.h"
+
+// ================================================ //
+//         Per-CPU cache with restartable sequences //
+// ================================================ //
+// heap_enable_percpu_cache 之后，mem_alloc/mem_free 的小请求经过当前 CPU 的缓存，不再经过各线程的 tcache
+// 缓存的块数只与 CPU 的个数有关，与线程数无关: 每个 CPU 每个 bin 最多 PERCPU_BIN_CAPACITY 块
+//  - 缓存中的块在 heap 看来仍然是已分配的，bin 与 tcache 相同(按 alloc_block_size 划分)
+//  - 每个 bin 是一个保存 payload 地址的数组栈，push/pop 是一个 rseq(restartable sequence)临界区:
+//    线程在临界区内被抢占或迁移到其他 CPU 时，内核使其跳转到 abort 处重新开始，因此不需要加锁或原子操作
+//    临界区的最后一条指令(写入栈顶)是提交点
+//  - rseq 不可用时(非 x86-64、glibc 没有注册 rseq)，以 sched_getcpu 选择 CPU，并持有该 CPU 的锁
+// 缓存在多个线程之间共享，因此 heap 需要处于多线程模式(heap_enable_thread_safe)
+#if defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#define PERCPU_CACHE_RSEQ
+#endif
+#endif
+
+const uint32_t PERCPU_BIN_CAPACITY = 32;
+const uint32_t PERCPU_BATCH = PERCPU_BIN_CAPACITY / 2;
+
+// 一个 CPU 的缓存，按 cache line 对齐，不同 CPU 之间不共享 cache line
+struct alignas(64) PERCPU_SLAB {
+    // rseq 不可用时使用
+    std::mutex lock;
+    uint32_t tops[TCACHE_BIN_NUM] = {0};
+    uint32_t items[TCACHE_BIN_NUM][PERCPU_BIN_CAPACITY] = {{0}};  // compress_ptr(payload)
+};
+
+struct PERCPU_CACHE {
+    uint32_t cpu_count = 0;
+    bool use_rseq = false;
+    // C++11 的 new 不保证 64 字节对齐，因此以 posix_memalign 分配
+    PERCPU_SLAB *slabs = nullptr;
+
+    PERCPU_CACHE(uint32_t cpus, bool rseq);
+    ~PERCPU_CACHE();
+};
+
+// statistics of the calling thread
+typedef struct {
+    uint64_t hits;          // 直接由当前 CPU 的缓存满足的 alloc
+    uint64_t misses;        // bin 为空，需要从 heap 补充的 alloc
+    uint64_t aborts;        // 被内核中止并重新开始的 rseq 临界区
+} percpu_stats_t;
+
+// 为多线程模式的 h 启用 per-CPU cache，use_rseq = false 时总是使用加锁的方式
+bool heap_enable_percpu_cache(bool use_rseq = true);
+bool heap_enable_percpu_cache(heap_t *h, bool use_rseq = true);
+
+// 将全部 CPU 中的块归还给 heap
+// rseq 临界区无法被其他线程打断，因此 use_rseq 时调用者需要保证没有其他线程在使用 h；加锁的方式下没有限制
+void percpu_cache_flush(heap_t *h);
+const percpu_stats_t *percpu_stats();
+
+// The per-CPU cache of cur_heap, used by mem_alloc/mem_free
+// return NIL if the heap cannot allocate
+uint64_t percpu_alloc(uint32_t payload_size);
+// return false if the block is not cached and should be freed to the heap
+bool percpu_free(uint64_t payload_vaddr);
+
+#endif //MALLOC_PERCPU_CACHE_H
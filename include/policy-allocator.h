@@ -0,0 +1,1112 @@
+#ifndef MALLOC_POLICY_ALLOCATOR_H
+#define MALLOC_POLICY_ALLOCATOR_H
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+#include "allocator.h"
+#include "small-list.h"
+#include "quick-list.h"
+#include "explicit-list.h"
+#include "implicit-list.h"
+#include "redblack-tree.h"
+#include "segregated-list.h"
+#include "tlsf.h"
+#include "buddy.h"
+#include "slab.h"
+#include "heap-lock.h"
+#include "scavenger.h"
+
+// ================================================ //
+//       The allocation and free algorithm          //
+// ================================================ //
+// 分配、分割、向OS申请、合并、trim 的流程与空闲块的管理方式无关，因此以 Index 作为模板参数
+// Index 需要提供以下静态函数:
+//  - uint64_t search_free_block(uint32_t payload_size, uint32_t &alloc_block_size)
+//  - void insert_free_block(uint64_t free_header)
+//  - void delete_free_block(uint64_t free_header)
+//  - void check_free_block()
+// 运行时选择策略的 mem_alloc/mem_free 使用 cur_heap->policy 作为 Index
+// ALLOCATOR<FreeIndex, SmallIndex> 在编译期确定 Index，热路径上没有间接调用
+// 所有的 block 操作均作用于 cur_heap
+// heap 启用了 buddy system 时，页级的请求由 buddy system 分配，buddy system 的 chunk 由 alloc_block 分配
+// heap 启用了 slab allocator 时，小对象由 slab allocator 分配，其 span 同样由 alloc_block 分配
+// heap 启用了多线程模式(cur_heap->locks)时，分割、合并、拓展与 trim 在持有所修改的 header/footer 的 stripe 时进行，
+// Index 的函数在内部获取各自的 index 锁，锁的顺序见 heap-lock.h
+// heap 启用了 quick list 时，[16, 256] Byte block 的释放推迟到 consolidate_quick_lists 时合并
+template <class Index>
+class HEAP_ALGORITHM {
+public:
+    static uint64_t alloc(uint32_t size);
+    static void free(uint64_t payload_vaddr);
+    static bool trim(uint32_t pad);
+    // 原地调整失败时分配新的块并复制，失败时返回 NIL，原来的块不变
+    static uint64_t realloc(uint64_t payload_vaddr, uint32_t size);
+    // 原地将已分配的块调整为可以容纳 size 字节，失败时不修改 heap
+    static bool resize(uint64_t payload_vaddr, uint32_t size);
+    // 已分配的块实际可以使用的字节数
+    static uint64_t usable_size(uint64_t payload_vaddr);
+
+private:
+    // boundary tag allocator
+    static uint64_t alloc_block(uint32_t size);
+    static void free_block(uint64_t payload_vaddr);
+    static bool trim_block(uint32_t pad);
+    static void consolidate_quick_lists();
+
+    // thread-safe heap
+    static uint64_t alloc_block_concurrent(uint32_t size);
+    static uint64_t try_alloc_observed(uint64_t block_vaddr, uint32_t request_block_size);
+    static bool resize_block_concurrent(uint64_t req, uint32_t request_block_size);
+
+    static void coalesce(uint64_t req);
+    static uint64_t try_alloc_with_splitting(uint64_t block_vaddr, uint32_t request_block_size);
+    static uint64_t try_extend_heap_to_alloc(uint32_t size);
+    static bool try_resize_block(uint64_t req, uint32_t request_block_size, bool can_extend);
+
+    // 多线程模式下其他线程可能正在修改 heap，无法检查整个 heap
+    static void count(uint64_t &counter) {
+        if (cur_heap->locks != nullptr) {
+            __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+        } else {
+            counter += 1;
+        }
+    }
+
+    static void check_after_update() {
+#ifdef DEBUG_MALLOC
+        if (cur_heap->locks == nullptr) {
+            check_heap_correctness();
+            Index::check_free_block();
+        }
+#endif
+    }
+};
+
+// 首次适配内存分配算法：找到第一块合适的block用于分配
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::try_alloc_with_splitting(uint64_t block_vaddr, uint32_t request_block_size) {
+    if (request_block_size < 8) {
+        return NIL;
+    }
+
+    uint64_t b = block_vaddr;
+    uint32_t b_block_size = get_block_size(b);
+    uint32_t b_allocated = get_allocated(b);
+
+    if (b_allocated == FREE && b_block_size >= request_block_size) {
+        // b 内部被 purge 的页在分配出去后第一次访问时由OS重新提交
+        // 分割剩下的部分仍然处于 b 的内部，无需再次 purge
+        bool b_purged = is_block_purged(b);
+
+        // 当剩余部分小于8 Byte，任何结构都无法满足，最低要求至少有8 Byte
+        // 不存在这种情况，因为分配的空间要求8 Byte对齐，因此要分配后剩余空间小于 8 Byte，则会round up到全部大小
+        // wide heap 中没有 8-Byte block，剩余 8 Byte 时整块分配
+        uint32_t right_size = b_block_size - request_block_size;
+        if (right_size < get_min_block_size()) {
+            request_block_size = b_block_size;
+            right_size = 0;
+        }
+
+        // allocated this block
+        Index::delete_free_block(b);
+        uint64_t right_footer = get_footer(b);
+
+        // 已分配的块没有 footer，其 payload 延伸到下一个 header 之前
+        set_allocated(b, ALLOCATED);
+        set_block_size(b, request_block_size);
+
+        if (right_size != 0) {
+            // split this block `b`
+            uint64_t right_header = get_next_header(b);
+
+            // right_header 原来是 payload，先设置 size 再设置 allocated，使 PA bit 写在正确的下一个 header 上
+            set_block_size(right_header, right_size);
+            set_allocated(right_header, FREE);
+
+            set_block_size(right_footer, right_size);
+            set_allocated(right_footer, FREE);
+
+            assert(get_footer(right_header) == right_footer);
+
+            if (b_purged && right_size >= MIN_REDBLACK_TREE_BLOCKSIZE) {
+                set_block_purged(right_header);
+            }
+
+            Index::insert_free_block(right_header);
+            count(cur_heap->stats.split_count);
+        }
+        return get_payload(b);
+    }
+
+    // 当前空间无法满足分配或是已分配
+    return NIL;
+}
+
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::try_extend_heap_to_alloc(uint32_t size) {
+    // get the size to be added
+    uint64_t old_last = get_last_block();
+
+    uint32_t last_allocated = get_allocated(old_last);
+    uint32_t last_block_size = get_block_size(old_last);
+
+    // 非首次适配的 Index (如 TLSF 会将请求向上取整到下一个 size class) 可能找不到末尾已经足够大的空闲块
+    if (last_allocated == FREE && last_block_size >= size) {
+        return try_alloc_with_splitting(old_last, size);
+    }
+
+    uint32_t to_request_from_OS = size;
+    if (last_allocated == FREE) {
+        // last block can help the request
+        to_request_from_OS -= last_block_size;
+
+        Index::delete_free_block(old_last);
+    }
+
+    uint64_t old_epilogue = get_epilogue();
+
+    uint32_t os_allocated_size = extend_heap(to_request_from_OS);
+    if (os_allocated_size) {
+        // 成功进行heap拓展，将新申请的空间 + [原始末尾空闲块] -> 合并 + 管理起来
+        assert(os_allocated_size >= 4096);
+        assert(os_allocated_size % 4096 == 0);
+
+        uint64_t block_header = NIL;
+
+        // now last block is different
+        // but we check the old last block
+        if (last_allocated == ALLOCATED) {
+            // no merging is needed
+            // take place the old epilogue as new last
+            uint64_t new_last = old_epilogue;
+            set_allocated(new_last, FREE);
+            set_block_size(new_last, os_allocated_size);
+
+            uint64_t new_last_footer = get_footer(new_last);
+            set_block_size(new_last_footer, os_allocated_size);
+            set_allocated(new_last_footer, FREE);
+
+            Index::insert_free_block(new_last);
+
+            block_header = new_last;
+        } else {
+            // merging with last_block is needed
+            set_allocated(old_last, FREE);
+            set_block_size(old_last, last_block_size + os_allocated_size);
+
+            uint64_t last_footer = get_footer(old_last);
+            set_block_size(last_footer, last_block_size + os_allocated_size);
+            set_allocated(last_footer, FREE);
+
+            // block size is different now
+            // consider the balanced tree index on block size, it must be reinserted
+            Index::insert_free_block(old_last);
+
+            block_header = old_last;
+        }
+
+        // try to allocate
+        uint64_t payload_vaddr = try_alloc_with_splitting(block_header, size);
+        if (payload_vaddr != NIL)
+        {
+            check_after_update();
+            return payload_vaddr;
+        } else {
+            assert(false);
+        }
+    }
+
+    // else, no page can be allocated
+    // 将原来末尾的最后一块空闲块插入回去
+    if (last_allocated == FREE) {
+        Index::insert_free_block(old_last);
+    }
+
+    check_after_update();
+#ifdef DEBUG_MALLOC
+    printf("OS cannot allocate physical page for heap!\n");
+#endif
+
+    return NIL;
+}
+
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::alloc(uint32_t size) {
+    if (size <= 4 && cur_heap->small_stack != nullptr) {
+        // 不需要任何锁
+        uint64_t payload_vaddr = small_stack_pop();
+        if (payload_vaddr != NIL) {
+            return payload_vaddr;
+        }
+    }
+
+    if (slab_is_suitable(size)) {
+        uint64_t payload_vaddr = slab_alloc(size);
+        while (payload_vaddr == NIL) {
+            // 没有空闲的 object 与页，向 boundary tag allocator 申请一个新的 span
+            // 多线程模式下新的 span 可能先被其他线程分完，因此重复直到分配成功
+            uint64_t span = alloc_block(SLAB_SPAN_PAYLOAD);
+            if (span == NIL) {
+                break;
+            }
+
+            slab_add_span(span);
+            payload_vaddr = slab_alloc(size);
+            assert(payload_vaddr != NIL || cur_heap->locks != nullptr);
+        }
+        return payload_vaddr;
+    }
+
+    if (cur_heap->quick_lists != nullptr && quick_list_is_suitable(size)) {
+        uint64_t payload_vaddr = quick_list_pop(size);
+        if (payload_vaddr != NIL) {
+            return payload_vaddr;
+        }
+    }
+
+    if (buddy_is_suitable(size)) {
+        uint64_t payload_vaddr = buddy_alloc(size);
+        while (payload_vaddr == NIL) {
+            // 没有足够大的 buddy block，向 boundary tag allocator 申请一个新的 chunk
+            // 多线程模式下新的 chunk 可能先被其他线程分完，因此重复直到分配成功
+            uint64_t chunk = alloc_block(BUDDY_CHUNK_PAYLOAD);
+            if (chunk == NIL) {
+                break;
+            }
+
+            buddy_add_chunk(chunk);
+            payload_vaddr = buddy_alloc(size);
+            assert(payload_vaddr != NIL || cur_heap->locks != nullptr);
+        }
+
+#ifdef DEBUG_MALLOC
+        if (cur_heap->locks == nullptr) {
+            buddy_check();
+        }
+#endif
+        return payload_vaddr;
+    }
+
+    return alloc_block(size);
+}
+
+template <class Index>
+void HEAP_ALGORITHM<Index>::free(uint64_t payload_vaddr) {
+    if (payload_vaddr == NIL) {
+        return;
+    }
+
+    // slab 的 object 没有 header，在读取 header 之前判断
+    uint64_t released_span = NIL;
+    if (slab_free(payload_vaddr, released_span)) {
+        // 整个 span 都空闲时，归还给 boundary tag allocator
+        free_block(released_span);
+        return;
+    }
+
+    if (cur_heap->small_stack != nullptr && small_stack_push(payload_vaddr)) {
+        return;
+    }
+
+    bool full = false;
+    if (cur_heap->quick_lists != nullptr && quick_list_push(payload_vaddr, full)) {
+        if (full) {
+            consolidate_quick_lists();
+        }
+        return;
+    }
+
+    uint64_t released_chunk = NIL;
+    if (buddy_free(payload_vaddr, released_chunk)) {
+        // 整个 chunk 都空闲时，归还给 boundary tag allocator
+        free_block(released_chunk);
+
+#ifdef DEBUG_MALLOC
+        if (cur_heap->locks == nullptr) {
+            buddy_check();
+        }
+#endif
+        return;
+    }
+
+    free_block(payload_vaddr);
+}
+
+template <class Index>
+bool HEAP_ALGORITHM<Index>::trim(uint32_t pad) {
+    // 先将 small stack 中的块合并，在获取 extend 锁之前进行(free_block 可能再调用 trim)
+    uint64_t p = small_stack_take_all();
+    while (p != NIL) {
+        uint64_t next = small_stack_next(p);
+        free_block(p);
+        p = next;
+    }
+    consolidate_quick_lists();
+
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    if (locks == nullptr) {
+        return trim_block(pad);
+    }
+
+    std::lock_guard<std::mutex> extend_guard(locks->extend);
+
+    STRIPE_SET s(locks);
+    heap_lock_footprint(s, [pad](STRIPE_SET &t) { heap_lock_trim_footprint(t, pad); });
+    bool released = trim_block(pad);
+    s.unlock();
+
+    return released;
+}
+
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::realloc(uint64_t payload_vaddr, uint32_t size) {
+    if (size == 0) {
+        if (payload_vaddr != NIL) {
+            free(payload_vaddr);
+        }
+        return NIL;
+    }
+    if (payload_vaddr == NIL) {
+        return alloc(size);
+    }
+
+    if (resize(payload_vaddr, size)) {
+        return payload_vaddr;
+    }
+
+    uint64_t old_size = usable_size(payload_vaddr);
+    uint64_t new_payload_vaddr = alloc(size);
+    if (new_payload_vaddr == NIL) {
+        return NIL;
+    }
+    memcpy(&heap[new_payload_vaddr], &heap[payload_vaddr], old_size < size ? old_size : size);
+    free(payload_vaddr);
+    return new_payload_vaddr;
+}
+
+template <class Index>
+bool HEAP_ALGORITHM<Index>::resize(uint64_t payload_vaddr, uint32_t size) {
+    assert(payload_vaddr != NIL && size > 0);
+
+    // slab object 与 buddy block 的大小固定，只能在其范围内调整
+    if (slab_owns(payload_vaddr)) {
+        return size <= slab_get_object_size(payload_vaddr);
+    }
+    uint32_t buddy_block_size = buddy_get_block_size(payload_vaddr);
+    if (buddy_block_size != 0) {
+        return size <= buddy_block_size;
+    }
+
+    uint64_t req = get_header(payload_vaddr);
+    uint32_t request_block_size = get_alloc_block_size(size);
+
+    if (cur_heap->locks != nullptr) {
+        return resize_block_concurrent(req, request_block_size);
+    }
+
+    uint32_t block_size = get_block_size(req);
+    bool resized = try_resize_block(req, request_block_size, true);
+
+    // 缩小之后末尾的空闲块足够大时，与 free_block 相同地 trim
+    uint64_t last = get_last_block();
+    if (resized && request_block_size < block_size && cur_heap->scavenger == nullptr &&
+        get_allocated(last) == FREE && get_block_size(last) >= HEAP_TRIM_THRESHOLD) {
+        trim_block(HEAP_TOP_PAD);
+    }
+    return resized;
+}
+
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::usable_size(uint64_t payload_vaddr) {
+    if (slab_owns(payload_vaddr)) {
+        return slab_get_object_size(payload_vaddr);
+    }
+    uint32_t buddy_block_size = buddy_get_block_size(payload_vaddr);
+    if (buddy_block_size != 0) {
+        return buddy_block_size;
+    }
+
+    // 块由调用者持有，其大小不会被其他线程修改
+    // 多线程模式下 get_block_size 在 DEBUG_MALLOC 下检查相邻块，可能与其他线程冲突，因此直接读取 header
+    uint32_t header_value = __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[get_header(payload_vaddr)]), __ATOMIC_RELAXED);
+    uint32_t block_size = ((header_value >> 2) & 0x1) ? 8 : (header_value & 0xFFFFFFF8);
+    // 已分配的块没有 footer，payload 延伸到下一个 header 之前
+    return block_size - 4;
+}
+
+// 将 quick list 中的块全部按原来的方式释放并合并
+template <class Index>
+void HEAP_ALGORITHM<Index>::consolidate_quick_lists() {
+    uint64_t p = quick_list_take_all();
+    while (p != NIL) {
+        uint64_t next = quick_list_next(p);
+        free_block(p);
+        p = next;
+    }
+}
+
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::alloc_block(uint32_t size) {
+    assert(0 < size && size < cur_heap->max_size - 4 - 8 - 4);
+
+    if (cur_heap->locks != nullptr) {
+        return alloc_block_concurrent(size);
+    }
+
+    uint32_t alloc_block_size = 0;
+    // 在当前heap中寻找合适的free_block，如果不存在则返回NIL
+    uint64_t payload_header = Index::search_free_block(size, alloc_block_size);
+    if (payload_header == NIL && !quick_list_is_empty()) {
+        // 拓展 heap 之前先合并 quick list 中的块，再 search 一次
+        consolidate_quick_lists();
+        payload_header = Index::search_free_block(size, alloc_block_size);
+    }
+    uint64_t payload_vaddr = NIL;
+
+    if (payload_header != NIL) {
+        // 找到了合适的空闲块
+        payload_vaddr = try_alloc_with_splitting(payload_header, alloc_block_size);
+        assert(payload_vaddr != NIL);
+    } else {
+        // 没有合适的空闲块，进行系统调用 system_brk()
+        payload_vaddr = try_extend_heap_to_alloc(alloc_block_size);
+        // 可能 OS 没有多余的内存的了，会返回NIL
+    }
+
+    check_after_update();
+
+    return payload_vaddr;
+}
+
+// search 返回的候选块在获取其 stripe 之前可能已经被其他线程分配或合并，获取之后确认其 stripe 的版本没有变化
+// 返回 NIL 表示需要重新 search
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::try_alloc_observed(uint64_t block_vaddr, uint32_t request_block_size) {
+    STRIPE_SET s(cur_heap->locks.get());
+    heap_lock_alloc_footprint(s, block_vaddr, request_block_size);
+    s.lock();
+
+    uint64_t payload_vaddr = NIL;
+    if (heap_lock_is_observed(block_vaddr)) {
+        payload_vaddr = try_alloc_with_splitting(block_vaddr, request_block_size);
+        assert(payload_vaddr != NIL);
+    }
+
+    s.unlock();
+    return payload_vaddr;
+}
+
+template <class Index>
+uint64_t HEAP_ALGORITHM<Index>::alloc_block_concurrent(uint32_t size) {
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+
+    uint32_t alloc_block_size = 0;
+    uint64_t b = Index::search_free_block(size, alloc_block_size);
+    if (b == NIL && !quick_list_is_empty()) {
+        // 在获取 extend 锁之前合并 quick list 中的块(free_block 可能再调用 trim)
+        consolidate_quick_lists();
+        b = Index::search_free_block(size, alloc_block_size);
+    }
+    while (b != NIL) {
+        uint64_t payload_vaddr = try_alloc_observed(b, alloc_block_size);
+        if (payload_vaddr != NIL) {
+            return payload_vaddr;
+        }
+        b = Index::search_free_block(size, alloc_block_size);
+    }
+
+    // 同一时刻只有一个线程拓展heap
+    std::lock_guard<std::mutex> extend_guard(locks->extend);
+    for (;;) {
+        // 等待期间其他线程可能已经拓展了heap或者释放了足够大的块
+        b = Index::search_free_block(size, alloc_block_size);
+        if (b == NIL) {
+            break;
+        }
+
+        uint64_t payload_vaddr = try_alloc_observed(b, alloc_block_size);
+        if (payload_vaddr != NIL) {
+            return payload_vaddr;
+        }
+    }
+
+    STRIPE_SET s(locks);
+    heap_lock_footprint(s, [alloc_block_size](STRIPE_SET &t) { heap_lock_extend_footprint(t, alloc_block_size); });
+    uint64_t payload_vaddr = try_extend_heap_to_alloc(alloc_block_size);
+    s.unlock();
+
+    return payload_vaddr;
+}
+
+template <class Index>
+void HEAP_ALGORITHM<Index>::free_block(uint64_t payload_vaddr) {
+    if (payload_vaddr == NIL) {
+        return;
+    }
+
+    assert(get_first_block() < payload_vaddr && payload_vaddr < get_epilogue());
+    assert((payload_vaddr & 0x7) == 0x0);
+
+    // request can be first or last block
+    uint64_t req = get_header(payload_vaddr);
+
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    if (locks != nullptr) {
+        STRIPE_SET s(locks);
+        heap_lock_footprint(s, [req](STRIPE_SET &t) { heap_lock_free_footprint(t, req); });
+        coalesce(req);
+        s.unlock();
+
+        // 不加锁地预先判断，避免每次 free 都获取 extend 锁；启用 scavenger 时由后台线程 trim
+        if (cur_heap->scavenger == nullptr && heap_lock_peek_last_free(HEAP_TRIM_THRESHOLD)) {
+            trim(HEAP_TOP_PAD);
+        }
+        return;
+    }
+
+    coalesce(req);
+
+    // 末尾的空闲块足够大时，将其多余的页归还给OS
+    uint64_t last = get_last_block();
+    if (cur_heap->scavenger == nullptr && get_allocated(last) == FREE && get_block_size(last) >= HEAP_TRIM_THRESHOLD) {
+        trim_block(HEAP_TOP_PAD);
+    }
+}
+
+// 将 req 标记为空闲，并与相邻的空闲块合并
+template <class Index>
+void HEAP_ALGORITHM<Index>::coalesce(uint64_t req) {
+    // req 已分配时没有 footer，释放之后才写入
+    uint64_t req_footer = get_footer(req);
+
+    // otherwise it's free twice
+    assert(get_allocated(req) == ALLOCATED);
+
+    // block starting address of next & prev blocks
+    uint64_t next = get_next_header(req);
+    uint64_t prev = get_prev_header(req);
+
+    uint32_t next_allocated = get_allocated(next);
+    uint32_t prev_allocated = get_allocated(prev);
+
+    // 合并后超过 HEAP_MAX_BLOCK_SIZE 的相邻空闲块保持分开，视为已分配
+    uint64_t merged_size = get_block_size(req);
+    if (next_allocated == FREE) {
+        merged_size += get_block_size(next);
+        if (merged_size > HEAP_MAX_BLOCK_SIZE) {
+            merged_size -= get_block_size(next);
+            next_allocated = ALLOCATED;
+        }
+    }
+    if (prev_allocated == FREE && merged_size + get_block_size(prev) > HEAP_MAX_BLOCK_SIZE) {
+        prev_allocated = ALLOCATED;
+    }
+
+    if (next_allocated == ALLOCATED && prev_allocated == ALLOCATED) {
+        // case 1: *A(A->F)A*
+        // ==> *AFA*
+        set_allocated(req, FREE);
+        set_block_size(req_footer, get_block_size(req));
+        set_allocated(req_footer, FREE);
+
+        // 更新空闲块信息
+        Index::insert_free_block(req);
+        check_after_update();
+    } else if (next_allocated == FREE && prev_allocated == ALLOCATED) {
+        // case 2: *A(A->F)FA
+        // ==> *AFFA ==> *A[FF]A merge current and next
+        Index::delete_free_block(next);
+
+        uint64_t one_free = merge_blocks_as_free(req, next);
+        count(cur_heap->stats.coalesce_count);
+
+        Index::insert_free_block(one_free);
+        check_after_update();
+    } else if (next_allocated == ALLOCATED && prev_allocated == FREE) {
+        // case 3: AF(A->F)A*
+        // ==> AFFA* ==> A[FF]A* merge current and prev
+        Index::delete_free_block(prev);
+
+        uint64_t one_free = merge_blocks_as_free(prev, req);
+        count(cur_heap->stats.coalesce_count);
+
+        Index::insert_free_block(one_free);
+        check_after_update();
+    } else if (next_allocated == FREE && prev_allocated == FREE) {
+        // case 4: AF(A->F)FA
+        // ==> AFFFA ==> A[FFF]A merge current and prev and next
+        Index::delete_free_block(prev);
+        Index::delete_free_block(next);
+
+        uint64_t one_free = merge_blocks_as_free(merge_blocks_as_free(prev, req), next);
+        count(cur_heap->stats.coalesce_count);
+        count(cur_heap->stats.coalesce_count);
+
+        Index::insert_free_block(one_free);
+        check_after_update();
+    } else {
+#ifdef DEBUG_MALLOC
+        printf("exception for free\n");
+        exit(0);
+#endif
+    }
+}
+
+// 原地将已分配的 req 调整为 request_block_size:
+//  - 缩小: 与 try_alloc_with_splitting 相同，分割出末尾的空闲块，并与后面的空闲块合并
+//  - 增长: 吸收后面的空闲块，req(与其后的空闲块)是最后一块时拓展 heap，多出的部分再分割出去
+// 无法原地调整时返回 false，heap 不变
+template <class Index>
+bool HEAP_ALGORITHM<Index>::try_resize_block(uint64_t req, uint32_t request_block_size, bool can_extend) {
+    assert(get_allocated(req) == ALLOCATED);
+
+    uint32_t block_size = get_block_size(req);
+    uint64_t total_size = block_size;
+
+    if (request_block_size > block_size) {
+        uint64_t next = get_next_header(req);
+        bool absorb_next = get_allocated(next) == FREE &&
+                           (uint64_t)block_size + get_block_size(next) <= HEAP_MAX_BLOCK_SIZE;
+        if (absorb_next) {
+            total_size += get_block_size(next);
+        }
+
+        uint32_t os_allocated_size = 0;
+        if (total_size < request_block_size) {
+            uint64_t after = absorb_next ? get_next_header(next) : next;
+            if (!can_extend || after != get_epilogue()) {
+                return false;
+            }
+
+            // 先拓展，失败时 heap 不变
+            os_allocated_size = extend_heap((uint32_t)(request_block_size - total_size));
+            if (os_allocated_size == 0) {
+                return false;
+            }
+        }
+
+        if (absorb_next) {
+            Index::delete_free_block(next);
+            scavenger_cursor_absorbed(next, req);
+            count(cur_heap->stats.coalesce_count);
+        }
+        total_size += os_allocated_size;
+
+        // req 仍然是已分配的块，PA bit 写在新的下一个 header 上
+        set_block_size(req, (uint32_t)total_size);
+    }
+
+    // 剩余部分不足最小块时保留在 req 中
+    uint32_t right_size = (uint32_t)(total_size - request_block_size);
+    if (right_size >= get_min_block_size()) {
+        set_block_size(req, request_block_size);
+
+        // right_header 原来是 payload，先设置 size 再设置 allocated
+        uint64_t right_header = get_next_header(req);
+        set_block_size(right_header, right_size);
+        set_allocated(right_header, FREE);
+
+        uint64_t right_footer = get_footer(right_header);
+        set_block_size(right_footer, right_size);
+        set_allocated(right_footer, FREE);
+
+        uint64_t next = get_next_header(right_header);
+        if (get_allocated(next) == FREE && (uint64_t)right_size + get_block_size(next) <= HEAP_MAX_BLOCK_SIZE) {
+            Index::delete_free_block(next);
+            right_header = merge_blocks_as_free(right_header, next);
+            count(cur_heap->stats.coalesce_count);
+        }
+
+        Index::insert_free_block(right_header);
+        count(cur_heap->stats.split_count);
+    }
+
+    check_after_update();
+    return true;
+}
+
+// 先不拓展 heap，在 req 附近的 stripe 内尝试；需要拓展时再按 extend -> stripes 的顺序重新获取锁
+template <class Index>
+bool HEAP_ALGORITHM<Index>::resize_block_concurrent(uint64_t req, uint32_t request_block_size) {
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    auto footprint = [req, request_block_size](STRIPE_SET &t) {
+        heap_lock_resize_footprint(t, req, request_block_size);
+    };
+
+    STRIPE_SET s(locks);
+    heap_lock_footprint(s, footprint);
+    uint32_t block_size = get_block_size(req);
+    bool resized = try_resize_block(req, request_block_size, false);
+    s.unlock();
+
+    if (!resized && request_block_size > block_size) {
+        std::lock_guard<std::mutex> extend_guard(locks->extend);
+        heap_lock_footprint(s, footprint);
+        resized = try_resize_block(req, request_block_size, true);
+        s.unlock();
+    }
+
+    if (resized && request_block_size < block_size &&
+        cur_heap->scavenger == nullptr && heap_lock_peek_last_free(HEAP_TRIM_THRESHOLD)) {
+        trim(HEAP_TOP_PAD);
+    }
+    return resized;
+}
+
+template <class Index>
+bool HEAP_ALGORITHM<Index>::trim_block(uint32_t pad) {
+    uint64_t last = get_last_block();
+    if (get_allocated(last) == ALLOCATED) {
+        return false;
+    }
+
+    // 末尾空闲块至少保留 pad 字节，并且不能小于空闲链表所需的最小块，剩余的整页归还给OS
+    // last % 8 == 4 且 new_end_vaddr % 8 == 0，因此新的块大小仍然是8字节对齐的
+    uint64_t keep_size = pad > MIN_EXPLICIT_FREE_LIST_BLOCKSIZE ? pad : MIN_EXPLICIT_FREE_LIST_BLOCKSIZE;
+    uint64_t new_end_vaddr = round_up(last + keep_size + 4, 4096);
+    if (new_end_vaddr >= cur_heap->end_vaddr) {
+        // 没有可以归还的页
+        return false;
+    }
+
+    Index::delete_free_block(last);
+
+    if (!os_syscall_brk(new_end_vaddr)) {
+        Index::insert_free_block(last);
+        return false;
+    }
+
+    // shorten the last block
+    uint32_t last_block_size = (uint32_t)(new_end_vaddr - 4 - last);
+    set_allocated(last, FREE);
+    set_block_size(last, last_block_size);
+
+    uint64_t last_footer = get_footer(last);
+    set_block_size(last_footer, last_block_size);
+    set_allocated(last_footer, FREE);
+
+    // move the epilogue, head only
+    uint64_t epilogue = get_epilogue();
+    set_block_size(epilogue, 0);
+    set_allocated(epilogue, ALLOCATED);
+
+    // 前一个空闲块可能因为合并后超过 HEAP_MAX_BLOCK_SIZE 而没有合并，缩短之后再合并
+    uint64_t prev = get_prev_header(last);
+    if (get_allocated(prev) == FREE && (uint64_t)get_block_size(prev) + last_block_size <= HEAP_MAX_BLOCK_SIZE) {
+        Index::delete_free_block(prev);
+        last = merge_blocks_as_free(prev, last);
+        count(cur_heap->stats.coalesce_count);
+    }
+
+    Index::insert_free_block(last);
+
+    check_after_update();
+
+    return true;
+}
+
+// ================================================ //
+//          Free block indexes as policies          //
+// ================================================ //
+// 每个 index 管理某一范围大小的空闲块，search 返回第一块 >= free_block_size 的空闲块，不存在则返回NIL
+// SmallIndex 管理 8-Byte 的空闲块，FreeIndex 管理 >= 16 Byte 的空闲块
+
+// 8-Byte free block: small list
+struct SMALL_LIST_INDEX {
+    static void initialize() {
+        small_list_init();
+    }
+
+    static uint64_t search(uint32_t free_block_size) {
+        return small_list_search();
+    }
+
+    static void insert(uint64_t free_header) {
+        small_list_insert(free_header);
+    }
+
+    static void remove(uint64_t free_header) {
+        small_list_delete(free_header);
+    }
+
+    static void check() {
+        small_list_check_free_blocks();
+    }
+};
+
+// 隐式空闲链表: 不维护任何结构，search 时遍历整个heap
+struct IMPLICIT_LIST_INDEX {
+    static void initialize() {}
+
+    static uint64_t search(uint32_t free_block_size) {
+        return implicit_list_search(free_block_size);
+    }
+
+    static void insert(uint64_t free_header) {}
+
+    static void remove(uint64_t free_header) {}
+
+    static void check() {}
+};
+
+// 显式空闲链表: >= 16 Byte 的空闲块
+struct EXPLICIT_LIST_INDEX {
+    static void initialize() {
+        explicit_list_initialize();
+    }
+
+    static uint64_t search(uint32_t free_block_size) {
+        return explicit_list_search(free_block_size);
+    }
+
+    static void insert(uint64_t free_header) {
+        explicit_list_insert(free_header);
+    }
+
+    static void remove(uint64_t free_header) {
+        explicit_list_delete(free_header);
+    }
+
+    static void check() {
+        check_size_list_correctness(cur_heap->explicit_list, MIN_EXPLICIT_FREE_LIST_BLOCKSIZE, 0xFFFFFFFF);
+    }
+};
+
+// 红黑树: [16, 32] 的空闲块使用显式空闲链表，>= 40 的空闲块使用rbt
+struct REDBLACK_TREE_INDEX {
+    static void initialize() {
+        redblack_tree_initialize();
+        explicit_list_initialize();
+    }
+
+    static uint64_t search(uint32_t free_block_size) {
+        if (free_block_size < MIN_REDBLACK_TREE_BLOCKSIZE) {
+            uint64_t b = explicit_list_search(free_block_size);
+            if (b != NIL) {
+                return b;
+            }
+        }
+
+        // 最佳适配算法: 找到第一块比req大的
+        return redblack_tree_search(free_block_size);
+    }
+
+    static void insert(uint64_t free_header) {
+        if (get_block_size(free_header) < MIN_REDBLACK_TREE_BLOCKSIZE) {
+            explicit_list_insert(free_header);
+        } else {
+            redblack_tree_insert(free_header);
+        }
+    }
+
+    static void remove(uint64_t free_header) {
+        if (get_block_size(free_header) < MIN_REDBLACK_TREE_BLOCKSIZE) {
+            explicit_list_delete(free_header);
+        } else {
+            redblack_tree_delete(free_header);
+        }
+    }
+
+    static void check() {
+        check_size_list_correctness(cur_heap->explicit_list, MIN_EXPLICIT_FREE_LIST_BLOCKSIZE, 32);
+    }
+};
+
+// 分离适配: 按 size class 划分的显式空闲链表 + bitmap
+struct SEGREGATED_LIST_INDEX {
+    static void initialize() {
+        segregated_list_initialize();
+    }
+
+    static uint64_t search(uint32_t free_block_size) {
+        return segregated_list_search(free_block_size);
+    }
+
+    static void insert(uint64_t free_header) {
+        segregated_list_insert(free_header);
+    }
+
+    static void remove(uint64_t free_header) {
+        segregated_list_delete(free_header);
+    }
+
+    static void check() {
+        segregated_list_check();
+    }
+};
+
+// 两级分离适配(TLSF): 两级 bitmap + (fl, sl) 显式空闲链表，search/insert/remove 均为 O(1)
+struct TLSF_INDEX {
+    static void initialize() {
+        tlsf_initialize();
+    }
+
+    static uint64_t search(uint32_t free_block_size) {
+        return tlsf_search(free_block_size);
+    }
+
+    static void insert(uint64_t free_header) {
+        tlsf_insert(free_header);
+    }
+
+    static void remove(uint64_t free_header) {
+        tlsf_delete(free_header);
+    }
+
+    static void check() {
+        tlsf_check();
+    }
+};
+
+// 将 SmallIndex 与 FreeIndex 组合为 HEAP_ALGORITHM 所需的 Index
+template <class FreeIndex, class SmallIndex>
+struct SIZE_CLASS_INDEX {
+    static void initialize_free_block() {
+        SmallIndex::initialize();
+        FreeIndex::initialize();
+        insert_free_block(get_first_block());
+    }
+
+    static uint64_t search_free_block(uint32_t payload_size, uint32_t &alloc_block_size) {
+        // search 8-byte block list
+        alloc_block_size = get_alloc_block_size(payload_size);
+        if (alloc_block_size == 8) {
+            // a small block
+            uint64_t b = SmallIndex::search(8);
+            if (b != NIL) {
+                return b;
+            }
+        }
+
+        return FreeIndex::search(alloc_block_size);
+    }
+
+    static void insert_free_block(uint64_t free_header) {
+        assert(free_header % 8 == 4);
+        assert(get_first_block() <= free_header && free_header < get_epilogue());
+        assert(get_allocated(free_header) == FREE);
+        assert(get_block_size(free_header) % 8 == 0);
+
+        if (get_block_size(free_header) == 8) {
+            SmallIndex::insert(free_header);
+        } else {
+            FreeIndex::insert(free_header);
+        }
+    }
+
+    static void delete_free_block(uint64_t free_header) {
+        assert(free_header % 8 == 4);
+        assert(get_first_block() <= free_header && free_header < get_epilogue());
+        assert(get_allocated(free_header) == FREE);
+        assert(get_block_size(free_header) % 8 == 0);
+
+        if (get_block_size(free_header) == 8) {
+            SmallIndex::remove(free_header);
+        } else {
+            FreeIndex::remove(free_header);
+        }
+    }
+
+    static void check_free_block() {
+        SmallIndex::check();
+        FreeIndex::check();
+    }
+};
+
+// ================================================ //
+//       The allocator with compile-time index      //
+// ================================================ //
+// 空闲块的管理方式作为模板参数，search/insert/delete 在编译期确定，可以被内联
+// block 格式与运行时选择策略的 heap 完全相同，拥有自己的 heap 实例(地址区间)
+// e.g. ALLOCATOR<REDBLACK_TREE_INDEX> a; a.init(); uint64_t p = a.alloc(16); a.free(p);
+template <class FreeIndex, class SmallIndex = SMALL_LIST_INDEX>
+class ALLOCATOR {
+public:
+    typedef SIZE_CLASS_INDEX<FreeIndex, SmallIndex> index_t;
+    typedef HEAP_ALGORITHM<index_t> algorithm_t;
+
+    ALLOCATOR() = default;
+
+    ~ALLOCATOR() {
+        heap_destroy(&heap_);
+    }
+
+    ALLOCATOR(const ALLOCATOR &) = delete;
+    ALLOCATOR& operator=(const ALLOCATOR &) = delete;
+
+    bool init(uint64_t max_size = HEAP_DEFAULT_SIZE) {
+        if (!heap_init_blocks(&heap_, max_size)) {
+            return false;
+        }
+
+        HEAP_GUARD guard(&heap_);
+        index_t::initialize_free_block();
+        return true;
+    }
+
+    uint64_t alloc(uint32_t size) {
+        HEAP_GUARD guard(&heap_);
+        return algorithm_t::alloc(size);
+    }
+
+    void free(uint64_t payload_vaddr) {
+        HEAP_GUARD guard(&heap_);
+        algorithm_t::free(payload_vaddr);
+    }
+
+    uint64_t realloc(uint64_t payload_vaddr, uint32_t size) {
+        HEAP_GUARD guard(&heap_);
+        return algorithm_t::realloc(payload_vaddr, size);
+    }
+
+    bool trim(uint32_t pad) {
+        HEAP_GUARD guard(&heap_);
+        return algorithm_t::trim(pad);
+    }
+
+    // [16, 256] Byte block 释放时延迟合并
+    bool enable_quick_lists() {
+        return heap_enable_quick_lists(&heap_);
+    }
+
+    // payload <= SLAB_MAX_OBJECT_SIZE 的请求由 slab allocator 分配
+    bool enable_slab() {
+        return heap_enable_slab(&heap_);
+    }
+
+    // 页级的请求由 buddy system 分配
+    bool enable_buddy() {
+        return heap_enable_buddy(&heap_);
+    }
+
+    // 之后 alloc/free/trim 可以在多个线程中同时调用，隐式空闲链表不支持
+    bool enable_thread_safe() {
+        if (std::is_same<FreeIndex, IMPLICIT_LIST_INDEX>::value) {
+            return false;
+        }
+        return heap_enable_thread_safe(&heap_);
+    }
+
+    void check() {
+        HEAP_GUARD guard(&heap_);
+        check_heap_correctness();
+        index_t::check_free_block();
+        buddy_check();
+        slab_check();
+    }
+
+    // heap 实例的 policy 为空，不能通过 mem_alloc(heap_t *) 等运行时接口操作
+    heap_t *get_heap() {
+        return &heap_;
+    }
+
+private:
+    heap_t heap_;
+};
+
+#endif //MALLOC_POLICY_ALLOCATOR_H
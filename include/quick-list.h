@@ -0,0 +1,59 @@
+#ifndef MALLOC_QUICK_LIST_H
+#define MALLOC_QUICK_LIST_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "allocator.h"
+
+// ================================================ //
+//      Quick lists with deferred coalescing        //
+// ================================================ //
+// heap_enable_quick_lists 之后，释放的 [16, 256] Byte block 不与相邻的块合并，而是按 block size 放入 quick list，
+// 之后同样大小的请求直接从 quick list 中取出，不再 search、分割:
+//  - 每 8 Byte 一个 quick list，块以 payload 的前 4 字节串联成栈，在 boundary tag 看来仍然是已分配的
+//  - 与 8-Byte block 的 small list 不同，quick list 中的块不在空闲块的索引中，合并时不需要从中间删除
+//  - 延迟的合并(consolidate)在以下情况下进行，将全部 quick list 中的块按原来的方式释放:
+//    1. quick list 中的块数达到 QUICK_LISTS_MAX_BLOCKS
+//    2. search 找不到合适的空闲块，拓展 heap 之前
+//    3. trim 之前
+// 多线程模式下 quick list 由一把锁保护，持有这把锁时不访问 heap 的其他结构
+const uint32_t QUICK_LIST_MIN_BLOCKSIZE = 16;
+const uint32_t QUICK_LIST_MAX_BLOCKSIZE = 256;
+const uint32_t QUICK_LIST_NUM = (QUICK_LIST_MAX_BLOCKSIZE - QUICK_LIST_MIN_BLOCKSIZE) / 8 + 1;
+const uint32_t QUICK_LISTS_MAX_BLOCKS = 4096;
+
+typedef struct {
+    uint64_t hits;              // 直接由 quick list 满足的 alloc
+    uint64_t pushes;            // 放入 quick list 的 free
+    uint64_t consolidations;    // 延迟合并的次数
+} quick_list_stats_t;
+
+struct QUICK_FREE_LISTS {
+    // 多线程模式下使用
+    std::mutex lock;
+    // heads 与 total 在锁内修改，quick_list_pop/quick_list_is_empty 不加锁地预先读取
+    uint32_t heads[QUICK_LIST_NUM] = {0};   // compress_ptr(payload)
+    uint32_t counts[QUICK_LIST_NUM] = {0};
+    std::atomic<uint32_t> total{0};
+    quick_list_stats_t stats = quick_list_stats_t();
+};
+
+bool heap_enable_quick_lists();
+bool heap_enable_quick_lists(heap_t *h);
+quick_list_stats_t heap_quick_list_stats(heap_t *h);
+
+// The quick lists of cur_heap, used by HEAP_ALGORITHM
+bool quick_list_is_suitable(uint32_t payload_size);
+// return NIL if the quick list is empty
+uint64_t quick_list_pop(uint32_t payload_size);
+// return false if the block is not [16, 256] Byte and should be freed as usual
+// full = true 时 quick list 中的块已经达到 QUICK_LISTS_MAX_BLOCKS，调用者需要 consolidate
+bool quick_list_push(uint64_t payload_vaddr, bool &full);
+// 取出全部的块，以 quick_list_next 遍历，NIL 结尾
+uint64_t quick_list_take_all();
+uint64_t quick_list_next(uint64_t payload_vaddr);
+bool quick_list_is_empty();
+
+#endif //MALLOC_QUICK_LIST_H
@@ -1,53 +1,164 @@
 #ifndef MYMALLOC_REDBLACK_TREE_H
 #define MYMALLOC_REDBLACK_TREE_H
 
+#include "allocator.h"
 #include "rbt.h"
 
 
 // ================================================ //
 //      The implementation of the free block rbt    //
 // ================================================ //
-class FREE_RBT final : public RBT {
+// rbt 中的空闲块均 >= MIN_REDBLACK_TREE_BLOCKSIZE，不会是 8-Byte block
+// 因此 header 中的 size 就是块大小，访问函数直接读写 heap 上的字段，RBT_BASE<FREE_RBT> 中的调用均可被内联
+// parent: [header + 4], left: [header + 8], right: [header + 12], color: footer 的 bit 1
+class FREE_RBT final : public RBT_BASE<FREE_RBT> {
+    friend class RBT_BASE<FREE_RBT>;
 public:
     // 构造函数
     FREE_RBT(uint64_t root)
         : root_(root) {}
 
     // 将其空闲部分变为隐式空闲链表，对于RBT_BLOCK是不需要做任何处理的
-    ~FREE_RBT() override = default;
+    ~FREE_RBT() = default;
 
-    uint64_t get_root() const override;
+    uint64_t get_root() const {
+        return root_;
+    }
 
 protected:
-    bool is_null_node(uint64_t header_vaddr) const override;
-
-    bool set_root(uint64_t new_root) override;
-
-    uint64_t construct_node() override;
-    bool destruct_node(uint64_t node) override;
-
-    bool is_nodes_equal(uint64_t first, uint64_t second) override;
-
-    uint64_t get_parent(uint64_t node) const override;
-    bool set_parent(uint64_t node, uintptr_t parent) override;
-
-    uint64_t get_left_child(uint64_t node) const override;
-    bool set_left_child(uint64_t node, uint64_t left_child) override;
-
-    uint64_t get_right_child(uint64_t node) const override;
-    bool set_right_child(uint64_t node, uint64_t right_child) override;
-
-    rbt_color_t get_color(uint64_t node) const override;
-    bool set_color(uint64_t node, rbt_color_t color) override;
-
-    uint64_t get_key(uint64_t node) const override;
-    bool set_key(uint64_t node, uint64_t key) override;
-
-    uint64_t get_value(uint64_t node) const override;
-    bool set_value(uint64_t node, uint64_t value) override;
+    bool is_null_node(uint64_t header_vaddr) const {
+        assert(header_vaddr == NIL || header_vaddr % 8 == 4);
+        return header_vaddr == NIL;
+    }
+
+    bool set_root(uint64_t new_root) {
+        root_ = new_root;
+        return true;
+    }
+
+    // FREE_RBT中不需要构建和销毁节点
+    uint64_t construct_node() {
+        return NULL_TREE_NODE;
+    }
+
+    // 可以不用管，兼容隐式链表格式
+    bool destruct_node(uint64_t header_vaddr) {
+        return header_vaddr != NIL;
+    }
+
+    bool is_nodes_equal(uint64_t first, uint64_t second) {
+        return first == second;
+    }
+
+    // node is header_vaddr
+    uint64_t get_parent(uint64_t node) const {
+        return get_field(node, 4);
+    }
+
+    bool set_parent(uint64_t node, uintptr_t parent) {
+        return set_field(node, parent, 4);
+    }
+
+    uint64_t get_left_child(uint64_t node) const {
+        return get_field(node, 8);
+    }
+
+    bool set_left_child(uint64_t node, uint64_t left_child) {
+        return set_field(node, left_child, 8);
+    }
+
+    uint64_t get_right_child(uint64_t node) const {
+        return get_field(node, 12);
+    }
+
+    bool set_right_child(uint64_t node, uint64_t right_child) {
+        return set_field(node, right_child, 12);
+    }
+
+    rbt_color_t get_color(uint64_t node) const {
+        if (node == NIL) {
+            // default BLACK
+            return COLOR_BLACK;
+        }
+
+        uint32_t footer_value = word(node + get_size(node) - 4);
+        return static_cast<rbt_color_t>((footer_value >> 1) & 0x1);
+    }
+
+    bool set_color(uint64_t node, rbt_color_t color) {
+        if (node == NIL) {
+            return false;
+        }
+
+        assert(color == COLOR_BLACK || color == COLOR_RED);
+
+        uint32_t &footer_value = word(node + get_size(node) - 4);
+        footer_value &= 0xFFFFFFFD; // 0xD = 1101 将color位清空
+        footer_value |= ((color & 0x1) << 1);   // set color
+        return true;
+    }
+
+    // key is block size
+    uint64_t get_key(uint64_t node) const {
+        return get_size(node);
+    }
+
+    bool set_key(uint64_t node, uint64_t key) {
+        assert((key & 0xFFFFFFFF00000000) == 0);
+
+        set_block_size(node, key);
+        return true;
+    }
+
+    // FREE_RBT中无需设置value
+    uint64_t get_value(uint64_t node) const {
+        return NIL;
+    }
+
+    bool set_value(uint64_t node, uint64_t value) {
+        return false;
+    }
 
 private:
+    static uint32_t &word(uint64_t vaddr) {
+        return *reinterpret_cast<uint32_t *>(&heap[vaddr]);
+    }
+
+    static uint32_t get_size(uint64_t node) {
+        assert(node % 8 == 4);
+        uint32_t block_size = word(node) & 0xFFFFFFF8;
+        assert(block_size >= MIN_REDBLACK_TREE_BLOCKSIZE);
+        return block_size;
+    }
+
+    // 32-bit compressed block ptr
+    static uint64_t get_field(uint64_t node, uint32_t offset) {
+        if (node == NIL) {
+            return NIL;
+        }
+
+        assert(get_size(node) >= MIN_REDBLACK_TREE_BLOCKSIZE);
+        return decompress_header_ptr(word(node + offset));
+    }
+
+    static bool set_field(uint64_t node, uint64_t block_ptr, uint32_t offset) {
+        if (node == NIL) {
+            return false;
+        }
+
+        assert(get_size(node) >= MIN_REDBLACK_TREE_BLOCKSIZE);
+        assert(block_ptr == NIL || get_size(block_ptr) >= MIN_REDBLACK_TREE_BLOCKSIZE);
+        word(node + offset) = compress_ptr(block_ptr);
+        return true;
+    }
+
     uint64_t root_ = NIL;
 };
 
+// The rbt of cur_heap, for free block >= MIN_REDBLACK_TREE_BLOCKSIZE
+void redblack_tree_initialize();
+uint64_t redblack_tree_search(uint32_t key);
+void redblack_tree_insert(uint64_t free_header);
+void redblack_tree_delete(uint64_t free_header);
+
 #endif //MYMALLOC_REDBLACK_TREE_H
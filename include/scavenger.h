@@ -0,0 +1,92 @@
+#ifndef MALLOC_SCAVENGER_H
+#define MALLOC_SCAVENGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "allocator.h"
+
+// ================================================ //
+//      Background scavenger of idle memory         //
+// ================================================ //
+// heap_start_scavenger 之后，一个后台线程每隔 interval_ms 扫描一次 heap，归还空闲的内存:
+//  1. 将共享的缓存(transfer cache、加锁方式的 per-CPU cache、8-Byte 无锁栈)中的块释放，使其与相邻的空闲块合并
+//     各线程 tcache 中的块只能由其所属线程访问: 改变 heap 的 tcache_epoch，各线程在下一次 alloc/free 时归还上一个 epoch 中没有使用过的 bin
+//  2. trim: 末尾的空闲块只保留 trim_pad 字节
+//  3. 从上一次停下的位置(cursor)继续遍历 heap，每次最多访问 scan_blocks 个块，到达 epilogue 时完成一轮
+//     遍历逐块地获取 header 所在的 stripe(heap_lock_stripe)，同一时刻只持有相邻的少数几个 stripe，不阻塞其他区间的 alloc/free
+//     连续 purge_idle_passes 轮遍历都没有变化的 >= purge_min_size 的空闲块，将其内部的整页归还给OS，每次扫描最多 purge_budget_pages 页
+//     cursor 被合并到前一个块中时，合并的一方将 cursor 改为合并后的块(scavenger_cursor_absorbed)，因此 cursor 始终是有效的 header
+// 启用之后，mem_free 不再自动 trim，红黑树也不再在插入时 purge，归还内存的开销全部由后台线程承担
+// 扫描需要与其他线程同时访问 heap，因此 heap 需要处于多线程模式(heap_enable_thread_safe)
+// 与 heap_enable_* 相同，heap_start_scavenger/heap_stop_scavenger 不能与其他线程对 h 的操作同时进行
+typedef struct {
+    uint32_t interval_ms;           // 两次扫描之间的间隔
+    uint32_t trim_pad;              // trim 时末尾空闲块保留的字节数
+    uint32_t purge_min_size;        // 只 purge >= purge_min_size 的空闲块
+    uint32_t purge_idle_passes;     // 空闲块连续多少轮遍历没有变化之后才 purge
+    uint32_t purge_budget_pages;    // 每次扫描最多 purge 的页数
+    uint32_t scan_blocks;           // 每次扫描最多访问的块数
+} scavenger_config_t;
+
+const scavenger_config_t SCAVENGER_DEFAULT_CONFIG = {
+    100,
+    HEAP_TOP_PAD,
+    HEAP_PURGE_THRESHOLD,
+    2,
+    1024,
+    4096,
+};
+
+typedef struct {
+    uint64_t passes;            // 扫描的次数
+    uint64_t rounds;            // 完整遍历 heap 的轮数
+    uint64_t scanned_blocks;    // 访问过的块数
+    uint64_t trims;             // trim 归还了页的次数
+    uint64_t purged_blocks;     // purge 的空闲块数
+    uint64_t purged_pages;      // purge 时归还给OS的页数
+} scavenger_stats_t;
+
+struct SCAVENGER {
+    heap_t *heap = nullptr;
+    scavenger_config_t config = SCAVENGER_DEFAULT_CONFIG;
+
+    // 后台线程与 heap_scavenge 的扫描互斥
+    std::mutex pass_mutex;
+    scavenger_stats_t stats = scavenger_stats_t();
+    // 下一次扫描开始的 header，NIL 表示从第一个块开始新的一轮，不会是 epilogue
+    // 持有其 stripe 时修改，合并时由其他线程以 CAS 改为合并后的块
+    std::atomic<uint64_t> cursor{NIL};
+    // 上一轮与本轮遍历中 >= purge_min_size 的空闲块: header -> (block size, 连续空闲的轮数)
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> idle_blocks;
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> round_blocks;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread thread;
+
+    ~SCAVENGER();
+};
+
+bool heap_start_scavenger(heap_t *h, const scavenger_config_t &config = SCAVENGER_DEFAULT_CONFIG);
+// 停止并等待后台线程结束，heap_destroy 时自动调用
+void heap_stop_scavenger(heap_t *h);
+
+// 在调用线程中立即进行一次扫描
+void heap_scavenge(heap_t *h);
+scavenger_stats_t heap_scavenger_stats(heap_t *h);
+
+// 块 absorbed 被合并到 into 中时调用，调用者持有 absorbed 的 stripe
+inline void scavenger_cursor_absorbed(uint64_t absorbed, uint64_t into) {
+    SCAVENGER *s = cur_heap->scavenger.get();
+    if (s != nullptr) {
+        s->cursor.compare_exchange_strong(absorbed, into, std::memory_order_relaxed);
+    }
+}
+
+#endif //MALLOC_SCAVENGER_H
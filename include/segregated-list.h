@@ -0,0 +1,35 @@
+#ifndef MYMALLOC_SEGREGATED_LIST_H
+#define MYMALLOC_SEGREGATED_LIST_H
+
+#include "allocator.h"
+#include "explicit-list.h"
+
+// ================================================ //
+//      The implementation of the segregated fit    //
+// ================================================ //
+// 按块大小划分为多个 size class，每个 size class 是一个显式空闲链表(与 EXPLICIT_FREE_LINKED_LIST 的节点格式相同)
+//  - [16, 256]: 每 8 Byte 一个 class (exact class)，class 中的块大小全部相同
+//  - (256, 2^32): 每个 2 的幂次区间一个 class: (256, 512), [512, 1024), ... [2^31, 2^32)
+// bitmap 的第 i 位表示第 i 个 class 非空，寻找第一个满足要求的 class 只需一次 ctz
+const uint32_t SEGREGATED_EXACT_MAX_BLOCKSIZE = 256;
+const int SEGREGATED_EXACT_CLASS_NUM = (SEGREGATED_EXACT_MAX_BLOCKSIZE - MIN_EXPLICIT_FREE_LIST_BLOCKSIZE) / 8 + 1;
+const int SEGREGATED_CLASS_NUM = SEGREGATED_EXACT_CLASS_NUM + (32 - 8);
+
+static_assert(SEGREGATED_CLASS_NUM <= 64, "the occupancy bitmap is 64-bit");
+
+struct SEGREGATED_FREE_LISTS {
+    uint64_t bitmap = 0;    // bit i is set if lists[i] is not empty
+    EXPLICIT_FREE_LINKED_LIST lists[SEGREGATED_CLASS_NUM];
+};
+
+// return the size class of a free block >= 16
+int segregated_list_class(uint32_t block_size);
+
+// The segregated free lists of cur_heap, for free block >= 16
+void segregated_list_initialize();
+uint64_t segregated_list_search(uint32_t free_block_size);
+void segregated_list_insert(uint64_t free_header);
+void segregated_list_delete(uint64_t free_header);
+void segregated_list_check();
+
+#endif //MYMALLOC_SEGREGATED_LIST_H
@@ -0,0 +1,83 @@
+#ifndef MYMALLOC_SLAB_H
+#define MYMALLOC_SLAB_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "allocator.h"
+
+// ================================================ //
+//      Slab allocator for small fixed-size objects //
+// ================================================ //
+// payload <= SLAB_MAX_OBJECT_SIZE 的请求向上取整到 8 的倍数(size class)，由 slab allocator 分配
+// 与 buddy system 相同，slab allocator 以 span 为单位向 boundary tag allocator 申请内存:
+// 一个 span 是一个已分配的普通 block，其 payload 中按页对齐的 SLAB_SPAN_PAGES 页分别属于一个 size class
+//  - 每一页以 SLAB_PAGE_HEADER 开始，之后是同样大小的 object，object 没有 header/footer
+//  - 页内的 bitmap 记录每个 object 是否已分配，alloc/free 只是 bit 操作
+//  - 每个 size class 有空闲 object 的页组成一个显式链表，prev/next 保存在 SLAB_PAGE_HEADER 中
+//  - 页中的 object 全部空闲、且不是该 size class 唯一有空闲 object 的页时，页归还给 span；
+//    span 的页全部空闲时归还给 boundary tag allocator，但至少保留一个 span
+// 每个 heap 的页是否属于 slab 记录在 SLAB_ALLOCATOR::page_bits(每页 1 bit)，free 时不需要加锁即可判断
+// 16 Byte 的 object 在 boundary tag allocator 中需要 24 Byte 的 block，slab 中只需要 16 Byte(以及页头的 1/50)
+const uint32_t SLAB_PAGE_SIZE = 4096;
+const uint32_t SLAB_MAX_OBJECT_SIZE = 256;
+const uint32_t SLAB_CLASS_NUM = SLAB_MAX_OBJECT_SIZE / 8;
+const uint32_t SLAB_SPAN_PAGES = 16;
+// 从 boundary tag allocator 申请的 payload 大小，保证其中存在按页对齐的 SLAB_SPAN_PAGES 页
+const uint32_t SLAB_SPAN_PAYLOAD = SLAB_SPAN_PAGES * SLAB_PAGE_SIZE + SLAB_PAGE_SIZE - 8;
+
+// 位于每一页的开头
+struct SLAB_PAGE_HEADER {
+    uint32_t object_size;
+    uint32_t free_count;
+    uint32_t prev;              // 同一 size class 有空闲 object 的页, compress_ptr(page)
+    uint32_t next;
+    uint64_t bitmap[SLAB_PAGE_SIZE / 8 / 64];  // bit i 为 1 表示第 i 个 object 已分配
+};
+
+const uint32_t SLAB_PAGE_HEADER_SIZE = sizeof(SLAB_PAGE_HEADER);
+
+struct SLAB_SPAN {
+    uint64_t payload_vaddr = NIL;   // 向 boundary tag allocator 申请的 block
+    uint32_t free_pages = 0;        // bit i 为 1 表示第 i 页没有分配给任何 size class
+};
+
+typedef struct {
+    uint64_t span_count;        // 当前持有的 span 个数
+    uint64_t page_count;        // 分配给 size class 的页数
+    uint64_t object_count;      // 已分配的 object 个数
+    uint64_t object_bytes;      // 已分配的 object 的大小之和
+} slab_stats_t;
+
+struct SLAB_ALLOCATOR {
+    uint32_t partial_pages[SLAB_CLASS_NUM] = {0};   // 每个 size class 有空闲 object 的页的链表头, compress_ptr(page)
+    std::map<uint64_t, SLAB_SPAN> spans;            // key: span 中按页对齐的起始地址
+    std::set<uint64_t> spans_with_free_pages;       // 优先使用低地址的 span
+    std::vector<uint64_t> page_bits;                // (vaddr - start_vaddr) / SLAB_PAGE_SIZE 页是否属于 slab
+    slab_stats_t stats = slab_stats_t();
+};
+
+// 为 h 启用 slab allocator，之后 h 上 payload <= SLAB_MAX_OBJECT_SIZE 的请求由 slab allocator 分配
+bool heap_enable_slab();
+bool heap_enable_slab(heap_t *h);
+// return nullptr if the slab allocator is not enabled
+const slab_stats_t *heap_slab_stats(heap_t *h);
+
+// The slab allocator of cur_heap
+bool slab_is_suitable(uint32_t payload_size);
+// 不加锁，vaddr 是否位于 slab 的页中
+bool slab_owns(uint64_t vaddr);
+// return NIL if no page of the size class has a free object and all spans are used up
+uint64_t slab_alloc(uint32_t payload_size);
+// add the payload of a block allocated from boundary tag allocator as a new span
+void slab_add_span(uint64_t span_payload_vaddr);
+// return false if vaddr is not allocated by the slab allocator
+// if a whole span becomes free, its payload is returned by released_span, otherwise NIL
+bool slab_free(uint64_t payload_vaddr, uint64_t &released_span);
+// the object size of a slab object
+uint32_t slab_get_object_size(uint64_t payload_vaddr);
+void slab_check();
+
+#endif //MYMALLOC_SLAB_H
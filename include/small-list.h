@@ -1,12 +1,18 @@
 #ifndef MYMALLOC_SMALL_LIST_H
 #define MYMALLOC_SMALL_LIST_H
 
+#include <atomic>
+
+#include "allocator.h"
 #include "linked-list.h"
 
 // ================================================ //
 //    The implementation of the small linked list   //
 // ================================================ //
-class SMALL_FREE_LINKED_LIST final : public LINKED_LIST {
+// 8-Byte 空闲块的 prev 和 next 分别保存在 header 和 footer 的高 29 位中，footer 的低 3 位保留(B8 标记)
+// 访问函数直接读写 heap 上的字段，可以被内联
+class SMALL_FREE_LINKED_LIST final : public LINKED_LIST_BASE<SMALL_FREE_LINKED_LIST> {
+    friend class LINKED_LIST_BASE<SMALL_FREE_LINKED_LIST>;
 public:
     SMALL_FREE_LINKED_LIST(uint64_t head, uint64_t count)
         : head_(head), count_(count) {}
@@ -14,36 +20,127 @@ public:
     // 由于heap上的空闲块，如果全部释放掉那么就变成了隐式空闲链表
     // ⭐ small list和其他空闲块不同，它利用了head 和 foot 设置了 prev 和 next
     // 但是我们将small list 作为 和 implicit list同等基础性的成分，均是默认情况，因此也无需析构
-    ~SMALL_FREE_LINKED_LIST() override = default;
+    ~SMALL_FREE_LINKED_LIST() = default;
 
 protected:
-    uint64_t get_head() const override;
-    bool set_head(uint64_t new_head) override;
+    uint64_t get_head() const {
+        return head_;
+    }
+
+    bool set_head(uint64_t new_head) {
+        head_ = new_head;
+        return true;
+    }
+
+    uint64_t get_count() const {
+        return count_;
+    }
+
+    bool set_count(uint64_t new_count) {
+        count_ = new_count;
+        return true;
+    }
 
-    uint64_t get_count() const override;
-    bool set_count(uint64_t new_count) override;
+    bool destruct_node(uint64_t node) {
+        return true;
+    }
 
-    bool destruct_node(uint64_t node) override;
+    bool is_nodes_equal(uint64_t first, uint64_t second) {
+        return first == second;
+    }
 
-    bool is_nodes_equal(uint64_t first, uint64_t second) override;
+    uint64_t get_node_prev(uint64_t node) {
+        return get_field(node);
+    }
 
-    uint64_t get_node_prev(uint64_t node) override;
-    bool set_node_prev(uint64_t node, uint64_t prev) override;
+    bool set_node_prev(uint64_t node, uint64_t prev) {
+        // we set by header only
+        return set_field(node, prev);
+    }
 
-    uint64_t get_node_next(uint64_t node) override;
-    bool set_node_next(uint64_t node, uint64_t next) override;
+    uint64_t get_node_next(uint64_t node) {
+        return get_field(node + 4);
+    }
+
+    bool set_node_next(uint64_t node, uint64_t next) {
+        // 设置next
+        return set_field(node + 4, next);
+    }
 
 private:
+    // vaddr 为 header(prev) 或 footer(next)
+    static uint64_t get_field(uint64_t vaddr) {
+        assert(vaddr % 4 == 0);
+        assert(get_allocated(vaddr - (vaddr % 8 == 0 ? 4 : 0)) == FREE);
+
+        uint32_t value = __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[vaddr]), __ATOMIC_RELAXED);
+        // 由于8-Byte中保存size地方现用来保存prev和next
+        // ⭐ size是8字节对齐，而prev和next是4字节对齐，存入少了4，因此我们需要给它加回来
+        return 4 + (value & 0xFFFFFFF8);
+    }
+
+    static bool set_field(uint64_t vaddr, uint64_t block_ptr) {
+        assert(vaddr % 4 == 0);
+        assert(get_allocated(vaddr - (vaddr % 8 == 0 ? 4 : 0)) == FREE);
+        assert(block_ptr % 8 == 4);
+        // 只有 29 位，wide heap 中没有 B8 block
+        assert((block_ptr >> 32) == 0);
+
+        // ⭐ 注意：这里将header_addr设置成了8字节对齐，会抹去最后一个1，即x100 -> x000
+        // 后续获取prev和next的时候需要设置回来
+        // 多线程模式下相邻 block 的分配与释放可能同时修改 header 的 PA bit，因此以 CAS 只替换高 29 位
+        uint32_t *field = reinterpret_cast<uint32_t *>(&heap[vaddr]);
+        uint32_t value = __atomic_load_n(field, __ATOMIC_RELAXED);
+        uint32_t new_value;
+        do {
+            new_value = (value & 0x00000007) | (uint32_t)(block_ptr & 0xFFFFFFF8);
+        } while (!__atomic_compare_exchange_n(field, &value, new_value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        return true;
+    }
+
     uint64_t head_ = 0;
     uint64_t count_ = 0;
 };
 
 // interface
 void small_list_init();
+// return the head of the small list, NIL if empty
+uint64_t small_list_search();
 void small_list_insert(uint64_t free_header);
 void small_list_delete(uint64_t free_header);
-extern std::shared_ptr<SMALL_FREE_LINKED_LIST> small_list;
-void check_size_list_correctness(const std::shared_ptr<LINKED_LIST> &list, uint32_t min_size, uint32_t max_size);
+// List is SMALL_FREE_LINKED_LIST or EXPLICIT_FREE_LINKED_LIST
+template <class List>
+void check_size_list_correctness(const std::shared_ptr<List> &list, uint32_t min_size, uint32_t max_size);
 void small_list_check_free_blocks();
 
+// ================================================ //
+//       The lock-free stack of 8-Byte blocks       //
+// ================================================ //
+// heap_enable_small_stack 之后，释放的 8-Byte block 压入一个无锁的 Treiber 栈，payload <= 4 的请求先从栈中弹出
+//  - 栈中的块在 heap 看来仍然是已分配的，因此不参与合并，也不会被 delete_free_block 从中间删除
+//  - 栈顶是一个 64 位的字: 低 32 位为栈顶 block 的 header(compress_ptr)，高 32 位为 ABA tag，每次 pop 加 1
+//    pop 读取栈顶的 next 之后，栈顶被其他线程弹出再压入时 tag 不同，CAS 失败
+//  - next 以 compress_ptr 保存在 8-Byte block 的 payload(header + 4)中
+//  - 栈中最多 SMALL_STACK_CAPACITY 块，已满时按原来的方式释放(合并后插入 small list)
+// 分割产生的 8-Byte 空闲块仍然由 small list 管理；mem_trim 时栈中的块全部按原来的方式释放
+const uint32_t SMALL_STACK_CAPACITY = 4096;
+
+struct SMALL_FREE_STACK {
+    std::atomic<uint64_t> top{0};
+    // 近似的块数，只用于限制栈的大小
+    std::atomic<uint32_t> count{0};
+};
+
+bool heap_enable_small_stack();
+bool heap_enable_small_stack(heap_t *h);
+
+// The small stack of cur_heap
+// return false if the block is not an 8-Byte block or the stack is full
+bool small_stack_push(uint64_t payload_vaddr);
+// return the payload of an 8-Byte block, NIL if empty
+uint64_t small_stack_pop();
+// 取出栈中的全部块，返回以 payload 中的 next 串成、以 NIL 结尾的单向链表(payload 地址)
+uint64_t small_stack_take_all();
+uint64_t small_stack_next(uint64_t payload_vaddr);
+
 #endif //MYMALLOC_SMALL_LIST_H
@@ -0,0 +1,63 @@
+#ifndef MALLOC_TCACHE_H
+#define MALLOC_TCACHE_H
+
+#include <cstdint>
+
+#include "allocator.h"
+
+// ================================================ //
+//        Thread-local allocation cache (tcache)    //
+// ================================================ //
+// heap_enable_tcache 之后，mem_alloc/mem_free 的小请求先经过当前线程的 tcache:
+//  - tcache 中的块在 heap 看来仍然是已分配的，alloc/free 只是在线程私有的 bin 中弹出/压入，不访问空闲块的管理结构，也不进行合并
+//  - bin 按 search_free_block 计算的 alloc_block_size 划分: 8, 16, 24, ..., TCACHE_MAX_BLOCKSIZE
+//  - bin 满时将较早放入的 TCACHE_BATCH 块整体放入 heap 的 transfer cache(transfer-cache.h)，已满时归还给 heap
+//  - bin 为空时先从 transfer cache 整体取出一批，没有时再从 heap 一次分配 TCACHE_BATCH 块
+//  - bin 中的块以 payload 的前 4 字节保存下一个块的 vaddr
+// heap 的 tcache_epoch 被 scavenger 改变之后，线程在下一次 alloc/free 时将上一个 epoch 中没有使用过的 bin 归还给 heap
+// 此后不再调用 mem_alloc/mem_free 的线程无法被通知，其中的块在线程退出或者调用 tcache_flush 时归还
+// 一个线程的 tcache 同一时刻只缓存一个 heap 的块，在其他 heap 上 mem_alloc 时先将原来的块全部归还
+// 线程退出时归还 tcache 中的全部块；heap_destroy 之前，其他使用过该 heap 的线程需要已经退出或者调用过 tcache_flush
+const uint32_t TCACHE_BIN_NUM = 64;
+const uint32_t TCACHE_MAX_BLOCKSIZE = TCACHE_BIN_NUM * 8;
+const uint32_t TCACHE_BIN_CAPACITY = 32;
+const uint32_t TCACHE_BATCH = TCACHE_BIN_CAPACITY / 2;
+
+// statistics of the calling thread
+typedef struct {
+    uint64_t hits;          // 直接由 tcache 满足的 alloc
+    uint64_t misses;        // bin 为空，需要从 transfer cache 或 heap 补充的 alloc
+    uint64_t flushes;       // 归还给 heap 的块数
+    uint64_t batch_inserts; // 放入 transfer cache 的批数
+    uint64_t batch_removes; // 从 transfer cache 取出的批数
+} tcache_stats_t;
+
+// 为 h 启用 tcache，之后 mem_alloc(h, ...)/mem_free(h, ...) 的小请求经过各线程的 tcache
+bool heap_enable_tcache();
+bool heap_enable_tcache(heap_t *h);
+
+// 将当前线程 tcache 中的块全部归还给 heap
+void tcache_flush();
+const tcache_stats_t *tcache_stats();
+
+// The tcache of the calling thread in front of cur_heap, used by mem_alloc/mem_free
+bool tcache_is_suitable(uint32_t payload_size);
+// bin i 中块的大小为 (i + 1) * 8，与 search_free_block 计算的 alloc_block_size 相同
+uint32_t tcache_get_bin(uint32_t payload_size);
+// bin 中每一块都能容纳的最大 payload，批量补充 bin 时按此分配
+// 已分配的块没有 footer，同一个 bin 的 payload 可能落在两个 slab size class 中
+uint32_t tcache_get_bin_payload_size(uint32_t bin);
+// 已分配块所属的 bin，不能缓存的块(过大或者可能是 buddy block)返回 TCACHE_BIN_NUM
+uint32_t tcache_get_block_bin(uint64_t payload_vaddr);
+// return NIL if the heap cannot allocate
+uint64_t tcache_alloc(uint32_t payload_size);
+// return false if the block is not cached and should be freed to the heap
+bool tcache_free(uint64_t payload_vaddr);
+// h 被销毁时丢弃当前线程中属于 h 的块
+void tcache_discard(heap_t *h);
+
+// mem_alloc/mem_free 不经过 tcache 的部分，tcache 补充与归还时使用
+uint64_t mem_alloc_uncached(uint32_t size);
+void mem_free_uncached(uint64_t payload_vaddr);
+
+#endif //MALLOC_TCACHE_H
@@ -0,0 +1,43 @@
+#ifndef MYMALLOC_TLSF_H
+#define MYMALLOC_TLSF_H
+
+#include "allocator.h"
+#include "explicit-list.h"
+
+// ================================================ //
+//  The implementation of two-level segregated fit  //
+// ================================================ //
+// first level: 按 2 的幂次划分，second level: 将每个 first level 区间再等分为 TLSF_SL_INDEX_COUNT 份
+// 每个 (fl, sl) 是一个显式空闲链表(与 EXPLICIT_FREE_LINKED_LIST 的节点格式相同)
+// fl_bitmap 的第 i 位表示 first level i 中存在非空链表，sl_bitmap[i] 的第 j 位表示链表 (i, j) 非空
+// search 时将请求大小向上取整到下一个 second level 的起点，所找到的链表中的任意一块都满足要求
+// 因此 search/insert/delete 都是 O(1) 的: 两次 ctz + 链表头的操作
+//  - block size < 128: fl = 0, sl = size / 8
+//  - block size >= 128: fl = floor(log2(size)) - 6, sl = size 在 [2^f, 2^(f+1)) 中所处的 1/16 区间
+const int TLSF_SL_INDEX_COUNT_LOG2 = 4;
+const int TLSF_SL_INDEX_COUNT = 1 << TLSF_SL_INDEX_COUNT_LOG2;
+const int TLSF_ALIGN_SIZE_LOG2 = 3;
+const int TLSF_FL_INDEX_SHIFT = TLSF_SL_INDEX_COUNT_LOG2 + TLSF_ALIGN_SIZE_LOG2;
+const int TLSF_FL_INDEX_MAX = 32;   // block size < 2^32
+const int TLSF_FL_INDEX_COUNT = TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1;
+const uint32_t TLSF_SMALL_BLOCK_SIZE = 1 << TLSF_FL_INDEX_SHIFT;
+
+static_assert(TLSF_FL_INDEX_COUNT <= 32 && TLSF_SL_INDEX_COUNT <= 32, "the bitmaps are 32-bit");
+
+struct TLSF_FREE_LISTS {
+    uint32_t fl_bitmap = 0;                             // bit i is set if sl_bitmap[i] != 0
+    uint32_t sl_bitmap[TLSF_FL_INDEX_COUNT] = {0};      // bit j of sl_bitmap[i] is set if lists[i][j] is not empty
+    EXPLICIT_FREE_LINKED_LIST lists[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+};
+
+// the (fl, sl) of a free block >= 16
+void tlsf_mapping_insert(uint32_t block_size, int &fl, int &sl);
+
+// The TLSF lists of cur_heap, for free block >= 16
+void tlsf_initialize();
+uint64_t tlsf_search(uint32_t free_block_size);
+void tlsf_insert(uint64_t free_header);
+void tlsf_delete(uint64_t free_header);
+void tlsf_check();
+
+#endif //MYMALLOC_TLSF_H
@@ -0,0 +1,131 @@
+#ifndef MALLOC_TRANSFER_CACHE_H
+#define MALLOC_TRANSFER_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+
+#include "linked-list.h"
+#include "allocator.h"
+#include "tcache.h"
+
+// ================================================ //
+//      Central transfer cache between tcaches      //
+// ================================================ //
+// 一个线程的 tcache bin 满时，将一批(TCACHE_BATCH)块整体放入 heap 的 transfer cache，
+// 另一个线程的 bin 为空时整体取走一批，块在线程之间移动时不需要逐个 free 到空闲链表再 search 出来
+//  - transfer cache 中的块在 heap 看来仍然是已分配的
+//  - 一批块以 payload 的前 8 字节构成循环双向链表(TRANSFER_BATCH)，放入与取出都是一次 O(1) 的 splice
+//  - 8-Byte block 的 payload 只有 4 字节，不经过 transfer cache
+// 每个 bin 最多保存 TRANSFER_CACHE_SLOTS 批，已满时由 tcache 直接归还给 heap
+const uint32_t TRANSFER_CACHE_SLOTS = 16;
+
+// 一批大小相同的已分配块
+//  - next 处于 payload 偏移 0 Byte的位置，与 tcache bin 中的 next 相同，因此转换为 bin 只需要断开环
+//  - prev 处于 payload 偏移 4 Byte的位置
+class TRANSFER_BATCH final : public LINKED_LIST_BASE<TRANSFER_BATCH> {
+    friend class LINKED_LIST_BASE<TRANSFER_BATCH>;
+public:
+    TRANSFER_BATCH() = default;
+    ~TRANSFER_BATCH() = default;
+
+    // 断开环并清空 batch，返回以 next 串成、以 NIL 结尾的单向链表(与 tcache bin 相同)，O(1)
+    uint64_t detach() {
+        uint64_t first = head_;
+        if (first != NIL) {
+            set_node_next(get_node_prev(first), NIL);
+        }
+
+        head_ = NIL;
+        count_ = 0;
+        return first;
+    }
+
+protected:
+    uint64_t get_head() const {
+        return head_;
+    }
+
+    bool set_head(uint64_t new_head) {
+        head_ = new_head;
+        return true;
+    }
+
+    uint64_t get_count() const {
+        return count_;
+    }
+
+    bool set_count(uint64_t new_count) {
+        count_ = new_count;
+        return true;
+    }
+
+    bool destruct_node(uint64_t) {
+        return true;
+    }
+
+    bool is_nodes_equal(uint64_t first, uint64_t second) {
+        return first == second;
+    }
+
+    uint64_t get_node_prev(uint64_t payload_vaddr) {
+        return get_field(payload_vaddr, 4);
+    }
+
+    bool set_node_prev(uint64_t payload_vaddr, uint64_t prev_vaddr) {
+        return set_field(payload_vaddr, prev_vaddr, 4);
+    }
+
+    uint64_t get_node_next(uint64_t payload_vaddr) {
+        return get_field(payload_vaddr, 0);
+    }
+
+    bool set_node_next(uint64_t payload_vaddr, uint64_t next_vaddr) {
+        return set_field(payload_vaddr, next_vaddr, 0);
+    }
+
+private:
+    // 32-bit compressed payload ptr
+    static uint64_t get_field(uint64_t payload_vaddr, uint32_t offset) {
+        if (payload_vaddr == NIL) {
+            return NIL;
+        }
+
+        assert(payload_vaddr % 8 == 0);
+        return decompress_payload_ptr(*reinterpret_cast<uint32_t *>(&heap[payload_vaddr + offset]));
+    }
+
+    static bool set_field(uint64_t payload_vaddr, uint64_t ptr, uint32_t offset) {
+        if (payload_vaddr == NIL) {
+            return false;
+        }
+
+        assert(payload_vaddr % 8 == 0);
+        assert(ptr == NIL || (ptr % 8 == 0));
+        *reinterpret_cast<uint32_t *>(&heap[payload_vaddr + offset]) = compress_ptr(ptr);
+        return true;
+    }
+
+    uint64_t head_ = NIL;
+    uint64_t count_ = 0;
+};
+
+// 按 tcache bin 划分，bin 0(8-Byte block)不使用
+struct TRANSFER_CACHE {
+    // 多线程模式下每个 bin 一个锁，只在 O(1) 的 splice 期间持有
+    std::mutex locks[TCACHE_BIN_NUM];
+    TRANSFER_BATCH slots[TCACHE_BIN_NUM][TRANSFER_CACHE_SLOTS];
+    uint32_t used[TCACHE_BIN_NUM] = {0};
+};
+
+// The transfer cache of cur_heap
+void transfer_cache_init();
+// 将 batch 整体放入 bin，成功后 batch 为空；bin 已满时返回 false
+bool transfer_cache_insert(uint32_t bin, TRANSFER_BATCH &batch);
+// 从 bin 中整体取出一批到空的 batch，bin 为空时返回 false
+bool transfer_cache_remove(uint32_t bin, TRANSFER_BATCH &batch);
+
+// 将 transfer cache 中的块全部归还给 heap
+void transfer_cache_flush();
+void transfer_cache_flush(heap_t *h);
+
+#endif //MALLOC_TRANSFER_CACHE_H
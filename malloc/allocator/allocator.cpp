@@ -1,319 +1,339 @@
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
 
 #include "allocator.h"
-
-// 初始值不应该在此处设置(heap init中),下面设置只是为了通过单元测试
-uint64_t heap_start_vaddr = 0;      // for pass uint-test
-uint64_t heap_end_vaddr = 4096;     // for pass uint-test
-uint8_t heap[HEAP_MAX_SIZE];
+#include "explicit-list.h"
+#include "huge.h"
+#include "redblack-tree.h"
+#include "small-list.h"
+#include "policy-allocator.h"
+#include "percpu-cache.h"
+#include "quick-list.h"
+#include "scavenger.h"
+#include "tcache.h"
+#include "transfer-cache.h"
+
+// 整个进程预留的虚拟地址空间，所有 heap 实例共享
+uint8_t *heap = nullptr;
+
+// 不指定 heap 实例的接口作用于 cur_heap，默认为 default heap
+static heap_t default_heap;
+__thread heap_t *cur_heap = &default_heap;
+
+// 已经初始化的 heap 实例，按照 start_vaddr 排序
+static heap_t *heap_instances[HEAP_MAX_INSTANCES];
+static int heap_instance_count = 0;
+static std::mutex heap_instances_mutex;
 
 /* ------------------------------------- */
 /*  Operating System Implemented         */
 /* ------------------------------------- */
-void os_syscall_brk() {
-    // an empty function
-}
 
-uint32_t extend_heap(uint32_t size) {
-    // round up to page alignment
-    size = (uint32_t) round_up((uint64_t)size, 4096);
-    if (heap_end_vaddr - heap_start_vaddr + size <= HEAP_MAX_SIZE) {
-        // do brk system call to request pages for heap
-        os_syscall_brk();
-        heap_end_vaddr += size;
-    } else {
-        return 0;
+// 预留整个进程的虚拟地址空间: PROT_NONE + MAP_NORESERVE 不占用任何物理页
+// 只会预留一次，之后各个 heap 实例在其中划分区间
+static bool os_heap_reserve() {
+    if (heap != nullptr) {
+        return true;
     }
 
-    // 设置epilogue(尾言), head only
-    uint64_t epilogue = get_epilogue();
-    set_allocated(epilogue, ALLOCATED);
-    set_block_size(epilogue, 0);
+    void *addr = mmap(nullptr, HEAP_MAX_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
 
-    return size;
+    heap = static_cast<uint8_t *>(addr);
+    return true;
 }
 
-/* ------------------------------------- */
-/*  Free Block Management Implementation */
-/* ------------------------------------- */
+// 归还 [begin, end) 的物理页，并恢复为 PROT_NONE 的预留状态
+// 多线程模式下 trim 时其他线程可能不加锁地读取这些页(heap_lock_*_footprint)，因此保持可读写，读到的是 0
+static bool os_heap_decommit(uint64_t begin, uint64_t end, bool protect = true) {
+    assert(begin % 4096 == 0 && end % 4096 == 0);
+
+    if (begin >= end) {
+        return true;
+    }
 
-#ifdef IMPLICIT_FREE_LIST
-bool implicit_list_initialize_free_block();
-uint64_t implicit_list_search_free_block(uint32_t payload_size, uint32_t &alloc_block_size);
-bool implicit_list_insert_free_block(uint64_t free_header);
-bool implicit_list_delete_free_block(uint64_t free_header);
-void implicit_list_check_free_block();
-#endif
-
-#ifdef EXPLICIT_FREE_LIST
-bool explicit_list_initialize_free_block();
-uint64_t explicit_list_search_free_block(uint32_t payload_size, uint32_t &alloc_block_size);
-bool explicit_list_insert_free_block(uint64_t free_header);
-bool explicit_list_delete_free_block(uint64_t free_header);
-void explicit_list_check_free_block();
-#endif
-
-#ifdef REDBLACK_TREE
-bool redblack_tree_initialize_free_block();
-uint64_t redblack_tree_search_free_block(uint32_t payload_size, uint32_t &alloc_block_size);
-bool redblack_tree_insert_free_block(uint64_t free_header);
-bool redblack_tree_delete_free_block(uint64_t free_header);
-void redblack_tree_check_free_block();
-#endif
-
-static bool initialize_free_block() {
-#ifdef IMPLICIT_FREE_LIST
-    return implicit_list_initialize_free_block();
-#endif
-
-#ifdef EXPLICIT_FREE_LIST
-    return explicit_list_initialize_free_block();
-#endif
-
-#ifdef REDBLACK_TREE
-    return redblack_tree_initialize_free_block();
-#endif
+    uint8_t *addr = &heap[begin];
+    uint64_t length = end - begin;
+    if (madvise(addr, length, MADV_DONTNEED) != 0) {
+        return false;
+    }
+    return !protect || mprotect(addr, length, PROT_NONE) == 0;
 }
 
-static uint64_t search_free_block(uint32_t payload_size, uint32_t &alloc_block_size) {
-#ifdef IMPLICIT_FREE_LIST
-    return implicit_list_search_free_block(payload_size, alloc_block_size);
-#endif
+// 在预留的地址空间中为 h 找到一段 max_size 大小的空闲区间(首次适配)
+static bool heap_register(heap_t *h, uint64_t max_size) {
+    std::lock_guard<std::mutex> lock(heap_instances_mutex);
 
-#ifdef EXPLICIT_FREE_LIST
-    return explicit_list_search_free_block(payload_size, alloc_block_size);
-#endif
+    if (heap_instance_count == HEAP_MAX_INSTANCES) {
+        return false;
+    }
 
-#ifdef REDBLACK_TREE
-    return redblack_tree_search_free_block(payload_size, alloc_block_size);
-#endif
-}
+    uint64_t start = 0;
+    int index = 0;
+    for (; index < heap_instance_count; ++index) {
+        if (heap_instances[index]->start_vaddr - start >= max_size) {
+            break;
+        }
+        start = heap_instances[index]->start_vaddr + heap_instances[index]->max_size;
+    }
 
-static bool insert_free_block(uint64_t free_header) {
-#ifdef IMPLICIT_FREE_LIST
-    return implicit_list_insert_free_block(free_header);
-#endif
+    if (HEAP_MAX_SIZE - start < max_size) {
+        return false;
+    }
 
-#ifdef EXPLICIT_FREE_LIST
-    return explicit_list_insert_free_block(free_header);
-#endif
+    for (int i = heap_instance_count; i > index; --i) {
+        heap_instances[i] = heap_instances[i - 1];
+    }
+    heap_instances[index] = h;
+    heap_instance_count += 1;
 
-#ifdef REDBLACK_TREE
-    return redblack_tree_insert_free_block(free_header);
-#endif
+    h->start_vaddr = start;
+    h->end_vaddr = start;
+    h->max_size = max_size;
+    h->wide = start + max_size > HEAP_NARROW_LIMIT;
+    return true;
 }
 
-static int delete_free_block(uint64_t free_header) {
-#ifdef IMPLICIT_FREE_LIST
-    return implicit_list_delete_free_block(free_header);
-#endif
+static void heap_unregister(heap_t *h) {
+    std::lock_guard<std::mutex> lock(heap_instances_mutex);
 
-#ifdef EXPLICIT_FREE_LIST
-    return explicit_list_delete_free_block(free_header);
-#endif
+    int index = 0;
+    while (index < heap_instance_count && heap_instances[index] != h) {
+        ++index;
+    }
+    assert(index < heap_instance_count);
 
-#ifdef REDBLACK_TREE
-    return redblack_tree_delete_free_block(free_header);
-#endif
+    for (int i = index; i + 1 < heap_instance_count; ++i) {
+        heap_instances[i] = heap_instances[i + 1];
+    }
+    heap_instance_count -= 1;
 }
 
-static void check_free_block() {
-#ifdef IMPLICIT_FREE_LIST
-    implicit_list_check_free_block();
-#endif
+heap_t *heap_find(uint64_t vaddr) {
+    std::lock_guard<std::mutex> lock(heap_instances_mutex);
 
-#ifdef EXPLICIT_FREE_LIST
-    explicit_list_check_free_block();
-#endif
-
-#ifdef REDBLACK_TREE
-    redblack_tree_check_free_block();
-#endif
+    for (int i = 0; i < heap_instance_count; ++i) {
+        heap_t *h = heap_instances[i];
+        if (h->start_vaddr <= vaddr && vaddr < h->start_vaddr + h->max_size) {
+            return h;
+        }
+    }
+    return nullptr;
 }
 
-/* ------------------------------------- */
-/*  Malloc and Free                      */
-/* ------------------------------------- */
-void check_heap_correctness();
-
-uint64_t merge_blocks_as_free(uint64_t low, uint64_t high) {
-    assert(low % 8 == 4);
-    assert(high % 8 == 4);
-    assert(get_first_block() <= low && low < get_last_block());
-    assert(get_first_block() < high && high <= get_last_block());
-    assert(get_next_header(low) == high);
-    assert(get_prev_header(high) == low);
+bool os_syscall_brk(uint64_t new_end_vaddr) {
+    assert(heap != nullptr);
+    assert(new_end_vaddr % 4096 == 0);
+    assert(new_end_vaddr > cur_heap->start_vaddr);
 
-    // must merge as free
-    uint32_t block_size = get_block_size(low) + get_block_size(high);
+    if (new_end_vaddr - cur_heap->start_vaddr > cur_heap->max_size) {
+        // 超出了该 heap 实例的地址区间
+        return false;
+    }
 
-    set_block_size(low, block_size);
-    set_allocated(low, FREE);
+    if (cur_heap->huge != nullptr && new_end_vaddr > cur_heap->huge->low.load(std::memory_order_acquire)) {
+        // 不能进入顶端的 huge mapping 区域
+        return false;
+    }
 
-    // 当合并存在8-Byte时，由于合并后大小不再是8Byte，因此在设置header的size时会清除后面的P8信息
-    // 在get_footer中又会去检查8-Bytes完整性，导致矛盾
-    // 因此此处使用low
-    uint64_t footer = get_footer(low);
-    set_block_size(footer, block_size);
-    set_allocated(footer, FREE);
+    if (new_end_vaddr > cur_heap->end_vaddr) {
+        // commit: 让 [end_vaddr, new_end_vaddr) 可读写，物理页在第一次访问时由OS分配
+        uint64_t length = new_end_vaddr - cur_heap->end_vaddr;
+        if (mprotect(&heap[cur_heap->end_vaddr], length, PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+    } else if (!os_heap_decommit(new_end_vaddr, cur_heap->end_vaddr, cur_heap->locks == nullptr)) {
+        // decommit: 归还 [new_end_vaddr, end_vaddr) 的物理页
+        return false;
+    }
 
-    return low;
+    cur_heap->end_vaddr = new_end_vaddr;
+    return true;
 }
 
-// 首次适配内存分配算法：找到第一块合适的block用于分配
-uint64_t try_alloc_with_splitting(uint64_t block_vaddr, uint32_t request_block_size) {
-    if (request_block_size < 8) {
-        return NIL;
+void purge_free_block(uint64_t header_vaddr) {
+    assert(get_allocated(header_vaddr) == FREE);
+
+    if (is_block_purged(header_vaddr)) {
+        return;
     }
 
-    uint64_t b = block_vaddr;
-    uint32_t b_block_size = get_block_size(b);
-    uint32_t b_allocated = get_allocated(b);
+    // 空闲块需要保留的部分: header, rbt 的 parent/left/right, purged 记录(offset 16) 以及 footer
+    // 在它们之间的整页才能归还给OS
+    uint32_t block_size = get_block_size(header_vaddr);
+    uint64_t begin = round_up(header_vaddr + 20, 4096);
+    uint64_t end = (header_vaddr + block_size - 4) / 4096 * 4096;
 
-    if (b_allocated == FREE && b_block_size >= request_block_size) {
-        // allocated this block
-        delete_free_block(b);
-        uint64_t right_footer = get_footer(b);
+    if (begin < end) {
+        // 页依然保持可读写，之后被分配出去时由OS在第一次访问时重新分配物理页(lazy recommit)
+        if (madvise(&heap[begin], end - begin, MADV_DONTNEED) != 0) {
+            return;
+        }
 
-        set_allocated(b, ALLOCATED);
-        set_block_size(b, request_block_size);
+        cur_heap->stats.purge_count += 1;
+        cur_heap->stats.purged_pages += (end - begin) / 4096;
+    }
 
-        uint64_t b_footer = b + request_block_size - 4;
-        set_allocated(b_footer, ALLOCATED);
-        set_block_size(b_footer, request_block_size);
+    set_block_purged(header_vaddr);
+}
+
+uint32_t extend_heap(uint32_t size) {
+    // round up to page alignment
+    size = (uint32_t) round_up((uint64_t)size, 4096);
 
-        // 当剩余部分小于8 Byte，任何结构都无法满足，最低要求至少有8 Byte
-        // 不存在这种情况，因为分配的空间要求8 Byte对齐，因此要分配后剩余空间小于 8 Byte，则会round up到全部大小
-        uint32_t right_size = b_block_size - request_block_size;
-        if (right_size >= 8) {
-            // split this block `b`
-            // b_block_size - request_block_size >= 8
-            uint64_t right_header = get_next_header(b);
+    // do brk system call to request pages for heap
+    if (!os_syscall_brk(cur_heap->end_vaddr + size)) {
+        return 0;
+    }
 
-            set_allocated(right_header, FREE);
-            set_block_size(right_header, right_size);
+    // 设置epilogue(尾言), head only
+    uint64_t epilogue = get_epilogue();
+    set_block_size(epilogue, 0);
+    set_allocated(epilogue, ALLOCATED);
 
-            set_allocated(right_footer, FREE);
-            set_block_size(right_footer, right_size);
+    return size;
+}
 
-            assert(get_footer(right_header) == right_footer);
+/* ------------------------------------- */
+/*  Free Block Management Implementation */
+/* ------------------------------------- */
 
-            insert_free_block(right_header);
-        }
-        return get_payload(b);
+const free_block_policy_t *get_free_block_policy(free_block_strategy_t strategy) {
+    switch (strategy) {
+        case IMPLICIT_FREE_LIST_STRATEGY:
+            return &implicit_list_policy;
+        case EXPLICIT_FREE_LIST_STRATEGY:
+            return &explicit_list_policy;
+        case REDBLACK_TREE_STRATEGY:
+            return &redblack_tree_policy;
+        case SEGREGATED_FIT_STRATEGY:
+            return &segregated_list_policy;
+        case TLSF_STRATEGY:
+            return &tlsf_policy;
+        default:
+            return nullptr;
     }
-
-    // 当前空间无法满足分配或是已分配
-    return NIL;
 }
 
-uint64_t try_extend_heap_to_alloc(uint32_t size) {
-    // get the size to be added
-    uint64_t old_last = get_last_block();
+// 运行时选择的策略: 通过 cur_heap->policy 进行 dispatch
+struct POLICY_INDEX {
+    static bool initialize_free_block() {
+        return cur_heap->policy->initialize_free_block();
+    }
 
-    uint32_t last_allocated = get_allocated(old_last);
-    uint32_t last_block_size = get_block_size(old_last);
+    static uint64_t search_free_block(uint32_t payload_size, uint32_t &alloc_block_size) {
+        return cur_heap->policy->search_free_block(payload_size, alloc_block_size);
+    }
 
-    uint32_t to_request_from_OS = size;
-    if (last_allocated == FREE) {
-        // last block can help the request
-        to_request_from_OS -= last_block_size;
+    static void insert_free_block(uint64_t free_header) {
+        cur_heap->policy->insert_free_block(free_header);
+    }
 
-        delete_free_block(old_last);
+    static void delete_free_block(uint64_t free_header) {
+        cur_heap->policy->delete_free_block(free_header);
     }
 
-    uint64_t old_epilogue = get_epilogue();
+    static void check_free_block() {
+        cur_heap->policy->check_free_block();
+    }
+};
 
-    uint32_t os_allocated_size = extend_heap(to_request_from_OS);
-    if (os_allocated_size) {
-        // 成功进行heap拓展，将新申请的空间 + [原始末尾空闲块] -> 合并 + 管理起来
-        assert(os_allocated_size >= 4096);
-        assert(os_allocated_size % 4096 == 0);
+/* ------------------------------------- */
+/*  Malloc and Free                      */
+/* ------------------------------------- */
 
-        uint64_t block_header = NIL;
+uint64_t merge_blocks_as_free(uint64_t low, uint64_t high) {
+    assert(low % 8 == 4);
+    assert(high % 8 == 4);
+    assert(get_first_block() <= low && low < high);
+    assert(get_first_block() < high && high < get_epilogue());
+    assert(get_next_header(low) == high);
+    // 正在释放的 low 没有 footer
+    assert(get_allocated(low) == ALLOCATED || get_prev_header(high) == low);
+    assert((uint64_t)get_block_size(low) + get_block_size(high) <= HEAP_MAX_BLOCK_SIZE);
 
-        // now last block is different
-        // but we check the old last block
-        if (last_allocated == ALLOCATED) {
-            // no merging is needed
-            // take place the old epilogue as new last
-            uint64_t new_last = old_epilogue;
-            set_allocated(new_last, FREE);
-            set_block_size(new_last, os_allocated_size);
+    // must merge as free
+    uint32_t block_size = get_block_size(low) + get_block_size(high);
 
-            uint64_t new_last_footer = get_footer(new_last);
-            set_allocated(new_last_footer, FREE);
-            set_block_size(new_last_footer, os_allocated_size);
+    set_block_size(low, block_size);
+    set_allocated(low, FREE);
 
-            insert_free_block(new_last);
+    // 合并后的块至少为 16 Byte，footer 是普通的 footer
+    uint64_t footer = get_footer(low);
+    set_block_size(footer, block_size);
+    set_allocated(footer, FREE);
 
-            block_header = new_last;
-        } else {
-            // merging with last_block is needed
-            set_allocated(old_last, FREE);
-            set_block_size(old_last, last_block_size + os_allocated_size);
+    scavenger_cursor_absorbed(high, low);
+    return low;
+}
 
-            uint64_t last_footer = get_footer(old_last);
-            set_allocated(last_footer, FREE);
-            set_block_size(last_footer, last_block_size + os_allocated_size);
+// interface
+bool heap_init() {
+    return heap_init(cur_heap->strategy);
+}
 
-            // block size is different now
-            // consider the balanced tree index on block size, it must be reinserted
-            insert_free_block(old_last);
+bool heap_init(free_block_strategy_t strategy) {
+    uint64_t max_size = cur_heap->max_size != 0 ? cur_heap->max_size : HEAP_DEFAULT_SIZE;
+    return heap_init(cur_heap, max_size, strategy);
+}
 
-            block_header = old_last;
-        }
+bool heap_init(heap_t *h, uint64_t max_size, free_block_strategy_t strategy) {
+    assert(h != nullptr);
 
-        // try to allocate
-        uint64_t payload_vaddr = try_alloc_with_splitting(block_header, size);
-        if (payload_vaddr != NIL)
-        {
-#ifdef DEBUG_MALLOC
-            check_heap_correctness();
-#endif
-            return payload_vaddr;
-        } else {
-            assert(false);
-        }
+    const free_block_policy_t *policy = get_free_block_policy(strategy);
+    if (policy == nullptr) {
+        return false;
     }
 
-    // else, no page can be allocated
-    // 将原来末尾的最后一块空闲块插入回去
-    if (last_allocated == FREE) {
-        insert_free_block(old_last);
+    if (!heap_init_blocks(h, max_size)) {
+        return false;
     }
 
-#ifdef DEBUG_MALLOC
-    check_heap_correctness();
-    printf("OS cannot allocate physical page for heap!\n");
-#endif
+    h->strategy = strategy;
+    h->policy = policy;
 
-    return NIL;
+    HEAP_GUARD guard(h);
+    POLICY_INDEX::initialize_free_block();
+
+    return true;
 }
 
-// interface
-bool heap_init() {
-    // reset allocated to 0
-    for (int i = 0; i < HEAP_MAX_SIZE; i += 8) {
-        *(uint64_t *) &heap[i] = 0;
+bool heap_init_blocks(heap_t *h, uint64_t max_size) {
+    assert(h != nullptr);
+
+    // 重新初始化时，先将原来的物理页归还并释放地址区间，新提交的匿名页全部为0，无需手动清零
+    heap_destroy(h);
+
+    max_size = round_up(max_size, 4096);
+    assert(max_size >= 4096);
+    if (!os_heap_reserve() || !heap_register(h, max_size)) {
+        return false;
     }
 
-    // heap_start_vaddr is the starting address of the first block
-    // the payload of the first block is 8B aligned ([8])
-    // so the header address of the first block is [8] - 4 = [4]
-    heap_start_vaddr = 0;
-    heap_end_vaddr = 4096;
+    HEAP_GUARD guard(h);
+
+    // start_vaddr is the starting address of the first block
+    // the payload of the first block is 8B aligned ([start_vaddr + 8])
+    // so the header address of the first block is [start_vaddr + 8] - 4 = [start_vaddr + 4]
+    if (!os_syscall_brk(h->start_vaddr + 4096)) {
+        heap_unregister(h);
+        h->max_size = 0;
+        h->wide = false;
+        return false;
+    }
 
     // set the prologue block
     uint64_t prologue_header = get_prologue();
     set_block_size(prologue_header, 8);
     set_allocated(prologue_header, ALLOCATED);
 
-    uint64_t prologue_footer = prologue_header + 4;
-    set_block_size(prologue_footer, 8);
-    set_allocated(prologue_footer, ALLOCATED);
-
     // set the epilogue block
     // it's a header only
     uint64_t epilogue = get_epilogue();
@@ -329,118 +349,161 @@ bool heap_init() {
     set_block_size(first_footer, 4096 - 4 - 8 - 4);
     set_allocated(first_footer, FREE);
 
-    initialize_free_block();
-
     return true;
 }
 
-uint64_t mem_alloc(uint32_t size) {
-    assert(0 < size && size < HEAP_MAX_SIZE - 4 - 8 - 4);
+void heap_destroy(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return;
+    }
 
-    uint32_t alloc_block_size = 0;
-    // 在当前heap中寻找合适的free_block，如果不存在则返回NIL
-    uint64_t payload_header = search_free_block(size, alloc_block_size);
-    uint64_t payload_vaddr = NIL;
+    // 先等待后台线程结束，尚未释放的 mem_free_async 块在此之前释放
+    h->async_free.reset();
+    h->scavenger.reset();
 
-    if (payload_header != NIL) {
-        // 找到了合适的空闲块
-        payload_vaddr = try_alloc_with_splitting(payload_header, alloc_block_size);
-        assert(payload_vaddr != NIL);
-    } else {
-        // 没有合适的空闲块，进行系统调用 system_brk()
-        payload_vaddr = try_extend_heap_to_alloc(alloc_block_size);
-        // 可能 OS 没有多余的内存的了，会返回NIL
+    // 当前线程 tcache 中属于 h 的块随 h 一起丢弃
+    if (h->tcache_enabled) {
+        tcache_discard(h);
     }
 
+    // 在释放地址区间之前解除全部的 huge mapping
+    h->huge.reset();
+    os_heap_decommit(h->start_vaddr, h->end_vaddr);
+    heap_unregister(h);
+
+    h->small_list.reset();
+    h->small_stack.reset();
+    h->quick_lists.reset();
+    h->explicit_list.reset();
+    h->rbt.reset();
+    h->segregated_lists.reset();
+    h->tlsf.reset();
+    h->buddy.reset();
+    h->slab.reset();
+    h->locks.reset();
+    h->tcache_enabled = false;
+    h->tcache_epoch = 0;
+    h->transfer_cache.reset();
+    h->percpu_cache.reset();
+    h->policy = nullptr;
+    h->stats = heap_stats_t();
+
+    h->start_vaddr = 0;
+    h->end_vaddr = 0;
+    h->max_size = 0;
+    h->wide = false;
+}
 
-#ifdef DEBUG_MALLOC
-    check_heap_correctness();
-    check_free_block();
-#endif
+uint64_t mem_alloc(heap_t *h, size_t size) {
+    HEAP_GUARD guard(h);
+    return mem_alloc(size);
+}
 
-    return payload_vaddr;
+void mem_free(heap_t *h, uint64_t payload_vaddr) {
+    HEAP_GUARD guard(h);
+    mem_free(payload_vaddr);
+}
+
+uint64_t mem_realloc(heap_t *h, uint64_t payload_vaddr, size_t size) {
+    HEAP_GUARD guard(h);
+    return mem_realloc(payload_vaddr, size);
+}
+
+bool mem_trim(heap_t *h, uint32_t pad) {
+    HEAP_GUARD guard(h);
+    return mem_trim(pad);
+}
+
+uint64_t mem_alloc(size_t size) {
+    if (huge_is_suitable(size)) {
+        uint64_t payload_vaddr = huge_alloc(size);
+        if (payload_vaddr != NIL) {
+            return payload_vaddr;
+        }
+        // 没有足够的地址区间时退回到 boundary tag allocator
+    }
+
+    if (size > HEAP_MAX_PAYLOAD_SIZE) {
+        // 一个 block 的大小以 32-bit 保存
+        return NIL;
+    }
+
+    if (cur_heap->percpu_cache != nullptr && tcache_is_suitable(size)) {
+        return percpu_alloc(size);
+    }
+    if (cur_heap->tcache_enabled && tcache_is_suitable(size)) {
+        return tcache_alloc(size);
+    }
+    return mem_alloc_uncached(size);
 }
 
 void mem_free(uint64_t payload_vaddr) {
-    if (payload_vaddr == NIL) {
+    if (payload_vaddr != NIL && huge_free(payload_vaddr)) {
+        return;
+    }
+
+    // per-CPU cache 取代 tcache，bin 已满时直接归还给 heap
+    if (payload_vaddr != NIL && cur_heap->percpu_cache != nullptr) {
+        if (!percpu_free(payload_vaddr)) {
+            mem_free_uncached(payload_vaddr);
+        }
+        return;
+    }
+    if (payload_vaddr != NIL && cur_heap->tcache_enabled && tcache_free(payload_vaddr)) {
         return;
     }
+    mem_free_uncached(payload_vaddr);
+}
+
+uint64_t mem_realloc(uint64_t payload_vaddr, size_t size) {
+    if (size == 0) {
+        mem_free(payload_vaddr);
+        return NIL;
+    }
+    if (payload_vaddr == NIL) {
+        return mem_alloc(size);
+    }
 
-    assert(get_first_block() < payload_vaddr && payload_vaddr < get_epilogue());
-    assert((payload_vaddr & 0x7) == 0x0);
-
-    // request can be first or last block
-    uint64_t req = get_header(payload_vaddr);
-    uint64_t req_footer = get_footer(req);  // for last block, it's 0
-
-    uint32_t req_allocated = get_allocated(req);
-    uint32_t req_block_size = get_block_size(req);
-
-    // otherwise it's free twice
-    assert(req_allocated == ALLOCATED);
-
-    // block starting address of next & prev blocks
-    uint64_t next = get_next_header(req);
-    uint64_t prev = get_prev_header(req);
-
-    uint32_t next_allocated = get_allocated(next);
-    uint32_t prev_allocated = get_allocated(prev);
-
-    if (next_allocated == ALLOCATED && prev_allocated == ALLOCATED) {
-        // case 1: *A(A->F)A*
-        // ==> *AFA*
-        set_allocated(req, FREE);
-        set_allocated(req_footer, FREE);
-
-        // 更新空闲块信息
-        insert_free_block(req);
-#ifdef DEBUG_MALLOC
-        check_heap_correctness();
-        check_free_block();
-#endif
-    } else if (next_allocated == FREE && prev_allocated == ALLOCATED) {
-        // case 2: *A(A->F)FA
-        // ==> *AFFA ==> *A[FF]A merge current and next
-        delete_free_block(next);
-
-        uint64_t one_free = merge_blocks_as_free(req, next);
-
-        insert_free_block(one_free);
-#ifdef DEBUG_MALLOC
-        check_heap_correctness();
-        check_free_block();
-#endif
-    } else if (next_allocated == ALLOCATED && prev_allocated == FREE) {
-        // case 3: AF(A->F)A*
-        // ==> AFFA* ==> A[FF]A* merge current and prev
-        delete_free_block(prev);
-
-        uint64_t one_free = merge_blocks_as_free(prev, req);
-
-        insert_free_block(one_free);
-#ifdef DEBUG_MALLOC
-        check_heap_correctness();
-        check_free_block();
-#endif
-    } else if (next_allocated == FREE && prev_allocated == FREE) {
-        // case 4: AF(A->F)FA
-        // ==> AFFFA ==> A[FFF]A merge current and prev and next
-        delete_free_block(prev);
-        delete_free_block(next);
-
-        uint64_t one_free = merge_blocks_as_free(merge_blocks_as_free(prev, req), next);
-
-        insert_free_block(one_free);
-#ifdef DEBUG_MALLOC
-        check_heap_correctness();
-        check_free_block();
-#endif
+    // huge mapping 以 mremap 调整，boundary tag allocator 的块在原地分割或吸收后面的空闲块
+    uint64_t old_size = huge_get_size(payload_vaddr);
+    if (old_size != 0) {
+        if (huge_is_suitable(size)) {
+            uint64_t new_payload_vaddr = huge_realloc(payload_vaddr, size);
+            if (new_payload_vaddr != NIL) {
+                return new_payload_vaddr;
+            }
+        }
     } else {
-#ifdef DEBUG_MALLOC
-        printf("exception for free\n");
-        exit(0);
-#endif
+        if (size <= HEAP_MAX_PAYLOAD_SIZE && !huge_is_suitable(size) &&
+            HEAP_ALGORITHM<POLICY_INDEX>::resize(payload_vaddr, (uint32_t)size)) {
+            return payload_vaddr;
+        }
+        old_size = HEAP_ALGORITHM<POLICY_INDEX>::usable_size(payload_vaddr);
     }
+
+    // 无法原地调整: 分配新的块并复制
+    uint64_t new_payload_vaddr = mem_alloc(size);
+    if (new_payload_vaddr == NIL) {
+        return NIL;
+    }
+    memcpy(&heap[new_payload_vaddr], &heap[payload_vaddr], old_size < size ? old_size : size);
+    mem_free(payload_vaddr);
+    return new_payload_vaddr;
+}
+
+uint64_t mem_alloc_uncached(uint32_t size) {
+    return HEAP_ALGORITHM<POLICY_INDEX>::alloc(size);
+}
+
+void mem_free_uncached(uint64_t payload_vaddr) {
+    HEAP_ALGORITHM<POLICY_INDEX>::free(payload_vaddr);
+}
+
+bool mem_trim(uint32_t pad) {
+    return HEAP_ALGORITHM<POLICY_INDEX>::trim(pad);
 }
 
 /* ------------------------------------- */
@@ -448,20 +511,24 @@ void mem_free(uint64_t payload_vaddr) {
 /* ------------------------------------- */
 void check_heap_correctness() {
     int linear_free_counter = 0;
+    uint32_t prev_free_size = 0;
     uint64_t p = get_first_block();
-    while(p != NIL && p <= get_last_block()) {
+    uint32_t prev_allocated = ALLOCATED;    // prologue
+    while(p != NIL && p < get_epilogue()) {
         assert(p % 8 == 4);
-        assert(get_first_block() <= p && p <= get_last_block());
+        assert(get_first_block() <= p && p < get_epilogue());
 
-        uint64_t f = get_footer(p);
 //        printf("header = %lu, size = %lu\n", p, get_block_size(p));
-//        printf("footer = %lu, size = %lu\n", p, get_block_size(f));
 
-        uint32_t block_size = get_block_size(p);
-        if (block_size != 8) {
+        // 只有空闲块有 footer，下一个 header 的 PA bit 与当前块的 AF 一致
+        assert(((*reinterpret_cast<uint32_t *>(&heap[p]) >> 1) & 0x1) == prev_allocated);
+        if (get_allocated(p) == FREE) {
+            uint64_t f = get_footer(p);
             assert(get_block_size(p) == get_block_size(f));
             assert(get_allocated(p) == get_allocated(f));
+            assert(get_prev_header(get_next_header(p)) == p);
         }
+        prev_allocated = get_allocated(p);
 
         // rule 1: block[0] ==> A/F
         // rule 2: block[-1] ==> A/F
@@ -470,8 +537,13 @@ void check_heap_correctness() {
         // these 4 rules ensures that
         // adjacent free blocks are always merged together
         // henceforth external fragmentation are minimized
+        // 例外: 合并后超过 HEAP_MAX_BLOCK_SIZE 的相邻空闲块保持分开
         if (get_allocated(p) == FREE) {
             linear_free_counter += 1;
+            if (linear_free_counter > 1 && (uint64_t)prev_free_size + get_block_size(p) > HEAP_MAX_BLOCK_SIZE) {
+                linear_free_counter = 1;
+            }
+            prev_free_size = get_block_size(p);
         } else {
             linear_free_counter = 0;
         }
@@ -480,6 +552,8 @@ void check_heap_correctness() {
 
         p = get_next_header(p);
     }
+    assert(p == get_epilogue());
+    assert(((*reinterpret_cast<uint32_t *>(&heap[p]) >> 1) & 0x1) == prev_allocated);
 }
 
 static void block_info_print(uint64_t h) {
@@ -490,11 +564,12 @@ static void block_info_print(uint64_t h) {
     uint32_t hv = *reinterpret_cast<uint32_t *>(&heap[h]);
     uint32_t fv = *reinterpret_cast<uint32_t *>(&heap[f]);
 
-    uint32_t p8 = (hv >> 1) & 0x1;
+    uint32_t pa = (hv >> 1) & 0x1;
     uint32_t b8 = (hv >> 2) & 0x1;
+    // 已分配的块没有 footer，RB 没有意义
     uint32_t rb = (fv >> 1) & 0x1;
 
-    printf("H:%lu,\tF:%lu,\tS:%u,\t(A:%u,RB:%u,B8:%u,P8:%u)\n", h, f, s, a, rb, b8, p8);
+    printf("H:%lu,\tF:%lu,\tS:%u,\t(A:%u,RB:%u,B8:%u,PA:%u)\n", h, f, s, a, rb, b8, pa);
 }
 
 void print_heap() {
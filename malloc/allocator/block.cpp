@@ -16,16 +16,23 @@ uint64_t round_up(uint64_t x, uint64_t n) {
 /* ------------------------------------- */
 
 const int AF_BIT = 0;   // allocated / free bit
-const int P8_BIT = 1;   // prev is 8 byte block bit
+const int PA_BIT = 1;   // prev block is allocated bit
 const int B8_BIT = 2;   // block is 8 byte bit
 
+// 只有空闲块有 footer，已分配的块的 payload 一直延伸到下一个 header 之前
+// 下一个 block 的 header 中的 PA bit 记录当前块是否已分配，PA 为 0 时才通过 footer 找到前一个块:
+//  - 普通空闲块的 footer 与 header 相同: size + AF，bit 1 为红黑树的 color
+//  - 8-Byte 空闲块的 footer(header + 4) 的高 29 位为 small list 的 next，bit 2(B8) 置 1 作为标记
+// 多线程模式下，small list 会在只持有 index 锁时修改 8-Byte 空闲块 header 的高位，
+// 而相邻 block 的分配与释放会同时修改同一个 header 的 PA bit，因此单个 bit 的修改是原子的
+
 static void set_bit(uint64_t vaddr, int bit_offset) {
-    uint64_t vector = 1 << bit_offset;
+    uint32_t vector = 1 << bit_offset;
 
     assert((vaddr & 0x3) == 0x0);  // vaddr should be 4 bytes alignment
     assert(get_prologue() <= vaddr && vaddr <= get_epilogue());
 
-    *reinterpret_cast<uint32_t *>(&heap[vaddr]) |= vector;
+    __atomic_fetch_or(reinterpret_cast<uint32_t *>(&heap[vaddr]), vector, __ATOMIC_RELAXED);
 }
 
 static void reset_bit(uint64_t vaddr, int bit_offset) {
@@ -34,7 +41,7 @@ static void reset_bit(uint64_t vaddr, int bit_offset) {
     assert((vaddr & 0x3) == 0x0);  // vaddr should be 4 bytes alignment
     assert(get_prologue() <= vaddr && vaddr <= get_epilogue());
 
-    *reinterpret_cast<uint32_t *>(&heap[vaddr]) &= (~vector);
+    __atomic_fetch_and(reinterpret_cast<uint32_t *>(&heap[vaddr]), ~vector, __ATOMIC_RELAXED);
 }
 
 // is_bit_set传入的是block vaddr
@@ -42,7 +49,7 @@ static bool is_bit_set(uint64_t vaddr, int bit_offset) {
     assert((vaddr & 0x3) == 0x0);  // vaddr should be 4 bytes alignment
     assert(get_prologue() <= vaddr && vaddr <= get_epilogue());
 
-    return (*reinterpret_cast<uint32_t *>(&heap[vaddr]) >> bit_offset) & 0x1;
+    return (__atomic_load_n(reinterpret_cast<uint32_t *>(&heap[vaddr]), __ATOMIC_RELAXED) >> bit_offset) & 0x1;
 }
 
 static void check_block8_correctness(uint64_t vaddr) {
@@ -53,37 +60,21 @@ static void check_block8_correctness(uint64_t vaddr) {
     assert(vaddr % 4 == 0);
     assert(get_prologue() <= vaddr && vaddr <= get_epilogue());
 
-    if (vaddr % 8 == 4) {
-        // header
+    if (vaddr % 8 == 0) {
+        // footer of a free 8-byte block
         assert(is_bit_set(vaddr, B8_BIT));
+        vaddr -= 4;
+    }
 
-        uint64_t next_header = vaddr + 8;
-
-        // B8 cannot be epilogue
-        assert(next_header <= get_epilogue());
-        assert(is_bit_set(next_header, P8_BIT));
-
-        if (get_allocated(vaddr) == ALLOCATED) {
-            // size == 8
-            assert((*reinterpret_cast<uint32_t *>(&heap[vaddr]) & 0xFFFFFFF8) == 8);
-        }
-    } else if (vaddr % 8 == 0) {
-        // payload(footer)
-        uint64_t next_header = vaddr + 8;
+    assert(vaddr % 8 == 4);
+    assert(is_bit_set(vaddr, B8_BIT));
 
-        // B8 cannot be epilogue
-        assert(next_header <= get_epilogue());
-        assert(is_bit_set(next_header, P8_BIT));
+    // B8 cannot be epilogue
+    assert(vaddr + 8 <= get_epilogue());
 
-        vaddr -= 4;
-        assert(is_bit_set(vaddr, B8_BIT));
-
-        if (get_allocated(vaddr) == ALLOCATED) {
-            // size == 8
-            assert((*reinterpret_cast<uint32_t *>(&heap[vaddr]) & 0xFFFFFFF8) == 8);
-        }
-    } else {
-        assert(false);
+    if ((*reinterpret_cast<uint32_t *>(&heap[vaddr]) & 0x1) == ALLOCATED) {
+        // size == 8
+        assert((*reinterpret_cast<uint32_t *>(&heap[vaddr]) & 0xFFFFFFF8) == 8);
     }
 }
 
@@ -94,25 +85,42 @@ static bool is_block8(uint64_t vaddr) {
 
     assert(get_prologue() <= vaddr && vaddr < get_epilogue());
 
-    if (vaddr % 8 == 4) {
-        // header
-        if (is_bit_set(vaddr, B8_BIT)) {
-#ifdef DEBUG_MALLOC
-            check_block8_correctness(vaddr);
-#endif
-            return true;
-        }
-    } else if (vaddr % 8 == 0) {
-        // payload(footer)
-        uint64_t next_header = vaddr + 4;
-        if (is_bit_set(next_header, P8_BIT)) {
+    // header: B8 bit; footer(只存在于空闲块): B8 标记
+    if (is_bit_set(vaddr, B8_BIT)) {
 #ifdef DEBUG_MALLOC
-            check_block8_correctness(vaddr - 4);
+        check_block8_correctness(vaddr);
 #endif
-            return true;
-        }
+        return true;
+    }
+    return false;
+}
+
+// 根据 header 的 AF 设置下一个 header 的 PA bit
+// header 中的 size 必须已经是正确的，epilogue(size 0) 以及越过 epilogue 的 block 没有下一个 header
+static void update_next_prev_allocated(uint64_t header_vaddr) {
+    uint32_t header_value = __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[header_vaddr]), __ATOMIC_RELAXED);
+    uint32_t block_size = ((header_value >> B8_BIT) & 0x1) ? 8 : (header_value & 0xFFFFFFF8);
+    uint64_t next_header_vaddr = header_vaddr + block_size;
+    if (block_size == 0 || next_header_vaddr > get_epilogue()) {
+        return;
+    }
+
+    if ((header_value & 0x1) == ALLOCATED) {
+        set_bit(next_header_vaddr, PA_BIT);
+    } else {
+        reset_bit(next_header_vaddr, PA_BIT);
     }
-    return 0;
+}
+
+uint32_t get_alloc_block_size(uint32_t payload_size) {
+    // header + payload，已分配的块没有 footer
+    uint32_t block_size = (uint32_t)round_up((uint64_t)payload_size + 4, 8);
+    return block_size < get_min_block_size() ? get_min_block_size() : block_size;
+}
+
+uint32_t get_min_block_size() {
+    // 8-Byte 空闲块的 prev/next 只有 29 bit
+    return cur_heap->wide ? MIN_EXPLICIT_FREE_LIST_BLOCKSIZE : 8;
 }
 
 // applicable for both header & footer
@@ -139,6 +147,7 @@ uint32_t get_block_size(uint64_t header_vaddr) {
 }
 
 // applicable for both header & footer
+// footer 只用于空闲块，设置 header 之后下一个 header 的 PA bit 随之更新
 void set_block_size(uint64_t header_vaddr, uint32_t block_size) {
     if (header_vaddr == NIL) {
         return;
@@ -148,46 +157,36 @@ void set_block_size(uint64_t header_vaddr, uint32_t block_size) {
     assert((header_vaddr & 0x3) == 0x0);  // header & footer should be 4 bytes alignment
     assert((block_size & 0x7) == 0x0);   // block size should be 8 bytes aligned
 
-    uint64_t next_header_vaddr;
     if (block_size == 8) {
         // small block is special
         if (header_vaddr % 8 == 0) {
-            // do not set footer of small block
+            // footer of a free 8-byte block: only the B8 mark, the rest is the next of small list
             // reset to header
+            set_bit(header_vaddr, B8_BIT);
             header_vaddr = header_vaddr - 4;
         }
-        next_header_vaddr = header_vaddr + 8;
 
         set_bit(header_vaddr, B8_BIT);
-        if (next_header_vaddr <= get_epilogue()) {
-            set_bit(next_header_vaddr, P8_BIT);
-        }
 
         if (get_allocated(header_vaddr) == FREE) {
             // free 8-byte does not set block size
+            update_next_prev_allocated(header_vaddr);
             return;
         }
         // else, set header block size 8
     } else {
-        // an ordinary block
-        if (header_vaddr % 8 == 4) {
-            // header
-            next_header_vaddr = header_vaddr + block_size;
-        } else {
-            // footer
-            next_header_vaddr = header_vaddr + 4;
-        }
-
+        // an ordinary block, header: B8 bit; footer: B8 mark
         reset_bit(header_vaddr, B8_BIT);
-        if (next_header_vaddr <= get_epilogue()) {
-            reset_bit(next_header_vaddr, P8_BIT);
-        }
     }
 
     // 清除原来的size信息,但保持allocated信息
     *(uint32_t *)&heap[header_vaddr] &= 0x00000007;
     *(uint32_t *)&heap[header_vaddr] |= block_size;  // 设置新的size
 
+    if (header_vaddr % 8 == 4) {
+        update_next_prev_allocated(header_vaddr);
+    }
+
 #ifdef DEBUG_MALLOC
     if (block_size == 8) {
         check_block8_correctness(header_vaddr);
@@ -208,26 +207,14 @@ uint32_t get_allocated(uint64_t header_vaddr) {
     assert(get_prologue() <= header_vaddr && header_vaddr <= get_epilogue());
     assert((header_vaddr & 0x3) == 0x0);  // header & footer should be 4 bytes alignment
 
-    // ⭐ 如果传入的是footer，需要判断下这个是否是8 Byte block -> 通过+4获取next_header，其P8标识了
-    // 如果是8 Byte block，则无需设置，设置header即可
-    if (header_vaddr % 8 == 0) {
-        // footer
-        // check if 8-byte small block
-        uint64_t next_header_vaddr = header_vaddr + 4;
-        if (next_header_vaddr <= get_epilogue()) {
-            // check P8 bit of next
-            if (is_bit_set(next_header_vaddr, P8_BIT)) {
-                // current block is 8-byte, no footer. check header instead
-                header_vaddr -= 4;
+    // ⭐ 如果传入的是footer，需要判断下这个是否是8 Byte block -> footer 中的 B8 标记
+    // 如果是8 Byte block，footer 中没有 allocated 信息，读取header即可
+    if (header_vaddr % 8 == 0 && is_bit_set(header_vaddr, B8_BIT)) {
+        // current block is 8-byte. check header instead
+        header_vaddr -= 4;
 #ifdef DEBUG_MALLOC
-                check_block8_correctness(header_vaddr);
+        check_block8_correctness(header_vaddr);
 #endif
-            }
-            // else, current block has footer
-        } else {
-            // this is block is epilogue but it's 8X
-            assert(false);
-        }
     }
 
     uint32_t header_value = *(uint32_t *)&heap[header_vaddr];
@@ -235,6 +222,7 @@ uint32_t get_allocated(uint64_t header_vaddr) {
 }
 
 // applicable for both header & footer
+// footer 只用于空闲块，设置 header 之后下一个 header 的 PA bit 随之更新
 void set_allocated(uint64_t header_vaddr, uint32_t allocated) {
     if (header_vaddr == NIL) {
         return;
@@ -243,31 +231,22 @@ void set_allocated(uint64_t header_vaddr, uint32_t allocated) {
     assert(get_prologue() <= header_vaddr && header_vaddr <= get_epilogue());
     assert((header_vaddr & 0x3) == 0x0);
 
-    if (header_vaddr % 8 == 0) {
-        // footer
-        // check if 8-byte small block
-        uint64_t next_header_vaddr = header_vaddr + 4;
-        if (next_header_vaddr <= get_epilogue()) {
-            // check P8 bit of next
-            if (is_bit_set(next_header_vaddr, P8_BIT)) {
-                // current block is 8-byte, no footer. check header instead
-                header_vaddr -= 4;
+    if (header_vaddr % 8 == 0 && is_bit_set(header_vaddr, B8_BIT)) {
+        // footer of a free 8-byte block. set header instead
+        header_vaddr -= 4;
 #ifdef DEBUG_MALLOC
-                check_block8_correctness(header_vaddr);
+        check_block8_correctness(header_vaddr);
 #endif
-            }
-            // else, current block has footer
-        } else {
-            // this is block is epilogue but it's 8X
-            assert(false);
-        }
     }
 
-    // 清除allocated信息，但是保持size + B8 + P8信息
+    // 清除allocated信息，但是保持size + B8 + PA信息
     *(uint32_t *)(&heap[header_vaddr]) &= 0xFFFFFFFE;
     // 设置allocated信息，同时确保allocated只有一位
     *(uint32_t *)(&heap[header_vaddr]) |= (allocated & 0x1);
-    return ;
+
+    if (header_vaddr % 8 == 4) {
+        update_next_prev_allocated(header_vaddr);
+    }
 }
 
 uint64_t get_payload(uint64_t vaddr) {
@@ -360,53 +339,47 @@ uint64_t get_prev_header(uint64_t vaddr) {
     assert((vaddr & 0x3) == 0);
     uint64_t header_vaddr = get_header(vaddr);
 
-    uint64_t prev_header_vaddr = NIL;
+    if (is_bit_set(header_vaddr, PA_BIT) == 1) {
+        // previous block is allocated and has no footer
+        return NIL;
+    }
 
-    // check P8 bit 0010
-    if (is_bit_set(header_vaddr, P8_BIT) == 1) {
-        // previous block is 8-byte block
-        prev_header_vaddr = header_vaddr - 8;
-#ifdef DEBUG_MALLOC
-        check_block8_correctness(prev_header_vaddr);
-#endif
-        return prev_header_vaddr;
-    } else {
-        // previous block is bigger than 8 bytes
-        uint64_t prev_footer_vaddr = header_vaddr - 4;
-        uint64_t prev_block_size = get_block_size(prev_footer_vaddr);
+    // previous block is free, its footer is right before the header
+    uint64_t prev_footer_vaddr = header_vaddr - 4;
+    uint64_t prev_block_size = get_block_size(prev_footer_vaddr);
 
-        prev_header_vaddr = header_vaddr - prev_block_size;
+    uint64_t prev_header_vaddr = header_vaddr - prev_block_size;
 
-        assert(get_first_block() <= prev_header_vaddr && prev_header_vaddr < get_epilogue());
-        assert(get_block_size(prev_header_vaddr) == get_block_size(prev_footer_vaddr));
-        assert(get_allocated(prev_header_vaddr) == get_allocated(prev_footer_vaddr));
+    assert(get_first_block() <= prev_header_vaddr && prev_header_vaddr < get_epilogue());
+    assert(get_block_size(prev_header_vaddr) == get_block_size(prev_footer_vaddr));
+    assert(get_allocated(prev_header_vaddr) == FREE);
+    assert(get_allocated(prev_footer_vaddr) == FREE);
 
-        return prev_header_vaddr;
-    }
+    return prev_header_vaddr;
 }
 
 uint64_t get_prologue() {
-    assert(heap_end_vaddr > heap_start_vaddr);
-    assert((heap_end_vaddr - heap_start_vaddr) % 4096 == 0);
-    assert(heap_start_vaddr % 4096 == 0);
+    assert(cur_heap->end_vaddr > cur_heap->start_vaddr);
+    assert((cur_heap->end_vaddr - cur_heap->start_vaddr) % 4096 == 0);
+    assert(cur_heap->start_vaddr % 4096 == 0);
 
     // 4 for the not in use
-    return heap_start_vaddr + 4;
+    return cur_heap->start_vaddr + 4;
 }
 
 uint64_t get_epilogue() {
-    assert(heap_end_vaddr > heap_start_vaddr);
-    assert((heap_end_vaddr - heap_start_vaddr) % 4096 == 0);
-    assert(heap_start_vaddr % 4096 == 0);
+    assert(cur_heap->end_vaddr > cur_heap->start_vaddr);
+    assert((cur_heap->end_vaddr - cur_heap->start_vaddr) % 4096 == 0);
+    assert(cur_heap->start_vaddr % 4096 == 0);
 
     // epilogue block is having header only
-    return heap_end_vaddr - 4;
+    return cur_heap->end_vaddr - 4;
 }
 
 uint64_t get_first_block() {
-    assert(heap_end_vaddr > heap_start_vaddr);
-    assert((heap_end_vaddr - heap_start_vaddr) % 4096 == 0);
-    assert(heap_start_vaddr % 4096 == 0);
+    assert(cur_heap->end_vaddr > cur_heap->start_vaddr);
+    assert((cur_heap->end_vaddr - cur_heap->start_vaddr) % 4096 == 0);
+    assert(cur_heap->start_vaddr % 4096 == 0);
 
     // 4 for the not in use
     // 8 for the prologue block
@@ -414,9 +387,9 @@ uint64_t get_first_block() {
 }
 
 uint64_t get_last_block() {
-    assert(heap_end_vaddr > heap_start_vaddr);
-    assert((heap_end_vaddr - heap_start_vaddr) % 4096 == 0);
-    assert(heap_start_vaddr % 4096 == 0);
+    assert(cur_heap->end_vaddr > cur_heap->start_vaddr);
+    assert((cur_heap->end_vaddr - cur_heap->start_vaddr) % 4096 == 0);
+    assert(cur_heap->start_vaddr % 4096 == 0);
 
     uint64_t epilogue_header = get_epilogue();
     return get_prev_header(epilogue_header);
@@ -468,13 +441,12 @@ uint64_t get_field32_block_ptr(uint64_t header_vaddr, uint32_t min_block_size, u
         return NIL;
     }
 
-    assert(get_first_block() <= header_vaddr && header_vaddr <= get_last_block());
+    assert(get_first_block() <= header_vaddr && header_vaddr < get_epilogue());
     assert(header_vaddr % 8 == 4);
     assert(get_block_size(header_vaddr) >= min_block_size);
 
     assert(offset % 4 == 0);
-    uint32_t vaddr_32 = *(uint32_t *)&heap[header_vaddr + offset];
-    return (uint64_t)vaddr_32;
+    return decompress_header_ptr(*(uint32_t *)&heap[header_vaddr + offset]);
 }
 
 bool set_field32_block_ptr(uint64_t header_vaddr, uint64_t block_ptr, uint32_t min_block_size, uint32_t offset) {
@@ -482,19 +454,50 @@ bool set_field32_block_ptr(uint64_t header_vaddr, uint64_t block_ptr, uint32_t m
         return false;
     }
 
-    assert(get_first_block() <= header_vaddr && header_vaddr <= get_last_block());
+    assert(get_first_block() <= header_vaddr && header_vaddr < get_epilogue());
     assert(header_vaddr % 8 == 4);
     assert(get_block_size(header_vaddr) >= min_block_size);
 
-    assert(block_ptr == NIL || (get_first_block() <= block_ptr && block_ptr <= get_last_block()));
+    assert(block_ptr == NIL || (get_first_block() <= block_ptr && block_ptr < get_epilogue()));
     assert(block_ptr == NIL || (block_ptr % 8 == 4));
     assert(block_ptr == NIL || (get_block_size(block_ptr) >= min_block_size));
 
     assert(offset % 4 == 0);
 
-    // actually is a 32-bit pointer
-    assert((block_ptr >> 32) == 0);
-    *(uint32_t *)&heap[header_vaddr + offset] = (uint32_t)(block_ptr & 0xFFFFFFFF);
+    // actually is a 32-bit compressed pointer
+    *(uint32_t *)&heap[header_vaddr + offset] = compress_ptr(block_ptr);
 
     return true;
-}
\ No newline at end of file
+}
+// 被 purge 过的空闲块(>= 40)在 offset 16 处记录其结束地址 header + block_size(compress_ptr)
+// 块被合并或分割之后大小发生变化，记录自然失效，因此无需在每条路径上清除
+// 即使是残留的 payload 恰好相等，也只是少做一次 purge，不影响正确性
+const uint32_t PURGED_FIELD_OFFSET = 16;
+
+bool is_block_purged(uint64_t header_vaddr) {
+    if (header_vaddr == NIL) {
+        return false;
+    }
+
+    assert(get_first_block() <= header_vaddr && header_vaddr < get_epilogue());
+    assert(header_vaddr % 8 == 4);
+
+    uint32_t block_size = get_block_size(header_vaddr);
+    if (get_allocated(header_vaddr) == ALLOCATED || block_size < MIN_REDBLACK_TREE_BLOCKSIZE) {
+        return false;
+    }
+
+    uint32_t end_vaddr = *(uint32_t *)&heap[header_vaddr + PURGED_FIELD_OFFSET];
+    return end_vaddr == compress_ptr(header_vaddr + block_size);
+}
+
+void set_block_purged(uint64_t header_vaddr) {
+    assert(get_first_block() <= header_vaddr && header_vaddr < get_epilogue());
+    assert(header_vaddr % 8 == 4);
+    assert(get_allocated(header_vaddr) == FREE);
+
+    uint32_t block_size = get_block_size(header_vaddr);
+    assert(block_size >= MIN_REDBLACK_TREE_BLOCKSIZE);
+
+    *(uint32_t *)&heap[header_vaddr + PURGED_FIELD_OFFSET] = compress_ptr(header_vaddr + block_size);
+}
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cassert>
+#include <thread>
+
+#include "allocator.h"
+#include "heap-lock.h"
+
+/* ------------------------------------- */
+/*  Thread-safe Heap                     */
+/* ------------------------------------- */
+
+bool heap_enable_thread_safe() {
+    return heap_enable_thread_safe(cur_heap);
+}
+
+bool heap_enable_thread_safe(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->policy == &implicit_list_policy) {
+        // search 需要遍历整个 heap，无法只锁住候选块
+        return false;
+    }
+
+    if (h->locks == nullptr) {
+        HEAP_LOCKS *locks = new HEAP_LOCKS();
+        locks->stripe_count = h->max_size >> HEAP_LOCK_STRIPE_SHIFT;
+        locks->stripes.reset(new std::atomic<uint32_t>[locks->stripe_count]());
+        h->locks.reset(locks);
+    }
+    return true;
+}
+
+static uint64_t get_stripe(uint64_t vaddr) {
+    assert(cur_heap->start_vaddr <= vaddr && vaddr < cur_heap->start_vaddr + cur_heap->max_size);
+    return (vaddr - cur_heap->start_vaddr) >> HEAP_LOCK_STRIPE_SHIFT;
+}
+
+/* ------------------------------------- */
+/*  Observed Version                     */
+/* ------------------------------------- */
+
+// 当前线程最近一次 search 返回的候选块，以及当时其 stripe 的版本
+static thread_local uint64_t observed_header = NIL;
+static thread_local uint32_t observed_version = 0;
+
+void heap_lock_observe(uint64_t header_vaddr) {
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    if (locks == nullptr) {
+        return;
+    }
+
+    observed_header = header_vaddr;
+    observed_version = locks->stripes[get_stripe(header_vaddr)].load(std::memory_order_acquire);
+}
+
+bool heap_lock_is_observed(uint64_t header_vaddr) {
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    assert(locks != nullptr);
+
+    if (observed_header != header_vaddr) {
+        return false;
+    }
+
+    // observe 时 stripe 被其他线程持有(奇数)，或者之后被其他线程持有过，都会使版本号不等于 observed + 1
+    uint32_t version = locks->stripes[get_stripe(header_vaddr)].load(std::memory_order_relaxed);
+    return version == observed_version + 1;
+}
+
+/* ------------------------------------- */
+/*  Stripe Set                           */
+/* ------------------------------------- */
+
+void STRIPE_SET::add(uint64_t vaddr) {
+    if (vaddr < cur_heap->start_vaddr || vaddr >= cur_heap->start_vaddr + cur_heap->max_size) {
+        // 不加锁读到的值可能已经过时，越界的地址直接忽略，在锁内重新计算时会发现不一致
+        return;
+    }
+
+    uint64_t s = get_stripe(vaddr);
+    uint64_t *end = stripes_ + count_;
+    uint64_t *pos = std::lower_bound(stripes_, end, s);
+    if (pos != end && *pos == s) {
+        return;
+    }
+
+    assert(count_ < MAX_STRIPES);
+    std::copy_backward(pos, end, end + 1);
+    *pos = s;
+    count_ += 1;
+}
+
+void STRIPE_SET::clear() {
+    assert(!locked_);
+    count_ = 0;
+}
+
+bool STRIPE_SET::covers(const STRIPE_SET &other) const {
+    return std::includes(stripes_, stripes_ + count_, other.stripes_, other.stripes_ + other.count_);
+}
+
+static void lock_stripe(std::atomic<uint32_t> &stripe) {
+    uint32_t spins = 0;
+    for (;;) {
+        uint32_t version = stripe.load(std::memory_order_relaxed);
+        if ((version & 0x1) == 0 &&
+            stripe.compare_exchange_weak(version, version + 1, std::memory_order_acquire)) {
+            return;
+        }
+
+        // 持有 stripe 的时间很短，先自旋，之后让出 CPU
+        spins += 1;
+        if (spins % 64 == 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void STRIPE_SET::lock() {
+    assert(!locked_);
+
+    // 按 stripe 升序获取
+    for (int i = 0; i < count_; ++i) {
+        lock_stripe(locks_->stripes[stripes_[i]]);
+    }
+    locked_ = true;
+}
+
+void STRIPE_SET::unlock() {
+    assert(locked_);
+
+    for (int i = count_ - 1; i >= 0; --i) {
+        locks_->stripes[stripes_[i]].fetch_add(1, std::memory_order_release);
+    }
+    locked_ = false;
+}
+
+/* ------------------------------------- */
+/*  Footprint                            */
+/* ------------------------------------- */
+
+// 读取之前先检查地址是否在 heap 之中，越界时返回 0
+static uint32_t raw_word(uint64_t vaddr) {
+    if (vaddr < cur_heap->start_vaddr || vaddr > cur_heap->end_vaddr - 4) {
+        return 0;
+    }
+    return __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[vaddr]), __ATOMIC_RELAXED);
+}
+
+// 与 get_block_size 相同，但不检查 block 的完整性
+static uint32_t raw_block_size(uint64_t header_vaddr) {
+    uint32_t value = raw_word(header_vaddr);
+    if ((value >> 2) & 0x1) {
+        // B8
+        return 8;
+    }
+    return value & 0xFFFFFFF8;
+}
+
+// 与 get_prev_header 相同: 前一个块已分配(PA)时没有 footer，返回 NIL
+static uint64_t raw_prev_header(uint64_t header_vaddr) {
+    if ((raw_word(header_vaddr) >> 1) & 0x1) {
+        // PA
+        return NIL;
+    }
+
+    uint32_t footer_value = raw_word(header_vaddr - 4);
+    if ((footer_value >> 2) & 0x1) {
+        // footer of a free 8-byte block
+        return header_vaddr - 8;
+    }
+    return header_vaddr - (footer_value & 0xFFFFFFF8);
+}
+
+// 已分配的 b 没有 footer，PA bit 在 b + request 或 b + block_size 上
+static void split_footprint(STRIPE_SET &s, uint64_t b, uint32_t block_size, uint32_t request) {
+    s.add(b);
+    s.add(b + request);
+    s.add(b + block_size - 4);
+    s.add(b + block_size);
+}
+
+// 最后一块、epilogue，以及 break 移动到 new_end_vaddr 之后新的 epilogue 与其前面的 footer
+static void tail_footprint(STRIPE_SET &s, uint64_t last, uint64_t new_end_vaddr) {
+    uint64_t epilogue = cur_heap->end_vaddr - 4;
+
+    if (last != NIL) {
+        s.add(last);
+    }
+    s.add(epilogue - 4);
+    s.add(epilogue);
+    s.add(new_end_vaddr - 8);
+    s.add(new_end_vaddr - 4);
+}
+
+void heap_lock_alloc_footprint(STRIPE_SET &s, uint64_t b, uint32_t request) {
+    split_footprint(s, b, raw_block_size(b), request);
+}
+
+void heap_lock_free_footprint(STRIPE_SET &s, uint64_t req) {
+    uint64_t prev = raw_prev_header(req);
+    uint64_t next = req + raw_block_size(req);
+
+    // [prev][req][next][next next]: 合并后的 footer 可能是 req 或 next 的 footer，PA bit 在 next 或 next next 上
+    // prev 已分配时 raw_prev_header 返回 NIL，不需要访问 prev
+    if (prev != NIL) {
+        s.add(prev);
+    }
+    s.add(req - 4);
+    s.add(req);
+    s.add(next - 4);
+    s.add(next);
+    if (next < cur_heap->end_vaddr - 4) {
+        uint64_t next_next = next + raw_block_size(next);
+        s.add(next_next - 4);
+        s.add(next_next);
+    }
+}
+
+void heap_lock_extend_footprint(STRIPE_SET &s, uint32_t block_size) {
+    uint64_t epilogue = cur_heap->end_vaddr - 4;
+    uint64_t last = raw_prev_header(epilogue);
+
+    // 与 try_extend_heap_to_alloc 相同: 末尾的空闲块与新申请的页合并之后再分割
+    uint64_t b = epilogue;
+    uint32_t to_request = block_size;
+    if (last != NIL && (raw_word(last) & 0x1) == FREE) {
+        uint32_t last_size = raw_block_size(last);
+        if (last_size >= block_size) {
+            split_footprint(s, last, last_size, block_size);
+            tail_footprint(s, last, cur_heap->end_vaddr);
+            return;
+        }
+
+        b = last;
+        to_request -= last_size;
+    }
+
+    uint64_t new_end_vaddr = cur_heap->end_vaddr + round_up(to_request, 4096);
+    split_footprint(s, b, (uint32_t)(new_end_vaddr - 4 - b), block_size);
+    tail_footprint(s, last, new_end_vaddr);
+}
+
+void heap_lock_trim_footprint(STRIPE_SET &s, uint32_t pad) {
+    uint64_t last = raw_prev_header(cur_heap->end_vaddr - 4);
+    if (last == NIL) {
+        // 末尾块已分配，trim 只读取 epilogue
+        s.add(cur_heap->end_vaddr - 4);
+        return;
+    }
+
+    // 与 trim 相同的 new_end_vaddr
+    uint64_t keep_size = pad > MIN_EXPLICIT_FREE_LIST_BLOCKSIZE ? pad : MIN_EXPLICIT_FREE_LIST_BLOCKSIZE;
+    uint64_t new_end_vaddr = round_up(last + keep_size + 4, 4096);
+    if (new_end_vaddr >= cur_heap->end_vaddr) {
+        new_end_vaddr = cur_heap->end_vaddr;
+    }
+    tail_footprint(s, last, new_end_vaddr);
+
+    // 缩短之后可能与前一个空闲块合并
+    uint64_t prev = raw_prev_header(last);
+    if (prev != NIL) {
+        s.add(prev);
+    }
+}
+
+void heap_lock_resize_footprint(STRIPE_SET &s, uint64_t req, uint32_t request) {
+    uint64_t epilogue = cur_heap->end_vaddr - 4;
+    uint64_t next = req + raw_block_size(req);
+
+    // [req][right][next][next next]: 分割出的 right 与 next 合并，或者 req 吸收 next 之后再分割
+    s.add(req);
+    s.add(req + request);
+    s.add(next - 4);
+    s.add(next);
+
+    uint64_t end = next;
+    if (next < epilogue && (raw_word(next) & 0x1) == FREE) {
+        end = next + raw_block_size(next);
+        s.add(end - 4);
+        s.add(end);
+    }
+
+    // 与 try_resize_block 相同: req(与其后的空闲块)是最后一块时拓展 heap，新的 epilogue 与其前面的 footer
+    if (end >= epilogue && req + request > epilogue) {
+        uint64_t new_end_vaddr = cur_heap->end_vaddr + round_up(req + request - epilogue, 4096);
+        s.add(new_end_vaddr - 8);
+        s.add(new_end_vaddr - 4);
+    }
+}
+
+bool heap_lock_peek_last_free(uint32_t min_size) {
+    uint64_t last = raw_prev_header(cur_heap->end_vaddr - 4);
+    if (last == NIL) {
+        return false;
+    }
+    uint32_t value = raw_word(last);
+    return (value & 0x1) == FREE && raw_block_size(last) >= min_size;
+}
+
+void heap_lock_stripe(uint64_t vaddr) {
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    assert(locks != nullptr);
+    lock_stripe(locks->stripes[get_stripe(vaddr)]);
+}
+
+void heap_unlock_stripe(uint64_t vaddr) {
+    HEAP_LOCKS *locks = cur_heap->locks.get();
+    assert(locks != nullptr);
+    locks->stripes[get_stripe(vaddr)].fetch_add(1, std::memory_order_release);
+}
+
+bool heap_lock_same_stripe(uint64_t vaddr1, uint64_t vaddr2) {
+    return get_stripe(vaddr1) == get_stripe(vaddr2);
+}
@@ -0,0 +1,245 @@
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <sys/mman.h>
+
+#include "allocator.h"
+#include "heap-lock.h"
+#include "huge.h"
+
+/* ------------------------------------- */
+/*  Operating System Implemented         */
+/* ------------------------------------- */
+
+// 以新的匿名页替换 [vaddr, vaddr + size) 的预留状态
+static bool os_map(uint64_t vaddr, uint64_t size) {
+    void *addr = mmap(&heap[vaddr], size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    return addr != MAP_FAILED;
+}
+
+// 解除映射，物理页立即归还给OS，并以 MAP_FIXED 原子地恢复为 PROT_NONE 的预留状态，地址空间中不会出现空洞
+static void os_unmap(uint64_t vaddr, uint64_t size) {
+    void *addr = mmap(&heap[vaddr], size, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    assert(addr != MAP_FAILED);
+    (void)addr;
+}
+
+// 将 [old_vaddr, old_vaddr + old_size) 移动到 new_vaddr 并增长到 new_size，原来的区间恢复为预留状态
+static bool os_move(uint64_t old_vaddr, uint64_t old_size, uint64_t new_vaddr, uint64_t new_size) {
+    assert(old_size < new_size);
+
+    if (!os_map(new_vaddr + old_size, new_size - old_size)) {
+        return false;
+    }
+
+    bool moved = false;
+#ifdef MREMAP_DONTUNMAP
+    // 只移动页表，不复制数据
+    // DONTUNMAP 使原来的区间仍然保持映射(页已经被移走)，在 os_unmap 之前不会被进程中其他的 mmap 占用
+    moved = mremap(&heap[old_vaddr], old_size, old_size,
+                   MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, &heap[new_vaddr]) != MAP_FAILED;
+#endif
+    if (!moved) {
+        // 内核不支持，或者原来的区间由原地增长形成的多个映射组成
+        if (!os_map(new_vaddr, old_size)) {
+            os_unmap(new_vaddr + old_size, new_size - old_size);
+            return false;
+        }
+        memcpy(&heap[new_vaddr], &heap[old_vaddr], old_size);
+    }
+
+    os_unmap(old_vaddr, old_size);
+    return true;
+}
+
+/* ------------------------------------- */
+/*  Huge Mappings                        */
+/* ------------------------------------- */
+
+static uint64_t get_top() {
+    return cur_heap->start_vaddr + cur_heap->max_size;
+}
+
+// 多线程模式下 mappings 的锁，单线程的 heap 返回 nullptr
+static std::mutex *get_lock(HUGE_MAPPINGS *m) {
+    return cur_heap->locks != nullptr ? &m->lock : nullptr;
+}
+
+// low 可能下降时持有 extend 锁，使 break 不会同时移动
+static std::mutex *get_extend_lock() {
+    return cur_heap->locks != nullptr ? &cur_heap->locks->extend : nullptr;
+}
+
+// 从高地址向低地址首次适配 size 大小的空闲区间，不能低于 break，不存在则返回 NIL
+static uint64_t find_range(HUGE_MAPPINGS *m, uint64_t size) {
+    uint64_t high = get_top();
+    for (auto it = m->mappings.rbegin(); it != m->mappings.rend(); ++it) {
+        if (high - (it->first + it->second) >= size) {
+            return high - size;
+        }
+        high = it->first;
+    }
+
+    if (high - cur_heap->end_vaddr >= size) {
+        return high - size;
+    }
+    return NIL;
+}
+
+static void update_low(HUGE_MAPPINGS *m) {
+    uint64_t low = m->mappings.empty() ? get_top() : m->mappings.begin()->first;
+    m->low.store(low, std::memory_order_release);
+}
+
+HUGE_MAPPINGS::~HUGE_MAPPINGS() {
+    for (auto &mapping : mappings) {
+        os_unmap(mapping.first, mapping.second);
+    }
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_enable_huge_mappings(uint64_t threshold) {
+    return heap_enable_huge_mappings(cur_heap, threshold);
+}
+
+bool heap_enable_huge_mappings(heap_t *h, uint64_t threshold) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->huge == nullptr) {
+        h->huge.reset(new HUGE_MAPPINGS());
+        h->huge->low.store(h->start_vaddr + h->max_size, std::memory_order_relaxed);
+    }
+    h->huge->threshold = threshold > HUGE_MIN_THRESHOLD ? threshold : HUGE_MIN_THRESHOLD;
+    return true;
+}
+
+huge_stats_t heap_huge_stats(heap_t *h) {
+    assert(h != nullptr && h->huge != nullptr);
+
+    HEAP_GUARD guard(h);
+    HEAP_INDEX_GUARD huge_guard(get_lock(h->huge.get()));
+    return h->huge->stats;
+}
+
+bool huge_is_suitable(size_t payload_size) {
+    HUGE_MAPPINGS *m = cur_heap->huge.get();
+    return m != nullptr && payload_size >= m->threshold;
+}
+
+uint64_t huge_alloc(size_t payload_size) {
+    HUGE_MAPPINGS *m = cur_heap->huge.get();
+    assert(m != nullptr && huge_is_suitable(payload_size));
+
+    uint64_t size = round_up(payload_size, 4096);
+
+    HEAP_INDEX_GUARD extend_guard(get_extend_lock());
+    HEAP_INDEX_GUARD guard(get_lock(m));
+
+    uint64_t vaddr = find_range(m, size);
+    if (vaddr == NIL || !os_map(vaddr, size)) {
+        return NIL;
+    }
+
+    m->mappings[vaddr] = size;
+    update_low(m);
+    m->stats.mapping_count += 1;
+    m->stats.mapped_bytes += size;
+    return vaddr;
+}
+
+bool huge_owns(uint64_t vaddr) {
+    HUGE_MAPPINGS *m = cur_heap->huge.get();
+    return m != nullptr && m->low.load(std::memory_order_acquire) <= vaddr && vaddr < get_top();
+}
+
+bool huge_free(uint64_t payload_vaddr) {
+    if (!huge_owns(payload_vaddr)) {
+        return false;
+    }
+
+    HUGE_MAPPINGS *m = cur_heap->huge.get();
+    HEAP_INDEX_GUARD guard(get_lock(m));
+
+    auto it = m->mappings.find(payload_vaddr);
+    if (it == m->mappings.end()) {
+        return false;
+    }
+
+    os_unmap(it->first, it->second);
+    m->stats.mapping_count -= 1;
+    m->stats.mapped_bytes -= it->second;
+    m->mappings.erase(it);
+    update_low(m);
+    return true;
+}
+
+uint64_t huge_get_size(uint64_t payload_vaddr) {
+    if (!huge_owns(payload_vaddr)) {
+        return 0;
+    }
+
+    HUGE_MAPPINGS *m = cur_heap->huge.get();
+    HEAP_INDEX_GUARD guard(get_lock(m));
+
+    auto it = m->mappings.find(payload_vaddr);
+    return it != m->mappings.end() ? it->second : 0;
+}
+
+uint64_t huge_realloc(uint64_t payload_vaddr, size_t new_size) {
+    HUGE_MAPPINGS *m = cur_heap->huge.get();
+    assert(m != nullptr && new_size > 0);
+
+    uint64_t size = round_up(new_size, 4096);
+
+    HEAP_INDEX_GUARD extend_guard(get_extend_lock());
+    HEAP_INDEX_GUARD guard(get_lock(m));
+
+    auto it = m->mappings.find(payload_vaddr);
+    assert(it != m->mappings.end());
+    uint64_t old_size = it->second;
+
+    if (size <= old_size) {
+        // shrink: 末尾多余的页直接解除映射
+        if (size < old_size) {
+            os_unmap(payload_vaddr + size, old_size - size);
+            it->second = size;
+            m->stats.mapped_bytes -= old_size - size;
+        }
+        return payload_vaddr;
+    }
+
+    // 上方的区间空闲时原地增长
+    auto next = std::next(it);
+    uint64_t limit = next != m->mappings.end() ? next->first : get_top();
+    if (payload_vaddr + size <= limit) {
+        if (!os_map(payload_vaddr + old_size, size - old_size)) {
+            return NIL;
+        }
+        it->second = size;
+        m->stats.mapped_bytes += size - old_size;
+        return payload_vaddr;
+    }
+
+    // 否则移动到新的区间
+    uint64_t vaddr = find_range(m, size);
+    if (vaddr == NIL || !os_move(payload_vaddr, old_size, vaddr, size)) {
+        return NIL;
+    }
+
+    m->mappings.erase(it);
+    m->mappings[vaddr] = size;
+    update_low(m);
+    m->stats.mapped_bytes += size - old_size;
+    m->stats.remap_count += 1;
+    return vaddr;
+}
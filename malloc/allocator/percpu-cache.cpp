@@ -0,0 +1,328 @@
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <sched.h>
+#include <sys/sysinfo.h>
+
+#include "allocator.h"
+#include "percpu-cache.h"
+
+#ifdef PERCPU_CACHE_RSEQ
+#include <sys/rseq.h>
+#endif
+
+/* ------------------------------------- */
+/*  Per-CPU Slabs                        */
+/* ------------------------------------- */
+
+PERCPU_CACHE::PERCPU_CACHE(uint32_t cpus, bool rseq) : cpu_count(cpus), use_rseq(rseq) {
+    void *p = nullptr;
+    if (posix_memalign(&p, alignof(PERCPU_SLAB), sizeof(PERCPU_SLAB) * cpus) != 0) {
+        throw std::bad_alloc();
+    }
+
+    slabs = static_cast<PERCPU_SLAB *>(p);
+    for (uint32_t i = 0; i < cpus; ++i) {
+        new (&slabs[i]) PERCPU_SLAB();
+    }
+}
+
+PERCPU_CACHE::~PERCPU_CACHE() {
+    for (uint32_t i = 0; i < cpu_count; ++i) {
+        slabs[i].~PERCPU_SLAB();
+    }
+    free(slabs);
+}
+
+static __thread percpu_stats_t percpu_stats_;
+
+typedef enum {
+    PERCPU_DONE,            // push/pop 成功
+    PERCPU_EMPTY_OR_FULL,   // pop 时 bin 为空，或者 push 时 bin 已满
+    PERCPU_UNAVAILABLE,     // 当前线程无法使用 rseq
+} percpu_result_t;
+
+/* ------------------------------------- */
+/*  Restartable Sequences                */
+/* ------------------------------------- */
+#ifdef PERCPU_CACHE_RSEQ
+// abort handler 之前的 4 字节必须是注册 rseq 时的 signature
+static_assert(RSEQ_SIG == 0x53053053, "the abort signature in the asm below");
+
+// glibc 在每个线程创建时注册 rseq，struct rseq 位于 thread pointer + __rseq_offset
+static struct rseq *get_rseq() {
+    return reinterpret_cast<struct rseq *>(reinterpret_cast<char *>(__builtin_thread_pointer()) + __rseq_offset);
+}
+
+// 当前线程所在的 CPU，未注册 rseq 时返回负数
+static int get_rseq_cpu(struct rseq *rs) {
+    if (__rseq_size == 0) {
+        return -1;
+    }
+    return (int32_t)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+}
+
+// 临界区 [1, 2) 的描述符(struct rseq_cs)放在 __rseq_cs section，开始时写入 rs->rseq_cs
+//  - 8(rs): rseq_cs，4(rs): cpu_id
+//  - 进入临界区后先确认仍然在 cpu 上(地址是按照 cpu 计算的)，否则跳转到 abort
+//  - 被抢占、迁移或者收到信号时，内核将 IP 设置为 abort handler(4)
+#define PERCPU_RSEQ_BEGIN                       \
+    ".pushsection __rseq_cs, \"aw\"\n\t"        \
+    ".balign 32\n\t"                            \
+    "3:\n\t"                                    \
+    ".long 0x0, 0x0\n\t"                        \
+    ".quad 1f, (2f - 1f), 4f\n\t"               \
+    ".popsection\n\t"                           \
+    "leaq 3b(%%rip), %%rax\n\t"                 \
+    "movq %%rax, 8(%[rs])\n\t"                  \
+    "1:\n\t"                                    \
+    "cmpl %[cpu], 4(%[rs])\n\t"                 \
+    "jnz 4f\n\t"
+
+#define PERCPU_RSEQ_END                         \
+    "2:\n\t"                                    \
+    ".pushsection __rseq_failure, \"ax\"\n\t"   \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                \
+    ".long 0x53053053\n\t"                      \
+    "4:\n\t"                                    \
+    "jmp %l[abort]\n\t"                         \
+    ".popsection\n\t"
+
+// 返回 false 表示临界区被中止，需要重新开始
+static bool rseq_pop(struct rseq *rs, int cpu, uint32_t *top, uint32_t *items, uint32_t *value, bool &empty) {
+    empty = false;
+    __asm__ __volatile__ goto(
+        PERCPU_RSEQ_BEGIN
+        "movl (%[top]), %%ecx\n\t"
+        "testl %%ecx, %%ecx\n\t"
+        "jz %l[empty_bin]\n\t"
+        "subl $1, %%ecx\n\t"
+        "movl (%[items], %%rcx, 4), %%edx\n\t"
+        "movl %%edx, (%[value])\n\t"
+        // commit
+        "movl %%ecx, (%[top])\n\t"
+        PERCPU_RSEQ_END
+        :
+        : [rs] "r"(rs), [cpu] "r"(cpu), [top] "r"(top), [items] "r"(items), [value] "r"(value)
+        : "memory", "cc", "rax", "rcx", "rdx"
+        : empty_bin, abort);
+    return true;
+empty_bin:
+    empty = true;
+    return true;
+abort:
+    return false;
+}
+
+static bool rseq_push(struct rseq *rs, int cpu, uint32_t *top, uint32_t *items, uint32_t value, bool &full) {
+    full = false;
+    __asm__ __volatile__ goto(
+        PERCPU_RSEQ_BEGIN
+        "movl (%[top]), %%ecx\n\t"
+        "cmpl %[capacity], %%ecx\n\t"
+        "jae %l[full_bin]\n\t"
+        "movl %[value], (%[items], %%rcx, 4)\n\t"
+        "addl $1, %%ecx\n\t"
+        // commit
+        "movl %%ecx, (%[top])\n\t"
+        PERCPU_RSEQ_END
+        :
+        : [rs] "r"(rs), [cpu] "r"(cpu), [top] "r"(top), [items] "r"(items), [value] "r"(value),
+          [capacity] "i"(PERCPU_BIN_CAPACITY)
+        : "memory", "cc", "rax", "rcx"
+        : full_bin, abort);
+    return true;
+full_bin:
+    full = true;
+    return true;
+abort:
+    return false;
+}
+
+static bool rseq_available() {
+    return get_rseq_cpu(get_rseq()) >= 0;
+}
+#else
+static bool rseq_available() {
+    return false;
+}
+#endif
+
+/* ------------------------------------- */
+/*  Push & Pop                           */
+/* ------------------------------------- */
+
+// rseq 不可用时: 持有当前 CPU 的锁
+static PERCPU_SLAB *lock_current_slab(PERCPU_CACHE *pc) {
+    int cpu = sched_getcpu();
+    if (cpu < 0) {
+        cpu = 0;
+    }
+
+    PERCPU_SLAB *slab = &pc->slabs[(uint32_t)cpu % pc->cpu_count];
+    slab->lock.lock();
+    return slab;
+}
+
+static percpu_result_t slab_pop(PERCPU_CACHE *pc, uint32_t bin, uint32_t &value) {
+#ifdef PERCPU_CACHE_RSEQ
+    if (pc->use_rseq) {
+        struct rseq *rs = get_rseq();
+        for (;;) {
+            int cpu = get_rseq_cpu(rs);
+            if (cpu < 0 || (uint32_t)cpu >= pc->cpu_count) {
+                return PERCPU_UNAVAILABLE;
+            }
+
+            PERCPU_SLAB *slab = &pc->slabs[cpu];
+            bool empty = false;
+            if (rseq_pop(rs, cpu, &slab->tops[bin], slab->items[bin], &value, empty)) {
+                return empty ? PERCPU_EMPTY_OR_FULL : PERCPU_DONE;
+            }
+            percpu_stats_.aborts += 1;
+        }
+    }
+#endif
+
+    PERCPU_SLAB *slab = lock_current_slab(pc);
+    percpu_result_t result = PERCPU_EMPTY_OR_FULL;
+    if (slab->tops[bin] != 0) {
+        slab->tops[bin] -= 1;
+        value = slab->items[bin][slab->tops[bin]];
+        result = PERCPU_DONE;
+    }
+    slab->lock.unlock();
+    return result;
+}
+
+static percpu_result_t slab_push(PERCPU_CACHE *pc, uint32_t bin, uint32_t value) {
+#ifdef PERCPU_CACHE_RSEQ
+    if (pc->use_rseq) {
+        struct rseq *rs = get_rseq();
+        for (;;) {
+            int cpu = get_rseq_cpu(rs);
+            if (cpu < 0 || (uint32_t)cpu >= pc->cpu_count) {
+                return PERCPU_UNAVAILABLE;
+            }
+
+            PERCPU_SLAB *slab = &pc->slabs[cpu];
+            bool full = false;
+            if (rseq_push(rs, cpu, &slab->tops[bin], slab->items[bin], value, full)) {
+                return full ? PERCPU_EMPTY_OR_FULL : PERCPU_DONE;
+            }
+            percpu_stats_.aborts += 1;
+        }
+    }
+#endif
+
+    PERCPU_SLAB *slab = lock_current_slab(pc);
+    percpu_result_t result = PERCPU_EMPTY_OR_FULL;
+    if (slab->tops[bin] < PERCPU_BIN_CAPACITY) {
+        slab->items[bin][slab->tops[bin]] = value;
+        slab->tops[bin] += 1;
+        result = PERCPU_DONE;
+    }
+    slab->lock.unlock();
+    return result;
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_enable_percpu_cache(bool use_rseq) {
+    return heap_enable_percpu_cache(cur_heap, use_rseq);
+}
+
+bool heap_enable_percpu_cache(heap_t *h, bool use_rseq) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0 || h->locks == nullptr) {
+        // not initialized, or not thread-safe
+        return false;
+    }
+
+    if (h->percpu_cache == nullptr) {
+        int cpus = get_nprocs_conf();
+        h->percpu_cache.reset(new PERCPU_CACHE(cpus > 0 ? (uint32_t)cpus : 1, use_rseq && rseq_available()));
+    }
+    return true;
+}
+
+void percpu_cache_flush(heap_t *h) {
+    assert(h != nullptr);
+
+    PERCPU_CACHE *pc = h->percpu_cache.get();
+    if (pc == nullptr) {
+        return;
+    }
+
+    HEAP_GUARD guard(h);
+    for (uint32_t cpu = 0; cpu < pc->cpu_count; ++cpu) {
+        PERCPU_SLAB &slab = pc->slabs[cpu];
+        // 加锁的方式下持有 CPU 的锁，其他线程可以同时使用缓存；push/pop 持有 CPU 的锁时不会访问 heap
+        if (!pc->use_rseq) {
+            slab.lock.lock();
+        }
+        for (uint32_t bin = 0; bin < TCACHE_BIN_NUM; ++bin) {
+            while (slab.tops[bin] != 0) {
+                slab.tops[bin] -= 1;
+                mem_free_uncached(decompress_payload_ptr(slab.items[bin][slab.tops[bin]]));
+            }
+        }
+        if (!pc->use_rseq) {
+            slab.lock.unlock();
+        }
+    }
+}
+
+const percpu_stats_t *percpu_stats() {
+    return &percpu_stats_;
+}
+
+uint64_t percpu_alloc(uint32_t payload_size) {
+    PERCPU_CACHE *pc = cur_heap->percpu_cache.get();
+    assert(pc != nullptr);
+
+    uint32_t bin = tcache_get_bin(payload_size);
+    uint32_t value = 0;
+    percpu_result_t result = slab_pop(pc, bin, value);
+    if (result == PERCPU_DONE) {
+        percpu_stats_.hits += 1;
+        return decompress_payload_ptr(value);
+    }
+
+    uint64_t payload_vaddr = mem_alloc_uncached(payload_size);
+    if (payload_vaddr == NIL || result == PERCPU_UNAVAILABLE) {
+        return payload_vaddr;
+    }
+
+    // 一次从 heap 中分配 PERCPU_BATCH 块，返回第一块，其余放入当前 CPU 的 bin
+    percpu_stats_.misses += 1;
+    uint32_t batch_payload_size = tcache_get_bin_payload_size(bin);
+    for (uint32_t i = 1; i < PERCPU_BATCH; ++i) {
+        uint64_t p = mem_alloc_uncached(batch_payload_size);
+        if (p == NIL) {
+            break;
+        }
+
+        if (slab_push(pc, bin, compress_ptr(p)) != PERCPU_DONE) {
+            // 其他线程已经填满了这个 CPU 的 bin
+            mem_free_uncached(p);
+            break;
+        }
+    }
+    return payload_vaddr;
+}
+
+bool percpu_free(uint64_t payload_vaddr) {
+    PERCPU_CACHE *pc = cur_heap->percpu_cache.get();
+    assert(pc != nullptr);
+
+    uint32_t bin = tcache_get_block_bin(payload_vaddr);
+    if (bin == TCACHE_BIN_NUM) {
+        return false;
+    }
+
+    return slab_push(pc, bin, compress_ptr(payload_vaddr)) == PERCPU_DONE;
+}
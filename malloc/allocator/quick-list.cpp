@@ -0,0 +1,155 @@
+#include <cassert>
+
+#include "allocator.h"
+#include "heap-lock.h"
+#include "quick-list.h"
+
+/* ------------------------------------- */
+/*  Quick Lists                          */
+/* ------------------------------------- */
+
+// quick list i 中块的大小为 QUICK_LIST_MIN_BLOCKSIZE + i * 8
+static uint32_t get_list(uint32_t block_size) {
+    assert(block_size % 8 == 0 && QUICK_LIST_MIN_BLOCKSIZE <= block_size && block_size <= QUICK_LIST_MAX_BLOCKSIZE);
+    return (block_size - QUICK_LIST_MIN_BLOCKSIZE) / 8;
+}
+
+static uint64_t get_next(uint64_t payload_vaddr) {
+    return decompress_payload_ptr(*reinterpret_cast<uint32_t *>(&heap[payload_vaddr]));
+}
+
+static void set_next(uint64_t payload_vaddr, uint64_t next) {
+    *reinterpret_cast<uint32_t *>(&heap[payload_vaddr]) = compress_ptr(next);
+}
+
+// 多线程模式下 quick list 的锁，单线程的 heap 返回 nullptr
+static std::mutex *get_lock(QUICK_FREE_LISTS *q) {
+    return cur_heap->locks != nullptr ? &q->lock : nullptr;
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_enable_quick_lists() {
+    return heap_enable_quick_lists(cur_heap);
+}
+
+bool heap_enable_quick_lists(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->quick_lists == nullptr) {
+        h->quick_lists.reset(new QUICK_FREE_LISTS());
+    }
+    return true;
+}
+
+quick_list_stats_t heap_quick_list_stats(heap_t *h) {
+    assert(h != nullptr && h->quick_lists != nullptr);
+
+    HEAP_GUARD guard(h);
+    HEAP_INDEX_GUARD quick_guard(get_lock(h->quick_lists.get()));
+    return h->quick_lists->stats;
+}
+
+bool quick_list_is_suitable(uint32_t payload_size) {
+    return 4 < payload_size && get_alloc_block_size(payload_size) <= QUICK_LIST_MAX_BLOCKSIZE;
+}
+
+uint64_t quick_list_pop(uint32_t payload_size) {
+    QUICK_FREE_LISTS *q = cur_heap->quick_lists.get();
+    assert(q != nullptr && quick_list_is_suitable(payload_size));
+
+    uint32_t i = get_list(get_alloc_block_size(payload_size));
+    if (__atomic_load_n(&q->heads[i], __ATOMIC_RELAXED) == NIL) {
+        // 不加锁地预先判断，空的 quick list 不需要获取锁
+        return NIL;
+    }
+
+    HEAP_INDEX_GUARD guard(get_lock(q));
+    uint64_t p = decompress_payload_ptr(q->heads[i]);
+    if (p == NIL) {
+        return NIL;
+    }
+
+    __atomic_store_n(&q->heads[i], compress_ptr(get_next(p)), __ATOMIC_RELAXED);
+    q->counts[i] -= 1;
+    q->total.fetch_sub(1, std::memory_order_relaxed);
+    q->stats.hits += 1;
+    return p;
+}
+
+bool quick_list_push(uint64_t payload_vaddr, bool &full) {
+    QUICK_FREE_LISTS *q = cur_heap->quick_lists.get();
+    assert(q != nullptr);
+    full = false;
+
+    if (cur_heap->buddy != nullptr && payload_vaddr % 4096 == 0) {
+        // 可能是没有 header 的 buddy block
+        return false;
+    }
+
+    // 块由调用者持有，其大小不会被其他线程修改
+    // 多线程模式下 get_block_size 在 DEBUG_MALLOC 下检查相邻块，可能与其他线程冲突，因此直接读取 header
+    uint32_t header_value = __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[get_header(payload_vaddr)]), __ATOMIC_RELAXED);
+    uint32_t block_size = header_value & 0xFFFFFFF8;
+    if (((header_value >> 2) & 0x1) == 1 || block_size < QUICK_LIST_MIN_BLOCKSIZE || block_size > QUICK_LIST_MAX_BLOCKSIZE) {
+        // B8, or not small
+        return false;
+    }
+    assert((header_value & 0x1) == ALLOCATED);
+
+    uint32_t i = get_list(block_size);
+
+    HEAP_INDEX_GUARD guard(get_lock(q));
+    set_next(payload_vaddr, decompress_payload_ptr(q->heads[i]));
+    __atomic_store_n(&q->heads[i], compress_ptr(payload_vaddr), __ATOMIC_RELAXED);
+    q->counts[i] += 1;
+    q->stats.pushes += 1;
+    full = q->total.fetch_add(1, std::memory_order_relaxed) + 1 >= QUICK_LISTS_MAX_BLOCKS;
+    return true;
+}
+
+uint64_t quick_list_take_all() {
+    QUICK_FREE_LISTS *q = cur_heap->quick_lists.get();
+    if (q == nullptr || quick_list_is_empty()) {
+        return NIL;
+    }
+
+    HEAP_INDEX_GUARD guard(get_lock(q));
+
+    // 将全部 quick list 串联成一条
+    uint64_t all = NIL;
+    for (uint32_t i = 0; i < QUICK_LIST_NUM; ++i) {
+        uint64_t p = decompress_payload_ptr(q->heads[i]);
+        while (p != NIL) {
+            uint64_t next = get_next(p);
+            set_next(p, all);
+            all = p;
+            p = next;
+        }
+
+        __atomic_store_n(&q->heads[i], compress_ptr(NIL), __ATOMIC_RELAXED);
+        q->counts[i] = 0;
+    }
+
+    if (all != NIL) {
+        q->stats.consolidations += 1;
+    }
+    q->total.store(0, std::memory_order_relaxed);
+    return all;
+}
+
+uint64_t quick_list_next(uint64_t payload_vaddr) {
+    return get_next(payload_vaddr);
+}
+
+bool quick_list_is_empty() {
+    QUICK_FREE_LISTS *q = cur_heap->quick_lists.get();
+    return q == nullptr || q->total.load(std::memory_order_relaxed) == 0;
+}
@@ -0,0 +1,307 @@
+#include <cassert>
+
+#include "allocator.h"
+#include "slab.h"
+#include "tcache.h"
+#include "transfer-cache.h"
+
+/* ------------------------------------- */
+/*  Thread-local Cache                   */
+/* ------------------------------------- */
+
+// 零初始化即为空的 tcache(NIL == 0)，因此可以使用 __thread
+typedef struct {
+    heap_t *heap;                           // bin 中的块所属的 heap，nullptr 表示未绑定
+    uint64_t bins[TCACHE_BIN_NUM];          // 各个 bin 的栈顶 payload
+    uint32_t counts[TCACHE_BIN_NUM];
+    uint32_t epoch;                         // 最近一次看到的 heap->tcache_epoch
+    uint64_t active_bins;                   // 当前 epoch 中使用过的 bin
+    tcache_stats_t stats;
+} tcache_t;
+
+static_assert(TCACHE_BIN_NUM <= 64, "active_bins is a 64-bit mask");
+
+static __thread tcache_t tcache;
+
+// bin i 中块的大小为 (i + 1) * 8
+static uint32_t get_bin(uint32_t block_size) {
+    assert(block_size % 8 == 0 && 8 <= block_size && block_size <= TCACHE_MAX_BLOCKSIZE);
+    return block_size / 8 - 1;
+}
+
+// 块由当前线程持有，其大小不会被其他线程修改
+// 多线程模式下 get_block_size 在 DEBUG_MALLOC 下检查相邻块，可能与其他线程冲突，因此直接读取 header
+static uint32_t get_cached_block_size(uint64_t payload_vaddr) {
+    uint32_t value = __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[get_header(payload_vaddr)]), __ATOMIC_RELAXED);
+    if ((value >> 2) & 0x1) {
+        // B8
+        return 8;
+    }
+    return value & 0xFFFFFFF8;
+}
+
+static uint64_t get_next(uint64_t payload_vaddr) {
+    return decompress_payload_ptr(*reinterpret_cast<uint32_t *>(&heap[payload_vaddr]));
+}
+
+static void set_next(uint64_t payload_vaddr, uint64_t next) {
+    *reinterpret_cast<uint32_t *>(&heap[payload_vaddr]) = compress_ptr(next);
+}
+
+static void bin_push(uint32_t bin, uint64_t payload_vaddr) {
+    set_next(payload_vaddr, tcache.bins[bin]);
+    tcache.bins[bin] = payload_vaddr;
+    tcache.counts[bin] += 1;
+}
+
+static uint64_t bin_pop(uint32_t bin) {
+    uint64_t p = tcache.bins[bin];
+    assert(p != NIL);
+
+    tcache.bins[bin] = get_next(p);
+    tcache.counts[bin] -= 1;
+    return p;
+}
+
+// 将链表 p 中的块全部归还给 cur_heap
+static void flush_list(uint64_t p) {
+    while (p != NIL) {
+        uint64_t next = get_next(p);
+        mem_free_uncached(p);
+        tcache.stats.flushes += 1;
+        p = next;
+    }
+}
+
+// bin 满时保留最近放入的块，将较早放入的 TCACHE_BATCH 块整体放入 transfer cache，transfer cache 已满时归还给 heap
+static void bin_flush_batch(uint32_t bin) {
+    assert(tcache.counts[bin] == TCACHE_BIN_CAPACITY);
+
+    uint64_t last_kept = tcache.bins[bin];
+    for (uint32_t i = 1; i < TCACHE_BIN_CAPACITY - TCACHE_BATCH; ++i) {
+        last_kept = get_next(last_kept);
+    }
+
+    uint64_t tail = get_next(last_kept);
+    set_next(last_kept, NIL);
+    tcache.counts[bin] -= TCACHE_BATCH;
+
+    if (bin == 0) {
+        // 8-Byte block 放不下 prev
+        flush_list(tail);
+        return;
+    }
+
+    TRANSFER_BATCH batch;
+    while (tail != NIL) {
+        uint64_t next = get_next(tail);
+        batch.insert_node(tail);
+        tail = next;
+    }
+
+    if (transfer_cache_insert(bin, batch)) {
+        tcache.stats.batch_inserts += 1;
+    } else {
+        flush_list(batch.detach());
+    }
+}
+
+// 从 transfer cache 整体取出一批作为 bin
+static bool bin_refill_batch(uint32_t bin) {
+    assert(tcache.bins[bin] == NIL);
+
+    TRANSFER_BATCH batch;
+    if (bin == 0 || !transfer_cache_remove(bin, batch)) {
+        return false;
+    }
+
+    tcache.stats.batch_removes += 1;
+    tcache.counts[bin] = (uint32_t)batch.count();
+    tcache.bins[bin] = batch.detach();
+    return true;
+}
+
+static void flush_all() {
+    if (tcache.heap == nullptr) {
+        return;
+    }
+
+    HEAP_GUARD guard(tcache.heap);
+    for (uint32_t i = 0; i < TCACHE_BIN_NUM; ++i) {
+        uint64_t p = tcache.bins[i];
+        tcache.bins[i] = NIL;
+        tcache.counts[i] = 0;
+        flush_list(p);
+    }
+}
+
+// 线程退出时归还全部的块
+struct TCACHE_RELEASER {
+    ~TCACHE_RELEASER() {
+        flush_all();
+        tcache.heap = nullptr;
+    }
+};
+
+static thread_local TCACHE_RELEASER tcache_releaser;
+
+// 绑定到 cur_heap，原来的块归还给其所属的 heap
+static void bind_cur_heap() {
+    if (tcache.heap == cur_heap) {
+        return;
+    }
+
+    // 注册线程退出时的 TCACHE_RELEASER
+    (void)&tcache_releaser;
+
+    flush_all();
+    tcache.heap = cur_heap;
+    tcache.epoch = __atomic_load_n(&cur_heap->tcache_epoch, __ATOMIC_RELAXED);
+    tcache.active_bins = 0;
+}
+
+// 记录 bin 的使用；epoch 改变时归还上一个 epoch 中没有使用过的 bin
+static void touch_bin(uint32_t bin) {
+    uint32_t epoch = __atomic_load_n(&cur_heap->tcache_epoch, __ATOMIC_RELAXED);
+    if (epoch != tcache.epoch) {
+        for (uint32_t i = 0; i < TCACHE_BIN_NUM; ++i) {
+            if (((tcache.active_bins >> i) & 0x1) == 0 && tcache.bins[i] != NIL) {
+                uint64_t p = tcache.bins[i];
+                tcache.bins[i] = NIL;
+                tcache.counts[i] = 0;
+                flush_list(p);
+            }
+        }
+        tcache.epoch = epoch;
+        tcache.active_bins = 0;
+    }
+    tcache.active_bins |= (uint64_t)1 << bin;
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_enable_tcache() {
+    return heap_enable_tcache(cur_heap);
+}
+
+bool heap_enable_tcache(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->transfer_cache == nullptr) {
+        HEAP_GUARD guard(h);
+        transfer_cache_init();
+    }
+
+    h->tcache_enabled = true;
+    return true;
+}
+
+void tcache_flush() {
+    flush_all();
+}
+
+const tcache_stats_t *tcache_stats() {
+    return &tcache.stats;
+}
+
+bool tcache_is_suitable(uint32_t payload_size) {
+    return 0 < payload_size && get_alloc_block_size(payload_size) <= TCACHE_MAX_BLOCKSIZE;
+}
+
+uint32_t tcache_get_bin(uint32_t payload_size) {
+    assert(tcache_is_suitable(payload_size));
+    return get_bin(get_alloc_block_size(payload_size));
+}
+
+uint32_t tcache_get_bin_payload_size(uint32_t bin) {
+    assert(bin < TCACHE_BIN_NUM);
+    return (bin + 1) * 8 - 4;
+}
+
+uint32_t tcache_get_block_bin(uint64_t payload_vaddr) {
+    assert(payload_vaddr != NIL);
+
+    if (cur_heap->buddy != nullptr && payload_vaddr % 4096 == 0) {
+        // 可能是没有 header 的 buddy block
+        return TCACHE_BIN_NUM;
+    }
+    if (slab_owns(payload_vaddr)) {
+        // 没有 header 的 slab object，直接由 slab allocator 释放
+        return TCACHE_BIN_NUM;
+    }
+
+    uint32_t block_size = get_cached_block_size(payload_vaddr);
+    if (block_size > TCACHE_MAX_BLOCKSIZE) {
+        return TCACHE_BIN_NUM;
+    }
+    return get_bin(block_size);
+}
+
+uint64_t tcache_alloc(uint32_t payload_size) {
+    assert(tcache_is_suitable(payload_size));
+    bind_cur_heap();
+
+    uint32_t bin = tcache_get_bin(payload_size);
+    touch_bin(bin);
+    if (tcache.bins[bin] != NIL) {
+        tcache.stats.hits += 1;
+        return bin_pop(bin);
+    }
+
+    tcache.stats.misses += 1;
+    if (bin_refill_batch(bin)) {
+        return bin_pop(bin);
+    }
+
+    // 一次从 heap 中分配 TCACHE_BATCH 块，返回第一块
+    uint64_t payload_vaddr = mem_alloc_uncached(payload_size);
+    if (payload_vaddr == NIL) {
+        return NIL;
+    }
+
+    uint32_t batch_payload_size = tcache_get_bin_payload_size(bin);
+    for (uint32_t i = 1; i < TCACHE_BATCH; ++i) {
+        uint64_t p = mem_alloc_uncached(batch_payload_size);
+        if (p == NIL) {
+            break;
+        }
+        bin_push(bin, p);
+    }
+    return payload_vaddr;
+}
+
+bool tcache_free(uint64_t payload_vaddr) {
+    uint32_t bin = tcache_get_block_bin(payload_vaddr);
+    if (bin == TCACHE_BIN_NUM) {
+        return false;
+    }
+
+    bind_cur_heap();
+    touch_bin(bin);
+
+    if (tcache.counts[bin] == TCACHE_BIN_CAPACITY) {
+        bin_flush_batch(bin);
+    }
+    bin_push(bin, payload_vaddr);
+    return true;
+}
+
+void tcache_discard(heap_t *h) {
+    if (tcache.heap != h) {
+        return;
+    }
+
+    // h 即将被销毁，其中的块不需要归还
+    for (uint32_t i = 0; i < TCACHE_BIN_NUM; ++i) {
+        tcache.bins[i] = NIL;
+        tcache.counts[i] = 0;
+    }
+    tcache.heap = nullptr;
+}
@@ -0,0 +1,84 @@
+#include <cassert>
+
+#include "allocator.h"
+#include "heap-lock.h"
+#include "transfer-cache.h"
+
+/* ------------------------------------- */
+/*  Transfer Cache                       */
+/* ------------------------------------- */
+
+// 单线程模式下不需要加锁
+static std::mutex *get_bin_lock(TRANSFER_CACHE *tc, uint32_t bin) {
+    return cur_heap->locks != nullptr ? &tc->locks[bin] : nullptr;
+}
+
+void transfer_cache_init() {
+    cur_heap->transfer_cache.reset(new TRANSFER_CACHE());
+}
+
+bool transfer_cache_insert(uint32_t bin, TRANSFER_BATCH &batch) {
+    TRANSFER_CACHE *tc = cur_heap->transfer_cache.get();
+    assert(tc != nullptr);
+    assert(0 < bin && bin < TCACHE_BIN_NUM);
+    assert(batch.count() != 0);
+
+    HEAP_INDEX_GUARD guard(get_bin_lock(tc, bin));
+    if (tc->used[bin] == TRANSFER_CACHE_SLOTS) {
+        return false;
+    }
+
+    TRANSFER_BATCH &slot = tc->slots[bin][tc->used[bin]];
+    assert(slot.count() == 0);
+    slot.splice(batch);
+    tc->used[bin] += 1;
+    return true;
+}
+
+bool transfer_cache_remove(uint32_t bin, TRANSFER_BATCH &batch) {
+    TRANSFER_CACHE *tc = cur_heap->transfer_cache.get();
+    assert(tc != nullptr);
+    assert(0 < bin && bin < TCACHE_BIN_NUM);
+    assert(batch.count() == 0);
+
+    HEAP_INDEX_GUARD guard(get_bin_lock(tc, bin));
+    if (tc->used[bin] == 0) {
+        return false;
+    }
+
+    tc->used[bin] -= 1;
+    batch.splice(tc->slots[bin][tc->used[bin]]);
+    return true;
+}
+
+void transfer_cache_flush() {
+    TRANSFER_CACHE *tc = cur_heap->transfer_cache.get();
+    if (tc == nullptr) {
+        return;
+    }
+
+    for (uint32_t bin = 1; bin < TCACHE_BIN_NUM; ++bin) {
+        // 在锁内将所有批次接成一个链表，释放时不持有锁
+        TRANSFER_BATCH all;
+        {
+            HEAP_INDEX_GUARD guard(get_bin_lock(tc, bin));
+            for (uint32_t i = 0; i < tc->used[bin]; ++i) {
+                all.splice(tc->slots[bin][i]);
+            }
+            tc->used[bin] = 0;
+        }
+
+        // 释放之前先断开环，释放之后块的 payload 可能被合并覆盖
+        uint64_t p = all.detach();
+        while (p != NIL) {
+            uint64_t next = decompress_payload_ptr(*reinterpret_cast<uint32_t *>(&heap[p]));
+            mem_free_uncached(p);
+            p = next;
+        }
+    }
+}
+
+void transfer_cache_flush(heap_t *h) {
+    HEAP_GUARD guard(h);
+    transfer_cache_flush();
+}
@@ -0,0 +1,174 @@
+#include <cassert>
+#include <mutex>
+
+#include "allocator.h"
+#include "arena.h"
+#include "heap-lock.h"
+
+/* ------------------------------------- */
+/*  Arenas                               */
+/* ------------------------------------- */
+
+// 最后一个位置留给共享的 arena
+// arena 在进程结束之前不会被销毁，已经初始化的 arena_storage[0, arena_num) 只会增加，因此 arena_find 不需要加锁
+static ARENA arena_storage[ARENA_MAX_NUM + 1];
+static std::atomic<int> arena_num{0};
+static std::mutex arena_create_mutex;
+static ARENA *shared_arena = nullptr;
+
+// 当前线程的 arena
+static __thread ARENA *self_arena = nullptr;
+
+// 将 remote free 队列中的块全部释放到 a 中，只能由 a 的所属线程调用
+static void arena_drain(ARENA *a) {
+    uint64_t p = a->remote_free_head.exchange(NIL, std::memory_order_acquire);
+    while (p != NIL) {
+        uint64_t next = decompress_payload_ptr(*reinterpret_cast<uint32_t *>(&heap[p]));
+        mem_free(&a->heap, p);
+        a->remote_drain_count += 1;
+        p = next;
+    }
+}
+
+// 压入 a 的 remote free 队列，可以由任意线程调用
+static void arena_remote_push(ARENA *a, uint64_t payload_vaddr) {
+    uint64_t head = a->remote_free_head.load(std::memory_order_relaxed);
+    do {
+        *reinterpret_cast<uint32_t *>(&heap[payload_vaddr]) = compress_ptr(head);
+    } while (!a->remote_free_head.compare_exchange_weak(head, payload_vaddr,
+                                                        std::memory_order_release, std::memory_order_relaxed));
+    a->remote_free_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 线程退出时放弃其 arena，剩余的 remote free 由接管的线程释放
+struct ARENA_RELEASER {
+    ~ARENA_RELEASER() {
+        ARENA *a = self_arena;
+        if (a == nullptr || a->shared) {
+            return;
+        }
+
+        arena_drain(a);
+        self_arena = nullptr;
+        a->owned.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local ARENA_RELEASER arena_releaser;
+
+// 调用者持有 arena_create_mutex
+static ARENA *arena_create(bool shared) {
+    int n = arena_num.load(std::memory_order_relaxed);
+    if (n >= ARENA_MAX_NUM + (shared ? 1 : 0)) {
+        return nullptr;
+    }
+
+    ARENA *a = &arena_storage[n];
+    if (!heap_init(&a->heap, ARENA_DEFAULT_SIZE, HEAP_DEFAULT_STRATEGY)) {
+        return nullptr;
+    }
+
+    if (shared && !heap_enable_thread_safe(&a->heap)) {
+        heap_destroy(&a->heap);
+        return nullptr;
+    }
+
+    a->shared = shared;
+    a->owned.store(true, std::memory_order_relaxed);
+
+    // heap 的地址区间初始化之后才能被 arena_find 看到
+    arena_num.store(n + 1, std::memory_order_release);
+    return a;
+}
+
+static ARENA *arena_acquire() {
+    // 注册线程退出时的 ARENA_RELEASER
+    (void)&arena_releaser;
+
+    // 优先接管被放弃的 arena
+    int n = arena_num.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        ARENA *a = &arena_storage[i];
+        bool expected = false;
+        if (!a->shared && a->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return a;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(arena_create_mutex);
+
+    ARENA *a = arena_create(false);
+    if (a != nullptr) {
+        return a;
+    }
+
+    // arena 的个数达到上限，之后的线程共享同一个 arena
+    if (shared_arena == nullptr) {
+        shared_arena = arena_create(true);
+    }
+    return shared_arena;
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+uint64_t arena_alloc(uint32_t size) {
+    ARENA *a = self_arena;
+    if (a == nullptr) {
+        a = arena_acquire();
+        if (a == nullptr) {
+            return NIL;
+        }
+        self_arena = a;
+    }
+
+    if (!a->shared && a->remote_free_head.load(std::memory_order_relaxed) != NIL) {
+        arena_drain(a);
+    }
+
+    return mem_alloc(&a->heap, size);
+}
+
+void arena_free(uint64_t payload_vaddr) {
+    if (payload_vaddr == NIL) {
+        return;
+    }
+
+    ARENA *a = arena_find(payload_vaddr);
+    assert(a != nullptr);
+
+    if (a == self_arena || a->shared) {
+        mem_free(&a->heap, payload_vaddr);
+    } else {
+        arena_remote_push(a, payload_vaddr);
+    }
+}
+
+ARENA *arena_find(uint64_t vaddr) {
+    int n = arena_num.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        heap_t *h = &arena_storage[i].heap;
+        if (h->start_vaddr <= vaddr && vaddr < h->start_vaddr + h->max_size) {
+            return &arena_storage[i];
+        }
+    }
+    return nullptr;
+}
+
+ARENA *arena_self() {
+    return self_arena;
+}
+
+int arena_count() {
+    return arena_num.load(std::memory_order_acquire);
+}
+
+arena_stats_t arena_stats(const ARENA *a) {
+    assert(a != nullptr);
+
+    arena_stats_t stats;
+    stats.remote_free_count = a->remote_free_count.load(std::memory_order_relaxed);
+    stats.remote_drain_count = a->remote_drain_count;
+    return stats;
+}
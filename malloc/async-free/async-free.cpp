@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "allocator.h"
+#include "async-free.h"
+#include "huge.h"
+#include "tcache.h"
+
+/* ------------------------------------- */
+/*  Per-thread Rings                     */
+/* ------------------------------------- */
+
+static std::atomic<uint64_t> next_freer_id{1};
+
+// 当前线程最近使用的缓冲区，线程退出时交还
+struct ASYNC_FREE_PRODUCER {
+    uint64_t freer_id = 0;
+    std::shared_ptr<ASYNC_FREE_RING> ring;
+
+    void release() {
+        if (ring != nullptr) {
+            ring->owned.store(false, std::memory_order_release);
+            ring.reset();
+        }
+        freer_id = 0;
+    }
+
+    ~ASYNC_FREE_PRODUCER() {
+        release();
+    }
+};
+
+static thread_local ASYNC_FREE_PRODUCER producer;
+
+// C++11 的 new 不保证 64 字节对齐，因此以 posix_memalign 分配
+static std::shared_ptr<ASYNC_FREE_RING> new_ring() {
+    void *p = nullptr;
+    if (posix_memalign(&p, alignof(ASYNC_FREE_RING), sizeof(ASYNC_FREE_RING)) != 0) {
+        throw std::bad_alloc();
+    }
+
+    return std::shared_ptr<ASYNC_FREE_RING>(new (p) ASYNC_FREE_RING(), [](ASYNC_FREE_RING *r) {
+        r->~ASYNC_FREE_RING();
+        free(r);
+    });
+}
+
+static ASYNC_FREE_RING *get_ring(ASYNC_FREER *f) {
+    if (producer.freer_id == f->id) {
+        return producer.ring.get();
+    }
+
+    // 切换到另一个 heap，原来的缓冲区交给其他线程复用
+    producer.release();
+
+    std::lock_guard<std::mutex> lock(f->rings_mutex);
+    for (const std::shared_ptr<ASYNC_FREE_RING> &r : f->rings) {
+        bool owned = false;
+        if (r->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+            producer.ring = r;
+            producer.freer_id = f->id;
+            return r.get();
+        }
+    }
+
+    f->rings.push_back(new_ring());
+    producer.ring = f->rings.back();
+    producer.freer_id = f->id;
+    return producer.ring.get();
+}
+
+// 只有所属线程 push，返回 false 表示缓冲区已满
+static bool ring_push(ASYNC_FREER *f, ASYNC_FREE_RING *r, uint64_t payload_vaddr) {
+    uint32_t tail = r->tail.load(std::memory_order_relaxed);
+    uint32_t head = r->head.load(std::memory_order_acquire);
+    if (tail - head == ASYNC_FREE_RING_CAPACITY) {
+        return false;
+    }
+
+    r->items[tail % ASYNC_FREE_RING_CAPACITY] = compress_ptr(payload_vaddr);
+    r->tail.store(tail + 1, std::memory_order_release);
+
+    if (tail + 1 - head == ASYNC_FREE_RING_CAPACITY / 2) {
+        // 后台线程也会定期检查，因此不需要持有 mutex，错过的唤醒只是推迟到下一个 interval
+        f->cv.notify_one();
+    }
+    return true;
+}
+
+/* ------------------------------------- */
+/*  Draining                             */
+/* ------------------------------------- */
+
+// 只有持有 drain_mutex 的线程 pop
+static void ring_pop_all(ASYNC_FREE_RING *r, std::vector<uint64_t> &batch) {
+    uint32_t head = r->head.load(std::memory_order_relaxed);
+    uint32_t tail = r->tail.load(std::memory_order_acquire);
+    for (uint32_t i = head; i != tail; ++i) {
+        batch.push_back(decompress_payload_ptr(r->items[i % ASYNC_FREE_RING_CAPACITY]));
+    }
+    // 读取 items 之后才将空间交还给生产者
+    r->head.store(tail, std::memory_order_release);
+}
+
+static void drain(ASYNC_FREER *f) {
+    std::lock_guard<std::mutex> drain_guard(f->drain_mutex);
+
+    std::vector<std::shared_ptr<ASYNC_FREE_RING>> rings;
+    {
+        std::lock_guard<std::mutex> lock(f->rings_mutex);
+        rings = f->rings;
+    }
+
+    f->batch.clear();
+    for (const std::shared_ptr<ASYNC_FREE_RING> &r : rings) {
+        ring_pop_all(r.get(), f->batch);
+    }
+    if (f->batch.empty()) {
+        return;
+    }
+
+    // 按地址释放，相邻的块依次合并，访问的 header/footer 与 stripe 也更集中
+    std::sort(f->batch.begin(), f->batch.end());
+
+    // 后台线程的 tcache 不会再分配，其中的块既不合并也无法被 scavenger 归还，因此直接释放到 heap
+    HEAP_GUARD guard(f->heap);
+    for (uint64_t p : f->batch) {
+        if (!huge_free(p)) {
+            mem_free_uncached(p);
+        }
+    }
+    f->freed += f->batch.size();
+    f->batches += 1;
+}
+
+static void async_free_loop(ASYNC_FREER *f) {
+    std::unique_lock<std::mutex> lock(f->mutex);
+    while (!f->stopping) {
+        f->cv.wait_for(lock, std::chrono::milliseconds(f->interval_ms));
+        if (f->stopping) {
+            break;
+        }
+
+        lock.unlock();
+        drain(f);
+        lock.lock();
+    }
+}
+
+ASYNC_FREER::~ASYNC_FREER() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    // 后台线程结束之后放入的块
+    drain(this);
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_start_async_free(heap_t *h, uint32_t interval_ms) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0 || h->locks == nullptr) {
+        // not initialized, or not thread-safe
+        return false;
+    }
+
+    if (h->async_free != nullptr) {
+        return true;
+    }
+
+    ASYNC_FREER *f = new ASYNC_FREER();
+    f->heap = h;
+    f->interval_ms = interval_ms == 0 ? 1 : interval_ms;
+    f->id = next_freer_id.fetch_add(1);
+
+    h->async_free.reset(f);
+    f->thread = std::thread(async_free_loop, f);
+    return true;
+}
+
+void heap_stop_async_free(heap_t *h) {
+    assert(h != nullptr);
+
+    // ~ASYNC_FREER 释放剩余的块并等待后台线程结束
+    h->async_free.reset();
+}
+
+void mem_free_async(uint64_t payload_vaddr) {
+    if (payload_vaddr == NIL) {
+        return;
+    }
+
+    ASYNC_FREER *f = cur_heap->async_free.get();
+    if (f == nullptr) {
+        mem_free(payload_vaddr);
+        return;
+    }
+
+    if (!ring_push(f, get_ring(f), payload_vaddr)) {
+        f->overflows.fetch_add(1, std::memory_order_relaxed);
+        mem_free(payload_vaddr);
+    }
+}
+
+void mem_free_async(heap_t *h, uint64_t payload_vaddr) {
+    HEAP_GUARD guard(h);
+    mem_free_async(payload_vaddr);
+}
+
+void async_free_drain(heap_t *h) {
+    assert(h != nullptr && h->async_free != nullptr);
+    drain(h->async_free.get());
+}
+
+async_free_stats_t async_free_stats(heap_t *h) {
+    assert(h != nullptr && h->async_free != nullptr);
+
+    ASYNC_FREER *f = h->async_free.get();
+    std::lock_guard<std::mutex> drain_guard(f->drain_mutex);
+
+    async_free_stats_t stats;
+    stats.freed = f->freed;
+    stats.batches = f->batches;
+    stats.overflows = f->overflows.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,310 @@
+#include <cassert>
+#include <memory>
+
+#include "allocator.h"
+#include "buddy.h"
+#include "heap-lock.h"
+
+/* ------------------------------------- */
+/*  Buddy System                         */
+/* ------------------------------------- */
+
+/*  chunk (a regular allocated block):
+    hh hh hh hh     [header]
+    ?? ?? ?? ??     [payload, ..., base) - unused, < 4096 Byte
+    .. .. .. ..     [base, base + 2^20) - buddy blocks
+    ?? ?? ?? ??     [base + 2^20, footer) - unused
+    ff ff ff ff     [footer]
+
+    free buddy block (order k, 2^k pages):
+    nn nn nn nn     [vaddr + 4] - next free block of order k
+    pp pp pp pp     [vaddr + 0] - previous free block of order k, vaddr % 4096 == 0
+
+    e.g. free block at offset 0x3000 (order 0) whose buddy at 0x2000 is free (order 0)
+    ==> merge as offset 0x2000 (order 1), whose buddy is 0x2000 ^ 0x2000 = 0x0000
+*/
+
+static BUDDY_ALLOCATOR *get_buddy() {
+    assert(cur_heap->buddy != nullptr);
+    return cur_heap->buddy.get();
+}
+
+// the chunk that vaddr belongs to, nullptr if not found
+static BUDDY_CHUNK *find_chunk(uint64_t vaddr, uint64_t &base) {
+    BUDDY_ALLOCATOR *b = get_buddy();
+
+    auto it = b->chunks.upper_bound(vaddr);
+    if (it == b->chunks.begin()) {
+        return nullptr;
+    }
+    --it;
+
+    if (vaddr >= it->first + BUDDY_MAX_BLOCKSIZE) {
+        return nullptr;
+    }
+
+    base = it->first;
+    return &it->second;
+}
+
+// the smallest order k such that 2^k pages >= payload_size
+static uint32_t get_order(uint32_t payload_size) {
+    uint32_t pages = (payload_size + (1 << BUDDY_PAGE_SHIFT) - 1) >> BUDDY_PAGE_SHIFT;
+    uint32_t order = 0;
+    while ((1u << order) < pages) {
+        order += 1;
+    }
+    return order;
+}
+
+static void free_list_insert(uint64_t vaddr, uint32_t order) {
+    BUDDY_ALLOCATOR *b = get_buddy();
+    b->free_lists[order].insert_node(vaddr);
+    b->bitmap |= (1u << order);
+}
+
+static void free_list_delete(uint64_t vaddr, uint32_t order) {
+    BUDDY_ALLOCATOR *b = get_buddy();
+    b->free_lists[order].delete_node(vaddr);
+    if (b->free_lists[order].count() == 0) {
+        b->bitmap &= ~(1u << order);
+    }
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_enable_buddy() {
+    return heap_enable_buddy(cur_heap);
+}
+
+bool heap_enable_buddy(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->buddy == nullptr) {
+        h->buddy.reset(new BUDDY_ALLOCATOR());
+    }
+    return true;
+}
+
+const buddy_stats_t *heap_buddy_stats(heap_t *h) {
+    assert(h != nullptr);
+    return h->buddy != nullptr ? &h->buddy->stats : nullptr;
+}
+
+double buddy_internal_fragmentation(const buddy_stats_t *stats) {
+    if (stats == nullptr || stats->allocated_bytes == 0) {
+        return 0.0;
+    }
+    return 1.0 - (double)stats->requested_bytes / (double)stats->allocated_bytes;
+}
+
+bool buddy_is_suitable(uint32_t payload_size) {
+    return cur_heap->buddy != nullptr &&
+           BUDDY_MIN_PAYLOAD <= payload_size && payload_size <= BUDDY_MAX_BLOCKSIZE;
+}
+
+uint64_t buddy_alloc(uint32_t payload_size) {
+    assert(buddy_is_suitable(payload_size));
+    BUDDY_ALLOCATOR *b = get_buddy();
+    HEAP_INDEX_GUARD guard(heap_buddy_lock());
+
+    uint32_t order = get_order(payload_size);
+    uint32_t candidates = b->bitmap & (~0u << order);
+    if (candidates == 0) {
+        return NIL;
+    }
+
+    uint32_t k = __builtin_ctz(candidates);
+    uint64_t vaddr = b->free_lists[k].head();
+    free_list_delete(vaddr, k);
+
+    uint64_t base = NIL;
+    BUDDY_CHUNK *chunk = find_chunk(vaddr, base);
+    assert(chunk != nullptr);
+
+    // split: 高地址的一半作为空闲块，低地址的一半继续分割
+    while (k > order) {
+        k -= 1;
+        uint64_t half = vaddr + ((uint64_t)1 << (k + BUDDY_PAGE_SHIFT));
+        chunk->pages[(half - base) >> BUDDY_PAGE_SHIFT] = (uint8_t)(BUDDY_PAGE_FREE | k);
+        free_list_insert(half, k);
+    }
+
+    uint32_t index = (uint32_t)((vaddr - base) >> BUDDY_PAGE_SHIFT);
+    chunk->pages[index] = (uint8_t)order;
+    chunk->requested[index] = payload_size;
+
+    b->stats.block_count += 1;
+    b->stats.requested_bytes += payload_size;
+    b->stats.allocated_bytes += (uint64_t)1 << (order + BUDDY_PAGE_SHIFT);
+
+    return vaddr;
+}
+
+void buddy_add_chunk(uint64_t chunk_payload_vaddr) {
+    BUDDY_ALLOCATOR *b = get_buddy();
+    HEAP_INDEX_GUARD guard(heap_buddy_lock());
+
+    uint64_t base = round_up(chunk_payload_vaddr, 1 << BUDDY_PAGE_SHIFT);
+    assert(base + BUDDY_MAX_BLOCKSIZE <= chunk_payload_vaddr + BUDDY_CHUNK_PAYLOAD);
+
+    BUDDY_CHUNK &chunk = b->chunks[base];
+    chunk.payload_vaddr = chunk_payload_vaddr;
+    chunk.pages[0] = (uint8_t)(BUDDY_PAGE_FREE | BUDDY_MAX_ORDER);
+    free_list_insert(base, BUDDY_MAX_ORDER);
+
+    b->stats.chunk_count += 1;
+}
+
+uint32_t buddy_get_block_size(uint64_t payload_vaddr) {
+    if (cur_heap->buddy == nullptr || payload_vaddr % (1 << BUDDY_PAGE_SHIFT) != 0) {
+        return 0;
+    }
+
+    HEAP_INDEX_GUARD guard(heap_buddy_lock());
+
+    uint64_t base = NIL;
+    BUDDY_CHUNK *chunk = find_chunk(payload_vaddr, base);
+    if (chunk == nullptr) {
+        return 0;
+    }
+
+    uint32_t order = chunk->pages[(payload_vaddr - base) >> BUDDY_PAGE_SHIFT];
+    assert((order & BUDDY_PAGE_FREE) == 0);
+    return (uint32_t)1 << (order + BUDDY_PAGE_SHIFT);
+}
+
+bool buddy_free(uint64_t payload_vaddr, uint64_t &released_chunk) {
+    released_chunk = NIL;
+    if (cur_heap->buddy == nullptr) {
+        return false;
+    }
+
+    // buddy block 总是按页对齐，其他的 payload 无需获取 buddy system 的锁
+    if (payload_vaddr % (1 << BUDDY_PAGE_SHIFT) != 0) {
+        return false;
+    }
+
+    BUDDY_ALLOCATOR *b = get_buddy();
+    HEAP_INDEX_GUARD guard(heap_buddy_lock());
+
+    uint64_t base = NIL;
+    BUDDY_CHUNK *chunk = find_chunk(payload_vaddr, base);
+    if (chunk == nullptr) {
+        return false;
+    }
+
+    uint64_t offset = payload_vaddr - base;
+    assert(offset % 4096 == 0);
+
+    uint32_t index = (uint32_t)(offset >> BUDDY_PAGE_SHIFT);
+    uint32_t order = chunk->pages[index];
+    // otherwise it's free twice
+    assert((order & BUDDY_PAGE_FREE) == 0);
+
+    b->stats.block_count -= 1;
+    b->stats.requested_bytes -= chunk->requested[index];
+    b->stats.allocated_bytes -= (uint64_t)1 << (order + BUDDY_PAGE_SHIFT);
+    chunk->requested[index] = 0;
+
+    // 与 buddy 合并，直到 buddy 不是同样大小的空闲块
+    while (order < BUDDY_MAX_ORDER) {
+        uint64_t buddy_offset = offset ^ ((uint64_t)1 << (order + BUDDY_PAGE_SHIFT));
+        uint32_t buddy_index = (uint32_t)(buddy_offset >> BUDDY_PAGE_SHIFT);
+        if (chunk->pages[buddy_index] != (BUDDY_PAGE_FREE | order)) {
+            break;
+        }
+
+        free_list_delete(base + buddy_offset, order);
+        chunk->pages[buddy_index] = 0;
+        chunk->pages[offset >> BUDDY_PAGE_SHIFT] = 0;
+
+        offset &= buddy_offset;
+        order += 1;
+    }
+
+    // 整个 chunk 都空闲时归还给 boundary tag allocator，但至少保留一个 chunk，避免反复申请与归还
+    if (order == BUDDY_MAX_ORDER && b->chunks.size() > 1) {
+        released_chunk = chunk->payload_vaddr;
+        b->chunks.erase(base);
+        b->stats.chunk_count -= 1;
+        return true;
+    }
+
+    chunk->pages[offset >> BUDDY_PAGE_SHIFT] = (uint8_t)(BUDDY_PAGE_FREE | order);
+    free_list_insert(base + offset, order);
+    return true;
+}
+
+// 遍历每个 chunk 中的 buddy block，检查空闲链表、bitmap、统计信息以及空闲的 buddy 都已经合并
+void buddy_check() {
+    if (cur_heap->buddy == nullptr) {
+        return;
+    }
+
+    BUDDY_ALLOCATOR *b = get_buddy();
+    HEAP_INDEX_GUARD guard(heap_buddy_lock());
+    uint64_t free_counter[BUDDY_ORDER_NUM] = {0};
+    buddy_stats_t stats = buddy_stats_t();
+
+    for (auto &it : b->chunks) {
+        uint64_t base = it.first;
+        BUDDY_CHUNK &chunk = it.second;
+
+        assert(base % 4096 == 0);
+        assert(chunk.payload_vaddr <= base);
+        assert(base + BUDDY_MAX_BLOCKSIZE <= chunk.payload_vaddr + BUDDY_CHUNK_PAYLOAD);
+        assert(get_allocated(get_header(chunk.payload_vaddr)) == ALLOCATED);
+
+        stats.chunk_count += 1;
+
+        uint32_t index = 0;
+        while (index < BUDDY_CHUNK_PAGES) {
+            uint32_t order = chunk.pages[index] & BUDDY_PAGE_ORDER_MASK;
+            assert(order <= BUDDY_MAX_ORDER);
+            assert(index % (1u << order) == 0);
+
+            if (chunk.pages[index] & BUDDY_PAGE_FREE) {
+                // the buddy of a free block must not be a free block of the same order
+                if (order < BUDDY_MAX_ORDER) {
+                    uint32_t buddy_index = index ^ (1u << order);
+                    assert(chunk.pages[buddy_index] != (BUDDY_PAGE_FREE | order));
+                }
+
+                uint64_t vaddr = base + ((uint64_t)index << BUDDY_PAGE_SHIFT);
+                uint64_t prev = b->free_lists[order].get_prev_node(vaddr);
+                uint64_t next = b->free_lists[order].get_next_node(vaddr);
+                assert(b->free_lists[order].get_next_node(prev) == vaddr);
+                assert(b->free_lists[order].get_prev_node(next) == vaddr);
+
+                free_counter[order] += 1;
+            } else {
+                assert(chunk.requested[index] > 0);
+                assert(chunk.requested[index] <= (1u << (order + BUDDY_PAGE_SHIFT)));
+
+                stats.block_count += 1;
+                stats.requested_bytes += chunk.requested[index];
+                stats.allocated_bytes += (uint64_t)1 << (order + BUDDY_PAGE_SHIFT);
+            }
+
+            index += 1u << order;
+        }
+    }
+
+    for (uint32_t k = 0; k < BUDDY_ORDER_NUM; ++k) {
+        assert(b->free_lists[k].count() == free_counter[k]);
+        assert(((b->bitmap >> k) & 0x1) == (free_counter[k] != 0));
+    }
+
+    assert(b->stats.chunk_count == stats.chunk_count);
+    assert(b->stats.block_count == stats.block_count);
+    assert(b->stats.requested_bytes == stats.requested_bytes);
+    assert(b->stats.allocated_bytes == stats.allocated_bytes);
+}
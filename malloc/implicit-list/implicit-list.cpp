@@ -1,6 +1,7 @@
 #include <cassert>
 
 #include "allocator.h"
+#include "implicit-list.h"
 #include "small-list.h"
 
 /* ------------------------------------- */
@@ -9,9 +10,9 @@
 
 /*  Allocated block:
 
-    ff ff ff f9/f1  [8n + 24] - footer
-    ?? ?? ?? ??     [8n + 20] - padding
-    xx xx ?? ??     [8n + 16] - payload & padding
+    xx xx ?? ??     [8n + 24] - payload & padding, no footer
+    xx xx xx xx     [8n + 20] - payload
+    xx xx xx xx     [8n + 16] - payload
     xx xx xx xx     [8n + 12] - payload
     xx xx xx xx     [8n + 8] - payload
     hh hh hh h9/h1  [8n + 4] - header
@@ -28,6 +29,24 @@
 
 const uint32_t MIN_IMPLICIT_FREE_LIST_BLOCK_SIZE = 8;
 
+uint64_t implicit_list_search(uint32_t free_block_size) {
+    // search the whole heap
+    // 从头开始遍历：首次适应算法
+    uint64_t b = get_first_block();
+    while (b < get_epilogue()) {
+        uint32_t b_block_size = get_block_size(b);
+        uint32_t b_allocated = get_allocated(b);
+
+        if (b_allocated == FREE && b_block_size >= free_block_size) {
+            return b;
+        } else {
+            b = get_next_header(b);
+        }
+    }
+
+    return NIL;
+}
+
 /* ------------------------------------- */
 /*  Implementation                       */
 /* ------------------------------------- */
@@ -41,36 +60,22 @@ bool implicit_list_initialize_free_block() {
 
 uint64_t implicit_list_search_free_block(uint32_t payload_size, uint32_t &alloc_block_size) {
     // search 8-byte block list
-    if (payload_size <= 4 && small_list->count() != 0) {
+    if (payload_size <= 4 && cur_heap->small_list->count() != 0) {
         // a small block and 8-byte is not empty
         alloc_block_size = 8;
-        return small_list->head();
+        return cur_heap->small_list->head();
     }
 
-    // payload size round up + header + footer
-    uint32_t free_block_size = round_up(payload_size, 8) + 4 + 4;
+    // header + payload size round up, allocated block has no footer
+    uint32_t free_block_size = get_alloc_block_size(payload_size);
     alloc_block_size = free_block_size;
 
-    // search the whole heap
-    // 从头开始遍历：首次适应算法
-    uint64_t b = get_first_block();
-    while (b <= get_last_block()) {
-        uint32_t b_block_size = get_block_size(b);
-        uint32_t b_allocated = get_allocated(b);
-
-        if (b_allocated == FREE && b_block_size >= free_block_size) {
-            return b;
-        } else {
-            b = get_next_header(b);
-        }
-    }
-
-    return NIL;
+    return implicit_list_search(free_block_size);
 }
 
 bool implicit_list_insert_free_block(uint64_t free_header) {
     assert(free_header % 8 == 4);
-    assert(get_first_block() <= free_header && free_header <= get_last_block());
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
     assert(get_allocated(free_header) == FREE);
 
     uint32_t block_size = get_block_size(free_header);
@@ -91,7 +96,7 @@ bool implicit_list_insert_free_block(uint64_t free_header) {
 
 bool implicit_list_delete_free_block(uint64_t free_header) {
     assert(free_header % 8 == 4);
-    assert(get_first_block() <= free_header && free_header <= get_last_block());
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
     assert(get_allocated(free_header) == FREE);
 
     uint32_t block_size = get_block_size(free_header);
@@ -113,3 +118,12 @@ bool implicit_list_delete_free_block(uint64_t free_header) {
 void implicit_list_check_free_block() {
     small_list_check_free_blocks();
 }
+
+const free_block_policy_t implicit_list_policy = {
+    "implicit free list",
+    implicit_list_initialize_free_block,
+    implicit_list_search_free_block,
+    implicit_list_insert_free_block,
+    implicit_list_delete_free_block,
+    implicit_list_check_free_block,
+};
@@ -0,0 +1,215 @@
+#include <cassert>
+#include <chrono>
+
+#include "allocator.h"
+#include "heap-lock.h"
+#include "percpu-cache.h"
+#include "scavenger.h"
+#include "transfer-cache.h"
+
+/* ------------------------------------- */
+/*  Scavenging                           */
+/* ------------------------------------- */
+
+// 持有 header 所在的 stripe 时读取，因此不经过 get_block_size 的完整性检查(会读取相邻块)
+static uint32_t get_locked_header(uint64_t header_vaddr) {
+    return *reinterpret_cast<uint32_t *>(&heap[header_vaddr]);
+}
+
+static uint32_t get_locked_block_size(uint64_t header_vaddr) {
+    uint32_t value = get_locked_header(header_vaddr);
+    if ((value >> 2) & 0x1) {
+        // B8
+        return 8;
+    }
+    return value & 0xFFFFFFF8;
+}
+
+// b 的 stripe 已经被持有；依次获取 b + 16(purge 记录) 与 next 的 stripe，已经持有的跳过
+// 返回持有的个数，held 按地址升序，最后一个与 next 位于同一个 stripe
+static int lock_step(uint64_t b, bool candidate, uint64_t next, uint64_t held[3]) {
+    int n = 0;
+    held[n++] = b;
+
+    uint64_t wanted[2] = {candidate ? b + 16 : NIL, next};
+    for (uint64_t vaddr : wanted) {
+        if (vaddr != NIL && !heap_lock_same_stripe(held[n - 1], vaddr)) {
+            heap_lock_stripe(vaddr);
+            held[n++] = vaddr;
+        }
+    }
+    return n;
+}
+
+// 从 cursor 开始 hand-over-hand 地逐块前进，每个块只在持有其 header(与 purge 时需要的)stripe 时读取
+static void purge_idle_blocks(SCAVENGER *s) {
+    uint32_t budget = s->config.purge_budget_pages;
+
+    // 获取 cursor 的 stripe 之前它可能被合并，持有之后 cursor 没有变化才是有效的 header
+    uint64_t b = s->cursor.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t header_vaddr = b != NIL ? b : get_first_block();
+        heap_lock_stripe(header_vaddr);
+        uint64_t cursor = s->cursor.load(std::memory_order_relaxed);
+        if (cursor == b) {
+            b = header_vaddr;
+            break;
+        }
+        heap_unlock_stripe(header_vaddr);
+        b = cursor;
+    }
+
+    for (uint32_t i = 0;; ++i) {
+        uint32_t block_size = get_locked_block_size(b);
+        if (block_size == 0) {
+            // epilogue: 完成一轮遍历
+            s->cursor.store(NIL, std::memory_order_relaxed);
+            heap_unlock_stripe(b);
+            s->idle_blocks.swap(s->round_blocks);
+            s->round_blocks.clear();
+            s->stats.rounds += 1;
+            return;
+        }
+
+        if (i == s->config.scan_blocks) {
+            // 持有 b 的 stripe 时记录，之后 b 被合并时由合并的一方修改
+            s->cursor.store(b, std::memory_order_relaxed);
+            heap_unlock_stripe(b);
+            return;
+        }
+
+        s->stats.scanned_blocks += 1;
+        uint64_t next = b + block_size;
+        bool candidate = (get_locked_header(b) & 0x1) == FREE &&
+                         block_size >= s->config.purge_min_size && block_size >= MIN_REDBLACK_TREE_BLOCKSIZE;
+
+        uint64_t held[3];
+        int n = lock_step(b, candidate, next, held);
+
+        if (candidate) {
+            // 与上一轮遍历时的大小相同，说明这段时间内没有被分配、分割或者合并
+            uint32_t passes = 1;
+            auto it = s->idle_blocks.find(b);
+            if (it != s->idle_blocks.end() && it->second.first == block_size) {
+                passes = it->second.second + 1;
+            }
+            s->round_blocks[b] = std::make_pair(block_size, passes);
+
+            // 末尾的空闲块由 trim 负责归还
+            bool is_last = get_locked_block_size(next) == 0;
+            if (passes >= s->config.purge_idle_passes && !is_last && budget > 0 && !is_block_purged(b)) {
+                uint64_t purged_pages = cur_heap->stats.purged_pages;
+                purge_free_block(b);
+                uint64_t pages = cur_heap->stats.purged_pages - purged_pages;
+                if (pages != 0) {
+                    s->stats.purged_blocks += 1;
+                    s->stats.purged_pages += pages;
+                    budget = pages >= budget ? 0 : budget - (uint32_t)pages;
+                }
+            }
+        }
+
+        // 只保留 next 所在的 stripe
+        for (int j = 0; j < n - 1; ++j) {
+            heap_unlock_stripe(held[j]);
+        }
+        b = next;
+    }
+}
+
+static void scavenge(SCAVENGER *s) {
+    std::lock_guard<std::mutex> pass_guard(s->pass_mutex);
+    HEAP_GUARD guard(s->heap);
+
+    // 共享缓存中的块在 heap 看来是已分配的，释放之后才能与相邻的空闲块合并
+    // 各线程的 tcache 只能由其所属线程访问，改变 epoch 通知它们归还空闲的 bin
+    __atomic_fetch_add(&cur_heap->tcache_epoch, 1, __ATOMIC_RELAXED);
+    transfer_cache_flush();
+    if (cur_heap->percpu_cache != nullptr && !cur_heap->percpu_cache->use_rseq) {
+        percpu_cache_flush(cur_heap);
+    }
+
+    // mem_trim 同时释放 8-Byte 无锁栈中的块
+    if (mem_trim(s->config.trim_pad)) {
+        s->stats.trims += 1;
+    }
+
+    purge_idle_blocks(s);
+    s->stats.passes += 1;
+}
+
+static void scavenger_loop(SCAVENGER *s) {
+    std::unique_lock<std::mutex> lock(s->mutex);
+    while (!s->stopping) {
+        s->cv.wait_for(lock, std::chrono::milliseconds(s->config.interval_ms));
+        if (s->stopping) {
+            break;
+        }
+
+        lock.unlock();
+        scavenge(s);
+        lock.lock();
+    }
+}
+
+SCAVENGER::~SCAVENGER() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_start_scavenger(heap_t *h, const scavenger_config_t &config) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0 || h->locks == nullptr) {
+        // not initialized, or not thread-safe
+        return false;
+    }
+
+    if (h->scavenger != nullptr) {
+        return true;
+    }
+
+    SCAVENGER *s = new SCAVENGER();
+    s->heap = h;
+    s->config = config;
+    if (s->config.interval_ms == 0) {
+        s->config.interval_ms = 1;
+    }
+    if (s->config.scan_blocks == 0) {
+        s->config.scan_blocks = 1;
+    }
+
+    h->scavenger.reset(s);
+    s->thread = std::thread(scavenger_loop, s);
+    return true;
+}
+
+void heap_stop_scavenger(heap_t *h) {
+    assert(h != nullptr);
+
+    // ~SCAVENGER 等待后台线程结束
+    h->scavenger.reset();
+}
+
+void heap_scavenge(heap_t *h) {
+    assert(h != nullptr && h->scavenger != nullptr);
+    scavenge(h->scavenger.get());
+}
+
+scavenger_stats_t heap_scavenger_stats(heap_t *h) {
+    assert(h != nullptr && h->scavenger != nullptr);
+
+    std::lock_guard<std::mutex> pass_guard(h->scavenger->pass_mutex);
+    return h->scavenger->stats;
+}
@@ -0,0 +1,245 @@
+#include <cassert>
+#include <memory>
+
+#include "allocator.h"
+#include "heap-lock.h"
+#include "segregated-list.h"
+#include "small-list.h"
+
+// 多线程模式下每个 size class 使用一个 class 锁
+static_assert(SEGREGATED_CLASS_NUM <= HEAP_LOCK_CLASS_NUM, "not enough class locks");
+
+/* ------------------------------------- */
+/*  Segregated Free Lists                */
+/* ------------------------------------- */
+
+/*  Free block (>= 16 Byte), the same as explicit free list:
+    ff ff ff f8/f0  [8n + 24] - footer
+    ?? ?? ?? ??     [8n + 20]
+    ?? ?? ?? ??     [8n + 16]
+    nn nn nn nn     [8n + 12] - next free block address
+    pp pp pp pp     [8n + 8] - previous free block address
+    hh hh hh h8/h0  [8n + 4] - header
+
+    size class:
+    [0, 30]     16, 24, 32, ..., 256
+    31          (256, 512)
+    32          [512, 1024)
+    ...
+    54          [2^31, 2^32)
+*/
+
+int segregated_list_class(uint32_t block_size) {
+    assert(block_size >= MIN_EXPLICIT_FREE_LIST_BLOCKSIZE);
+    assert(block_size % 8 == 0);
+
+    if (block_size <= SEGREGATED_EXACT_MAX_BLOCKSIZE) {
+        return (block_size - MIN_EXPLICIT_FREE_LIST_BLOCKSIZE) / 8;
+    }
+
+    // floor(log2(block_size)) in [8, 31]
+    int log2 = 31 - __builtin_clz(block_size);
+    return SEGREGATED_EXACT_CLASS_NUM + (log2 - 8);
+}
+
+/* ------------------------------------- */
+/*  Operations for Size Class Lists      */
+/* ------------------------------------- */
+void segregated_list_initialize() {
+    cur_heap->segregated_lists.reset(new SEGREGATED_FREE_LISTS());
+}
+
+uint64_t segregated_list_search(uint32_t free_block_size) {
+    SEGREGATED_FREE_LISTS *seg = cur_heap->segregated_lists.get();
+
+    int c = 0;
+    if (free_block_size >= MIN_EXPLICIT_FREE_LIST_BLOCKSIZE) {
+        c = segregated_list_class(free_block_size);
+    }
+
+    // exact class 中的块大小均等于 free_block_size，而区间 class 中的块可能小于 free_block_size
+    // 因此只在 free_block_size 所在的区间 class 中进行首次适配
+    if (c >= SEGREGATED_EXACT_CLASS_NUM && ((__atomic_load_n(&seg->bitmap, __ATOMIC_RELAXED) >> c) & 0x1)) {
+        HEAP_INDEX_GUARD guard(heap_class_lock(c));
+        EXPLICIT_FREE_LINKED_LIST &list = seg->lists[c];
+
+        uint64_t b = list.head();
+        uint64_t counter_copy = list.count();
+        for (uint64_t i = 0; i < counter_copy; ++i) {
+            assert(get_allocated(b) == FREE);
+
+            if (get_block_size(b) >= free_block_size) {
+                heap_lock_observe(b);
+                return b;
+            }
+            b = list.get_next_node(b);
+        }
+    }
+    if (c >= SEGREGATED_EXACT_CLASS_NUM) {
+        c += 1;
+    }
+
+    // 更大的 class 中的任意一块都满足要求，取第一个非空 class 的 head
+    // 多线程模式下 bitmap 在获取 class 锁之前读取，class 可能已经被其他线程取空，此时继续查找下一个 class
+    uint64_t mask = ~0ULL << c;
+    for (;;) {
+        uint64_t candidates = __atomic_load_n(&seg->bitmap, __ATOMIC_RELAXED) & mask;
+        if (candidates == 0) {
+            return NIL;
+        }
+
+        int k = __builtin_ctzll(candidates);
+        HEAP_INDEX_GUARD guard(heap_class_lock(k));
+        if (seg->lists[k].count() != 0) {
+            uint64_t b = seg->lists[k].head();
+            heap_lock_observe(b);
+            return b;
+        }
+        mask &= ~(1ULL << k);
+    }
+}
+
+void segregated_list_insert(uint64_t free_header) {
+    int c = segregated_list_class(get_block_size(free_header));
+    SEGREGATED_FREE_LISTS *seg = cur_heap->segregated_lists.get();
+
+    HEAP_INDEX_GUARD guard(heap_class_lock(c));
+    seg->lists[c].insert_node(free_header);
+    __atomic_fetch_or(&seg->bitmap, 1ULL << c, __ATOMIC_RELAXED);
+}
+
+void segregated_list_delete(uint64_t free_header) {
+    int c = segregated_list_class(get_block_size(free_header));
+    SEGREGATED_FREE_LISTS *seg = cur_heap->segregated_lists.get();
+
+    HEAP_INDEX_GUARD guard(heap_class_lock(c));
+    seg->lists[c].delete_node(free_header);
+    if (seg->lists[c].count() == 0) {
+        __atomic_fetch_and(&seg->bitmap, ~(1ULL << c), __ATOMIC_RELAXED);
+    }
+}
+
+// 遍历一次heap，检查每个空闲块都处于其 size class 的链表中，以及 bitmap 与链表是否一致
+void segregated_list_check() {
+    SEGREGATED_FREE_LISTS *seg = cur_heap->segregated_lists.get();
+    uint64_t counter[SEGREGATED_CLASS_NUM] = {0};
+
+    uint64_t b = get_first_block();
+    while (b < get_epilogue()) {
+        uint32_t b_block_size = get_block_size(b);
+
+        if (get_allocated(b) == FREE && b_block_size >= MIN_EXPLICIT_FREE_LIST_BLOCKSIZE) {
+            int c = segregated_list_class(b_block_size);
+            EXPLICIT_FREE_LINKED_LIST &list = seg->lists[c];
+
+            uint64_t prev = list.get_prev_node(b);
+            uint64_t next = list.get_next_node(b);
+
+            assert(get_allocated(prev) == FREE);
+            assert(get_allocated(next) == FREE);
+            assert(segregated_list_class(get_block_size(prev)) == c);
+            assert(segregated_list_class(get_block_size(next)) == c);
+            assert(list.get_next_node(prev) == b);
+            assert(list.get_prev_node(next) == b);
+
+            ++counter[c];
+        }
+
+        b = get_next_header(b);
+    }
+
+    for (int c = 0; c < SEGREGATED_CLASS_NUM; ++c) {
+        assert(seg->lists[c].count() == counter[c]);
+        assert(((seg->bitmap >> c) & 0x1) == (counter[c] != 0));
+
+        if (counter[c] != 0) {
+            uint64_t head = seg->lists[c].head();
+            assert(get_allocated(head) == FREE);
+            assert(segregated_list_class(get_block_size(head)) == c);
+        }
+    }
+}
+
+/* ------------------------------------- */
+/*  Implementation                       */
+/* ------------------------------------- */
+
+bool segregated_list_initialize_free_block() {
+    segregated_list_initialize();
+    segregated_list_insert(get_first_block());
+
+    // init small block list
+    small_list_init();
+
+    return true;
+}
+
+uint64_t segregated_list_search_free_block(uint32_t payload_size, uint32_t &alloc_block_size) {
+    // search 8-byte block list
+    alloc_block_size = get_alloc_block_size(payload_size);
+    if (alloc_block_size == 8) {
+        // a small block
+        uint64_t b = small_list_search();
+        if (b != NIL) {
+            return b;
+        }
+    }
+
+    return segregated_list_search(alloc_block_size);
+}
+
+bool segregated_list_insert_free_block(uint64_t free_header) {
+    assert(free_header % 8 == 4);
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
+    assert(get_allocated(free_header) == FREE);
+
+    uint32_t block_size = get_block_size(free_header);
+    assert(block_size % 8 == 0);
+    assert(block_size >= 8);
+
+    switch (block_size) {
+        case 8:
+            small_list_insert(free_header);
+            break;
+        default:
+            segregated_list_insert(free_header);
+            break;
+    }
+
+    return true;
+}
+
+bool segregated_list_delete_free_block(uint64_t free_header) {
+    assert(free_header % 8 == 4);
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
+    assert(get_allocated(free_header) == FREE);
+
+    uint32_t block_size = get_block_size(free_header);
+    assert(block_size % 8 == 0);
+    assert(block_size >= 8);
+
+    switch (block_size) {
+        case 8:
+            small_list_delete(free_header);
+            break;
+        default:
+            segregated_list_delete(free_header);
+            break;
+    }
+
+    return true;
+}
+
+void segregated_list_check_free_block() {
+    small_list_check_free_blocks();
+    segregated_list_check();
+}
+
+const free_block_policy_t segregated_list_policy = {
+    "segregated fit",
+    segregated_list_initialize_free_block,
+    segregated_list_search_free_block,
+    segregated_list_insert_free_block,
+    segregated_list_delete_free_block,
+    segregated_list_check_free_block,
+};
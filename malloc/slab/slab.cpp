@@ -0,0 +1,373 @@
+#include <cassert>
+
+#include "allocator.h"
+#include "heap-lock.h"
+#include "slab.h"
+
+/* ------------------------------------- */
+/*  Slab Pages                           */
+/* ------------------------------------- */
+
+/*  span (a regular allocated block):
+    hh hh hh hh     [header]
+    ?? ?? ?? ??     [payload, ..., base) - unused, < 4096 Byte
+    .. .. .. ..     [base, base + 16 pages) - slab pages
+    ?? ?? ?? ??     [base + 16 pages, footer) - unused
+    ff ff ff ff     [footer]
+
+    slab page of object size s:
+    [+0, +80)       SLAB_PAGE_HEADER: object_size, free_count, prev, next, bitmap[8]
+    [+80, +80 + s)  object 0
+    [+80 + s, ...)  object 1, ..., (4096 - 80) / s objects
+*/
+
+static SLAB_ALLOCATOR *get_slab() {
+    assert(cur_heap->slab != nullptr);
+    return cur_heap->slab.get();
+}
+
+static SLAB_PAGE_HEADER *get_page_header(uint64_t page) {
+    assert(page % SLAB_PAGE_SIZE == 0);
+    return reinterpret_cast<SLAB_PAGE_HEADER *>(&heap[page]);
+}
+
+static uint32_t get_class(uint32_t payload_size) {
+    assert(0 < payload_size && payload_size <= SLAB_MAX_OBJECT_SIZE);
+    return (payload_size - 1) / 8;
+}
+
+static uint32_t get_capacity(uint32_t object_size) {
+    return (SLAB_PAGE_SIZE - SLAB_PAGE_HEADER_SIZE) / object_size;
+}
+
+static uint64_t get_page_index(uint64_t vaddr) {
+    return (vaddr - cur_heap->start_vaddr) / SLAB_PAGE_SIZE;
+}
+
+// page_bits 只在持有 slab 锁时修改，slab_owns 不加锁读取
+static void set_page_bit(uint64_t page, bool owned) {
+    SLAB_ALLOCATOR *s = get_slab();
+    uint64_t i = get_page_index(page);
+    uint64_t word = __atomic_load_n(&s->page_bits[i / 64], __ATOMIC_RELAXED);
+    if (owned) {
+        word |= (uint64_t)1 << (i % 64);
+    } else {
+        word &= ~((uint64_t)1 << (i % 64));
+    }
+    __atomic_store_n(&s->page_bits[i / 64], word, __ATOMIC_RELEASE);
+}
+
+static void partial_insert(uint32_t c, uint64_t page) {
+    SLAB_ALLOCATOR *s = get_slab();
+    SLAB_PAGE_HEADER *p = get_page_header(page);
+    uint64_t next = decompress_payload_ptr(s->partial_pages[c]);
+
+    p->prev = compress_ptr(NIL);
+    p->next = compress_ptr(next);
+    if (next != NIL) {
+        get_page_header(next)->prev = compress_ptr(page);
+    }
+    s->partial_pages[c] = compress_ptr(page);
+}
+
+static void partial_delete(uint32_t c, uint64_t page) {
+    SLAB_ALLOCATOR *s = get_slab();
+    SLAB_PAGE_HEADER *p = get_page_header(page);
+    uint64_t prev = decompress_payload_ptr(p->prev);
+    uint64_t next = decompress_payload_ptr(p->next);
+
+    if (prev != NIL) {
+        get_page_header(prev)->next = p->next;
+    } else {
+        assert(decompress_payload_ptr(s->partial_pages[c]) == page);
+        s->partial_pages[c] = p->next;
+    }
+    if (next != NIL) {
+        get_page_header(next)->prev = p->prev;
+    }
+    p->prev = compress_ptr(NIL);
+    p->next = compress_ptr(NIL);
+}
+
+// 从 span 中取出一个空闲页作为 size class c 的页，没有空闲页时返回 NIL
+static uint64_t page_alloc(uint32_t c) {
+    SLAB_ALLOCATOR *s = get_slab();
+    if (s->spans_with_free_pages.empty()) {
+        return NIL;
+    }
+
+    uint64_t base = *s->spans_with_free_pages.begin();
+    SLAB_SPAN &span = s->spans[base];
+    assert(span.free_pages != 0);
+
+    uint32_t i = __builtin_ctz(span.free_pages);
+    span.free_pages &= ~(1u << i);
+    if (span.free_pages == 0) {
+        s->spans_with_free_pages.erase(base);
+    }
+
+    uint64_t page = base + (uint64_t)i * SLAB_PAGE_SIZE;
+    SLAB_PAGE_HEADER *p = get_page_header(page);
+    p->object_size = (c + 1) * 8;
+    p->free_count = get_capacity(p->object_size);
+    for (uint64_t &word : p->bitmap) {
+        word = 0;
+    }
+    partial_insert(c, page);
+
+    s->stats.page_count += 1;
+    return page;
+}
+
+// 页归还给 span，span 的页全部空闲时返回其 payload
+static uint64_t page_free(uint64_t page) {
+    SLAB_ALLOCATOR *s = get_slab();
+
+    auto it = s->spans.upper_bound(page);
+    assert(it != s->spans.begin());
+    --it;
+
+    uint64_t base = it->first;
+    SLAB_SPAN &span = it->second;
+    uint32_t i = (uint32_t)((page - base) / SLAB_PAGE_SIZE);
+    assert(i < SLAB_SPAN_PAGES && (span.free_pages & (1u << i)) == 0);
+
+    span.free_pages |= 1u << i;
+    s->stats.page_count -= 1;
+
+    // 至少保留一个 span，避免反复申请与归还
+    if (span.free_pages == (1u << SLAB_SPAN_PAGES) - 1 && s->spans.size() > 1) {
+        uint64_t released = span.payload_vaddr;
+        for (uint32_t k = 0; k < SLAB_SPAN_PAGES; ++k) {
+            set_page_bit(base + (uint64_t)k * SLAB_PAGE_SIZE, false);
+        }
+        s->spans_with_free_pages.erase(base);
+        s->spans.erase(it);
+        s->stats.span_count -= 1;
+        return released;
+    }
+
+    s->spans_with_free_pages.insert(base);
+    return NIL;
+}
+
+/* ------------------------------------- */
+/*  Interface                            */
+/* ------------------------------------- */
+
+bool heap_enable_slab() {
+    return heap_enable_slab(cur_heap);
+}
+
+bool heap_enable_slab(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->slab == nullptr) {
+        SLAB_ALLOCATOR *s = new SLAB_ALLOCATOR();
+        uint64_t pages = h->max_size / SLAB_PAGE_SIZE + 1;
+        s->page_bits.resize((pages + 63) / 64, 0);
+        h->slab.reset(s);
+    }
+    return true;
+}
+
+const slab_stats_t *heap_slab_stats(heap_t *h) {
+    assert(h != nullptr);
+    return h->slab != nullptr ? &h->slab->stats : nullptr;
+}
+
+bool slab_is_suitable(uint32_t payload_size) {
+    return cur_heap->slab != nullptr && 0 < payload_size && payload_size <= SLAB_MAX_OBJECT_SIZE;
+}
+
+bool slab_owns(uint64_t vaddr) {
+    SLAB_ALLOCATOR *s = cur_heap->slab.get();
+    if (s == nullptr || vaddr < cur_heap->start_vaddr || vaddr >= cur_heap->start_vaddr + cur_heap->max_size) {
+        return false;
+    }
+
+    uint64_t i = get_page_index(vaddr);
+    return (__atomic_load_n(&s->page_bits[i / 64], __ATOMIC_ACQUIRE) >> (i % 64)) & 0x1;
+}
+
+uint64_t slab_alloc(uint32_t payload_size) {
+    assert(slab_is_suitable(payload_size));
+    SLAB_ALLOCATOR *s = get_slab();
+    HEAP_INDEX_GUARD guard(heap_slab_lock());
+
+    uint32_t c = get_class(payload_size);
+    uint64_t page = decompress_payload_ptr(s->partial_pages[c]);
+    if (page == NIL) {
+        page = page_alloc(c);
+        if (page == NIL) {
+            return NIL;
+        }
+    }
+
+    SLAB_PAGE_HEADER *p = get_page_header(page);
+    assert(p->object_size == (c + 1) * 8 && p->free_count > 0);
+
+    // 第一个未分配的 object
+    uint32_t index = 0;
+    for (uint32_t w = 0; w < SLAB_PAGE_SIZE / 8 / 64; ++w) {
+        if (~p->bitmap[w] != 0) {
+            index = w * 64 + __builtin_ctzll(~p->bitmap[w]);
+            break;
+        }
+    }
+    assert(index < get_capacity(p->object_size));
+
+    p->bitmap[index / 64] |= (uint64_t)1 << (index % 64);
+    p->free_count -= 1;
+    if (p->free_count == 0) {
+        partial_delete(c, page);
+    }
+
+    s->stats.object_count += 1;
+    s->stats.object_bytes += p->object_size;
+
+    return page + SLAB_PAGE_HEADER_SIZE + (uint64_t)index * p->object_size;
+}
+
+void slab_add_span(uint64_t span_payload_vaddr) {
+    SLAB_ALLOCATOR *s = get_slab();
+    HEAP_INDEX_GUARD guard(heap_slab_lock());
+
+    uint64_t base = round_up(span_payload_vaddr, SLAB_PAGE_SIZE);
+    assert(base + SLAB_SPAN_PAGES * SLAB_PAGE_SIZE <= span_payload_vaddr + SLAB_SPAN_PAYLOAD);
+
+    SLAB_SPAN &span = s->spans[base];
+    span.payload_vaddr = span_payload_vaddr;
+    span.free_pages = (1u << SLAB_SPAN_PAGES) - 1;
+    s->spans_with_free_pages.insert(base);
+    for (uint32_t k = 0; k < SLAB_SPAN_PAGES; ++k) {
+        set_page_bit(base + (uint64_t)k * SLAB_PAGE_SIZE, true);
+    }
+
+    s->stats.span_count += 1;
+}
+
+bool slab_free(uint64_t payload_vaddr, uint64_t &released_span) {
+    released_span = NIL;
+
+    // 不属于 slab 的 payload 无需获取 slab 的锁
+    if (!slab_owns(payload_vaddr)) {
+        return false;
+    }
+
+    SLAB_ALLOCATOR *s = get_slab();
+    HEAP_INDEX_GUARD guard(heap_slab_lock());
+
+    uint64_t page = payload_vaddr / SLAB_PAGE_SIZE * SLAB_PAGE_SIZE;
+    SLAB_PAGE_HEADER *p = get_page_header(page);
+    uint32_t c = get_class(p->object_size);
+    uint32_t capacity = get_capacity(p->object_size);
+
+    uint64_t offset = payload_vaddr - page - SLAB_PAGE_HEADER_SIZE;
+    assert(payload_vaddr >= page + SLAB_PAGE_HEADER_SIZE && offset % p->object_size == 0);
+    uint32_t index = (uint32_t)(offset / p->object_size);
+    assert(index < capacity);
+
+    // otherwise it's free twice
+    assert((p->bitmap[index / 64] >> (index % 64)) & 0x1);
+    p->bitmap[index / 64] &= ~((uint64_t)1 << (index % 64));
+    p->free_count += 1;
+
+    s->stats.object_count -= 1;
+    s->stats.object_bytes -= p->object_size;
+
+    if (p->free_count == 1) {
+        // 原来已满
+        partial_insert(c, page);
+    }
+
+    // 全部空闲，并且这个 size class 还有其他有空闲 object 的页
+    if (p->free_count == capacity && (decompress_payload_ptr(s->partial_pages[c]) != page || p->next != compress_ptr(NIL))) {
+        partial_delete(c, page);
+        released_span = page_free(page);
+    }
+    return true;
+}
+
+uint32_t slab_get_object_size(uint64_t payload_vaddr) {
+    assert(slab_owns(payload_vaddr));
+    return get_page_header(payload_vaddr / SLAB_PAGE_SIZE * SLAB_PAGE_SIZE)->object_size;
+}
+
+// 遍历每个 span 中的页，检查 bitmap、空闲计数、partial 链表以及统计信息
+void slab_check() {
+    if (cur_heap->slab == nullptr) {
+        return;
+    }
+
+    SLAB_ALLOCATOR *s = get_slab();
+    HEAP_INDEX_GUARD guard(heap_slab_lock());
+    slab_stats_t stats = slab_stats_t();
+    uint64_t partial_counter[SLAB_CLASS_NUM] = {0};
+
+    for (auto &it : s->spans) {
+        uint64_t base = it.first;
+        SLAB_SPAN &span = it.second;
+
+        assert(base % SLAB_PAGE_SIZE == 0);
+        assert(span.payload_vaddr <= base);
+        assert(base + SLAB_SPAN_PAGES * SLAB_PAGE_SIZE <= span.payload_vaddr + SLAB_SPAN_PAYLOAD);
+        assert(get_allocated(get_header(span.payload_vaddr)) == ALLOCATED);
+        assert((span.free_pages != 0) == (s->spans_with_free_pages.count(base) == 1));
+
+        stats.span_count += 1;
+
+        for (uint32_t k = 0; k < SLAB_SPAN_PAGES; ++k) {
+            uint64_t page = base + (uint64_t)k * SLAB_PAGE_SIZE;
+            assert(slab_owns(page));
+            if (span.free_pages & (1u << k)) {
+                continue;
+            }
+
+            SLAB_PAGE_HEADER *p = get_page_header(page);
+            assert(p->object_size % 8 == 0 && 8 <= p->object_size && p->object_size <= SLAB_MAX_OBJECT_SIZE);
+
+            uint32_t capacity = get_capacity(p->object_size);
+            uint32_t allocated = 0;
+            for (uint32_t i = 0; i < SLAB_PAGE_SIZE / 8; ++i) {
+                if ((p->bitmap[i / 64] >> (i % 64)) & 0x1) {
+                    assert(i < capacity);
+                    allocated += 1;
+                }
+            }
+            assert(allocated + p->free_count == capacity);
+
+            if (p->free_count > 0) {
+                partial_counter[get_class(p->object_size)] += 1;
+            }
+
+            stats.page_count += 1;
+            stats.object_count += allocated;
+            stats.object_bytes += (uint64_t)allocated * p->object_size;
+        }
+    }
+
+    for (uint32_t c = 0; c < SLAB_CLASS_NUM; ++c) {
+        uint64_t counter = 0;
+        uint64_t prev = NIL;
+        for (uint64_t page = decompress_payload_ptr(s->partial_pages[c]); page != NIL;
+             page = decompress_payload_ptr(get_page_header(page)->next)) {
+            SLAB_PAGE_HEADER *p = get_page_header(page);
+            assert(decompress_payload_ptr(p->prev) == prev);
+            assert(p->object_size == (c + 1) * 8 && p->free_count > 0);
+            prev = page;
+            counter += 1;
+        }
+        assert(counter == partial_counter[c]);
+    }
+
+    assert(s->stats.span_count == stats.span_count);
+    assert(s->stats.page_count == stats.page_count);
+    assert(s->stats.object_count == stats.object_count);
+    assert(s->stats.object_bytes == stats.object_bytes);
+}
@@ -1,113 +1,49 @@
 #include <memory>
 
 #include "allocator.h"
+#include "heap-lock.h"
 #include "small-list.h"
+#include "explicit-list.h"
 
 
-/* ------------------------------------- */
-/*  Operations for List Block Structure  */
-/* ------------------------------------- */
-uint64_t SMALL_FREE_LINKED_LIST::get_head() const {
-    return head_;
-}
-
-bool SMALL_FREE_LINKED_LIST::set_head(uint64_t new_head) {
-    head_ = new_head;
-    return true;
-}
-
-uint64_t SMALL_FREE_LINKED_LIST::get_count() const {
-    return count_;
-}
-
-bool SMALL_FREE_LINKED_LIST::set_count(uint64_t new_count) {
-    count_ = new_count;
-    return true;
-}
-
-bool SMALL_FREE_LINKED_LIST::destruct_node(uint64_t node) {
-    return true;
-}
-
-bool SMALL_FREE_LINKED_LIST::is_nodes_equal(uint64_t first, uint64_t second) {
-    return first == second;
-}
-
-uint64_t SMALL_FREE_LINKED_LIST::get_node_prev(uint64_t node) {
-    assert(node % 8 == 4);
-    assert(get_allocated(node) == FREE);
-
-    uint32_t value = *reinterpret_cast<uint32_t *>(&heap[node]);
-    // 由于8-Byte中保存size地方现用来保存prev和next
-    // ⭐ size是8字节对齐，而prev和next是4字节对齐，存入少了4，因此我们需要给它加回来
-    return 4 + (value & 0xFFFFFFF8);
-}
-
-bool SMALL_FREE_LINKED_LIST::set_node_prev(uint64_t node, uint64_t prev) {
-    // we set by header only
-    assert(node % 8 == 4);
-    assert(get_allocated(node) == FREE);
-    assert(prev % 8 == 4);
-
-    // ⭐ 注意：这里将header_addr设置成了8字节对齐，会抹去最后一个1，即x100 -> x000
-    // 后续获取prev和next的时候需要设置回来
-    *reinterpret_cast<uint32_t *>(&heap[node]) &= 0x00000007;   // reset prev pointer
-    *reinterpret_cast<uint32_t *>(&heap[node]) |= (prev & 0xFFFFFFF8);
-
-    return true;
-}
-
-uint64_t SMALL_FREE_LINKED_LIST::get_node_next(uint64_t node) {
-    assert(node % 8 == 4);
-    assert(get_allocated(node) == FREE);
-
-    uint32_t value = *reinterpret_cast<uint32_t *>(&heap[node + 4]);
-    // 由于8-Byte中保存size地方现用来保存prev和next
-    // ⭐ size是8字节对齐，而prev和next是4字节对齐，存入少了4，因此我们需要给它加回来
-    return 4 + (value & 0xFFFFFFF8);
-}
-
-bool SMALL_FREE_LINKED_LIST::set_node_next(uint64_t node, uint64_t next) {
-    assert(node % 8 == 4);
-    assert(get_allocated(node) == FREE);
-    assert(next % 8 == 4);
-
-    // 设置next
-    node += 4;
-    // ⭐ 注意：这里将header_addr设置成了8字节对齐，会抹去最后一个1，即x100 -> x000
-    // 后续获取prev和next的时候需要设置回来
-    *reinterpret_cast<uint32_t *>(&heap[node]) &= 0x00000007;   // reset next pointer
-    *reinterpret_cast<uint32_t *>(&heap[node]) |= (next & 0xFFFFFFF8);
-
-    return true;
-}
-
 /* ------------------------------------- */
 /*  Operations for Linked List           */
 /* ------------------------------------- */
 
 // unique_ptr 并不支持 多态的向上转换(子类->父类), 因此改为shared_ptr
-std::shared_ptr<SMALL_FREE_LINKED_LIST> small_list;
-
+// small list 由 cur_heap 持有
 void small_list_init() {
-    small_list.reset(new SMALL_FREE_LINKED_LIST(NULL_LIST_NODE, 0));
+    cur_heap->small_list.reset(new SMALL_FREE_LINKED_LIST(NULL_LIST_NODE, 0));
+}
+
+uint64_t small_list_search() {
+    HEAP_INDEX_GUARD guard(heap_small_list_lock());
+    if (cur_heap->small_list->count() == 0) {
+        return NIL;
+    }
+
+    uint64_t b = cur_heap->small_list->head();
+    heap_lock_observe(b);
+    return b;
 }
 
 void small_list_insert(uint64_t free_header) {
-    assert(get_first_block() <= free_header && free_header <= get_last_block());
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
     assert(free_header % 8 == 4);
     assert(get_block_size(free_header) == 8);
     assert(get_allocated(free_header) == FREE);
 
-    small_list->insert_node(free_header);
+    HEAP_INDEX_GUARD guard(heap_small_list_lock());
+    cur_heap->small_list->insert_node(free_header);
 }
 
 void small_list_delete(uint64_t free_header) {
-    assert(get_first_block() <= free_header && free_header <= get_last_block());
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
     assert(free_header % 8 == 4);
     assert(get_block_size(free_header) == 8);
 
-    small_list->delete_node(free_header);
+    HEAP_INDEX_GUARD guard(heap_small_list_lock());
+    cur_heap->small_list->delete_node(free_header);
 }
 
 // 参考原始explicit-list中 `check_explicit_list_correctness`
@@ -116,12 +52,13 @@ void small_list_delete(uint64_t free_header) {
 // 2. explicit-list
 // 2.1 explicit-list大小应处于 [16, 0xFFFFFFFF]  in explicit list
 // 2.2 explicit-list大小应处于 [16, 0x32]        in red black tree
-void check_size_list_correctness(const std::shared_ptr<LINKED_LIST> &list, uint32_t min_size, uint32_t max_size) {
+template <class List>
+void check_size_list_correctness(const std::shared_ptr<List> &list, uint32_t min_size, uint32_t max_size) {
     uint32_t counter = 0;
     uint64_t b = get_first_block();
     bool head_exists = false;
 
-    while (b <= get_last_block()) {
+    while (b < get_epilogue()) {
         uint32_t b_block_size = get_block_size(b);
 
         if (get_allocated(b) == FREE && min_size <= b_block_size && b_block_size <= max_size) {
@@ -167,6 +104,126 @@ void check_size_list_correctness(const std::shared_ptr<LINKED_LIST> &list, uint3
     assert(n == list->head());
 }
 
+template void check_size_list_correctness(const std::shared_ptr<SMALL_FREE_LINKED_LIST> &, uint32_t, uint32_t);
+template void check_size_list_correctness(const std::shared_ptr<EXPLICIT_FREE_LINKED_LIST> &, uint32_t, uint32_t);
+
 void small_list_check_free_blocks() {
-    check_size_list_correctness(small_list, 8, 8);
-}
\ No newline at end of file
+    check_size_list_correctness(cur_heap->small_list, 8, 8);
+}
+/* ------------------------------------- */
+/*  Lock-free Stack of 8-Byte Blocks     */
+/* ------------------------------------- */
+
+bool heap_enable_small_stack() {
+    return heap_enable_small_stack(cur_heap);
+}
+
+bool heap_enable_small_stack(heap_t *h) {
+    assert(h != nullptr);
+
+    if (h->max_size == 0) {
+        // not initialized
+        return false;
+    }
+
+    if (h->small_stack == nullptr) {
+        h->small_stack.reset(new SMALL_FREE_STACK());
+    }
+    return true;
+}
+
+static uint64_t get_top_header(uint64_t top) {
+    return decompress_header_ptr((uint32_t)top);
+}
+
+static uint64_t get_top_tag(uint64_t top) {
+    return top >> 32;
+}
+
+// 栈中的 block 由 payload 中的 next 串联，pop 时读取的 next 可能已经被其他线程修改，此时 CAS 必然失败
+static uint64_t load_next(uint64_t header_vaddr) {
+    return decompress_header_ptr(__atomic_load_n(reinterpret_cast<uint32_t *>(&heap[header_vaddr + 4]), __ATOMIC_RELAXED));
+}
+
+static void store_next(uint64_t header_vaddr, uint64_t next) {
+    __atomic_store_n(reinterpret_cast<uint32_t *>(&heap[header_vaddr + 4]), compress_ptr(next), __ATOMIC_RELAXED);
+}
+
+bool small_stack_push(uint64_t payload_vaddr) {
+    SMALL_FREE_STACK *stack = cur_heap->small_stack.get();
+    assert(stack != nullptr);
+
+    if (cur_heap->buddy != nullptr && payload_vaddr % 4096 == 0) {
+        // 可能是没有 header 的 buddy block
+        return false;
+    }
+
+    // 块由调用者持有，其 B8 bit 不会被其他线程修改
+    // 多线程模式下 get_block_size 在 DEBUG_MALLOC 下检查相邻块，可能与其他线程冲突，因此直接读取 header
+    uint64_t header_vaddr = get_header(payload_vaddr);
+    uint32_t header_value = __atomic_load_n(reinterpret_cast<uint32_t *>(&heap[header_vaddr]), __ATOMIC_RELAXED);
+    if (((header_value >> 2) & 0x1) == 0 || stack->count.load(std::memory_order_relaxed) >= SMALL_STACK_CAPACITY) {
+        // not B8, or the stack is full
+        return false;
+    }
+    assert((header_value & 0x1) == ALLOCATED);
+
+    uint64_t top = stack->top.load(std::memory_order_relaxed);
+    uint64_t new_top;
+    do {
+        store_next(header_vaddr, get_top_header(top));
+        new_top = (get_top_tag(top) << 32) | compress_ptr(header_vaddr);
+    } while (!stack->top.compare_exchange_weak(top, new_top, std::memory_order_release, std::memory_order_relaxed));
+
+    stack->count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t small_stack_pop() {
+    SMALL_FREE_STACK *stack = cur_heap->small_stack.get();
+    assert(stack != nullptr);
+
+    uint64_t top = stack->top.load(std::memory_order_acquire);
+    for (;;) {
+        uint64_t header_vaddr = get_top_header(top);
+        if (header_vaddr == NIL) {
+            return NIL;
+        }
+
+        uint64_t new_top = ((get_top_tag(top) + 1) << 32) | compress_ptr(load_next(header_vaddr));
+        if (stack->top.compare_exchange_weak(top, new_top, std::memory_order_acquire, std::memory_order_acquire)) {
+            stack->count.fetch_sub(1, std::memory_order_relaxed);
+            return get_payload(header_vaddr);
+        }
+    }
+}
+
+uint64_t small_stack_take_all() {
+    SMALL_FREE_STACK *stack = cur_heap->small_stack.get();
+    if (stack == nullptr) {
+        return NIL;
+    }
+
+    uint64_t top = stack->top.load(std::memory_order_acquire);
+    uint64_t new_top;
+    do {
+        if (get_top_header(top) == NIL) {
+            return NIL;
+        }
+        new_top = (get_top_tag(top) + 1) << 32;
+    } while (!stack->top.compare_exchange_weak(top, new_top, std::memory_order_acquire, std::memory_order_acquire));
+
+    // 取出的链表只由调用者访问，计数一次性减去
+    uint64_t header_vaddr = get_top_header(top);
+    uint32_t n = 0;
+    for (uint64_t h = header_vaddr; h != NIL; h = load_next(h)) {
+        n += 1;
+    }
+    stack->count.fetch_sub(n, std::memory_order_relaxed);
+    return get_payload(header_vaddr);
+}
+
+uint64_t small_stack_next(uint64_t payload_vaddr) {
+    uint64_t next = load_next(get_header(payload_vaddr));
+    return next == NIL ? NIL : get_payload(next);
+}
@@ -0,0 +1,258 @@
+#include <cassert>
+#include <memory>
+
+#include "allocator.h"
+#include "tlsf.h"
+#include "heap-lock.h"
+#include "small-list.h"
+
+// 多线程模式下每个 first level 使用一个 class 锁
+static_assert(TLSF_FL_INDEX_COUNT <= HEAP_LOCK_CLASS_NUM, "not enough class locks");
+
+/* ------------------------------------- */
+/*  Two-Level Segregated Fit             */
+/* ------------------------------------- */
+
+/*  Free block (>= 16 Byte), the same as explicit free list:
+    ff ff ff f8/f0  [8n + 24] - footer
+    ?? ?? ?? ??     [8n + 20]
+    ?? ?? ?? ??     [8n + 16]
+    nn nn nn nn     [8n + 12] - next free block address
+    pp pp pp pp     [8n + 8] - previous free block address
+    hh hh hh h8/h0  [8n + 4] - header
+
+    e.g. block size = 460 = 0b1_1100_1100
+    f = floor(log2(460)) = 8, fl = 8 - 6 = 2
+    sl = (460 >> (8 - 4)) ^ (1 << 4) = 0b1_1100 ^ 0b1_0000 = 12
+    (2, 12) manages the blocks in [448, 464)
+*/
+
+// floor(log2(x)), x > 0
+static int tlsf_fls(uint64_t x) {
+    return 63 - __builtin_clzll(x);
+}
+
+void tlsf_mapping_insert(uint32_t block_size, int &fl, int &sl) {
+    if (block_size < TLSF_SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = block_size >> TLSF_ALIGN_SIZE_LOG2;
+    } else {
+        int f = tlsf_fls(block_size);
+        sl = (int)(block_size >> (f - TLSF_SL_INDEX_COUNT_LOG2)) ^ TLSF_SL_INDEX_COUNT;
+        fl = f - (TLSF_FL_INDEX_SHIFT - 1);
+    }
+}
+
+// 将请求大小向上取整到下一个 second level 的起点，从而 (fl, sl) 中的任意一块都满足要求
+static void tlsf_mapping_search(uint32_t free_block_size, int &fl, int &sl) {
+    uint64_t size = free_block_size;
+    if (size >= TLSF_SMALL_BLOCK_SIZE) {
+        size += (1ULL << (tlsf_fls(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+
+    if (size >> TLSF_FL_INDEX_MAX) {
+        // 超出最大的 first level
+        fl = TLSF_FL_INDEX_COUNT;
+        sl = 0;
+        return;
+    }
+
+    tlsf_mapping_insert((uint32_t)size, fl, sl);
+}
+
+/* ------------------------------------- */
+/*  Operations for Two-Level Lists       */
+/* ------------------------------------- */
+void tlsf_initialize() {
+    cur_heap->tlsf.reset(new TLSF_FREE_LISTS());
+}
+
+uint64_t tlsf_search(uint32_t free_block_size) {
+    TLSF_FREE_LISTS *t = cur_heap->tlsf.get();
+
+    int fl = 0, sl = 0;
+    tlsf_mapping_search(free_block_size, fl, sl);
+    if (fl >= TLSF_FL_INDEX_COUNT) {
+        return NIL;
+    }
+
+    // 多线程模式下 bitmap 在获取 first level 的锁之前读取，链表可能已经被其他线程取空，此时重新查找
+    for (;;) {
+        // 先在同一个 first level 中寻找 >= sl 的非空链表
+        int f = fl;
+        uint32_t sl_mask = ~0U << sl;
+        if ((__atomic_load_n(&t->sl_bitmap[fl], __ATOMIC_RELAXED) & sl_mask) == 0) {
+            // 再寻找更大的 first level
+            uint32_t fl_map = fl + 1 < 32 ? __atomic_load_n(&t->fl_bitmap, __ATOMIC_RELAXED) & (~0U << (fl + 1)) : 0;
+            if (fl_map == 0) {
+                return NIL;
+            }
+
+            f = __builtin_ctz(fl_map);
+            sl_mask = ~0U;
+        }
+
+        HEAP_INDEX_GUARD guard(heap_class_lock(f));
+        uint32_t sl_map = t->sl_bitmap[f] & sl_mask;
+        if (sl_map != 0) {
+            uint64_t b = t->lists[f][__builtin_ctz(sl_map)].head();
+            heap_lock_observe(b);
+            return b;
+        }
+    }
+}
+
+// first level fl 的链表与 sl_bitmap[fl] 由 fl 的锁保护，fl_bitmap 被不同的 first level 共享，因此原子地修改
+void tlsf_insert(uint64_t free_header) {
+    TLSF_FREE_LISTS *t = cur_heap->tlsf.get();
+
+    int fl = 0, sl = 0;
+    tlsf_mapping_insert(get_block_size(free_header), fl, sl);
+
+    HEAP_INDEX_GUARD guard(heap_class_lock(fl));
+    t->lists[fl][sl].insert_node(free_header);
+    __atomic_fetch_or(&t->fl_bitmap, 1U << fl, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&t->sl_bitmap[fl], 1U << sl, __ATOMIC_RELAXED);
+}
+
+void tlsf_delete(uint64_t free_header) {
+    TLSF_FREE_LISTS *t = cur_heap->tlsf.get();
+
+    int fl = 0, sl = 0;
+    tlsf_mapping_insert(get_block_size(free_header), fl, sl);
+
+    HEAP_INDEX_GUARD guard(heap_class_lock(fl));
+    t->lists[fl][sl].delete_node(free_header);
+    if (t->lists[fl][sl].count() == 0) {
+        if (__atomic_and_fetch(&t->sl_bitmap[fl], ~(1U << sl), __ATOMIC_RELAXED) == 0) {
+            __atomic_fetch_and(&t->fl_bitmap, ~(1U << fl), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// 遍历一次heap，检查每个空闲块都处于其 (fl, sl) 的链表中，以及两级 bitmap 与链表是否一致
+void tlsf_check() {
+    TLSF_FREE_LISTS *t = cur_heap->tlsf.get();
+    uint64_t counter[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT] = {{0}};
+
+    uint64_t b = get_first_block();
+    while (b < get_epilogue()) {
+        uint32_t b_block_size = get_block_size(b);
+
+        if (get_allocated(b) == FREE && b_block_size >= MIN_EXPLICIT_FREE_LIST_BLOCKSIZE) {
+            int fl = 0, sl = 0;
+            tlsf_mapping_insert(b_block_size, fl, sl);
+            EXPLICIT_FREE_LINKED_LIST &list = t->lists[fl][sl];
+
+            uint64_t prev = list.get_prev_node(b);
+            uint64_t next = list.get_next_node(b);
+
+            int prev_fl = 0, prev_sl = 0, next_fl = 0, next_sl = 0;
+            tlsf_mapping_insert(get_block_size(prev), prev_fl, prev_sl);
+            tlsf_mapping_insert(get_block_size(next), next_fl, next_sl);
+
+            assert(get_allocated(prev) == FREE);
+            assert(get_allocated(next) == FREE);
+            assert(prev_fl == fl && prev_sl == sl);
+            assert(next_fl == fl && next_sl == sl);
+            assert(list.get_next_node(prev) == b);
+            assert(list.get_prev_node(next) == b);
+
+            ++counter[fl][sl];
+        }
+
+        b = get_next_header(b);
+    }
+
+    for (int fl = 0; fl < TLSF_FL_INDEX_COUNT; ++fl) {
+        for (int sl = 0; sl < TLSF_SL_INDEX_COUNT; ++sl) {
+            assert(t->lists[fl][sl].count() == counter[fl][sl]);
+            assert(((t->sl_bitmap[fl] >> sl) & 0x1) == (counter[fl][sl] != 0));
+        }
+        assert(((t->fl_bitmap >> fl) & 0x1) == (t->sl_bitmap[fl] != 0));
+    }
+}
+
+/* ------------------------------------- */
+/*  Implementation                       */
+/* ------------------------------------- */
+
+bool tlsf_initialize_free_block() {
+    tlsf_initialize();
+    tlsf_insert(get_first_block());
+
+    // init small block list
+    small_list_init();
+
+    return true;
+}
+
+uint64_t tlsf_search_free_block(uint32_t payload_size, uint32_t &alloc_block_size) {
+    // search 8-byte block list
+    alloc_block_size = get_alloc_block_size(payload_size);
+    if (alloc_block_size == 8) {
+        // a small block
+        uint64_t b = small_list_search();
+        if (b != NIL) {
+            return b;
+        }
+    }
+
+    return tlsf_search(alloc_block_size);
+}
+
+bool tlsf_insert_free_block(uint64_t free_header) {
+    assert(free_header % 8 == 4);
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
+    assert(get_allocated(free_header) == FREE);
+
+    uint32_t block_size = get_block_size(free_header);
+    assert(block_size % 8 == 0);
+    assert(block_size >= 8);
+
+    switch (block_size) {
+        case 8:
+            small_list_insert(free_header);
+            break;
+        default:
+            tlsf_insert(free_header);
+            break;
+    }
+
+    return true;
+}
+
+bool tlsf_delete_free_block(uint64_t free_header) {
+    assert(free_header % 8 == 4);
+    assert(get_first_block() <= free_header && free_header < get_epilogue());
+    assert(get_allocated(free_header) == FREE);
+
+    uint32_t block_size = get_block_size(free_header);
+    assert(block_size % 8 == 0);
+    assert(block_size >= 8);
+
+    switch (block_size) {
+        case 8:
+            small_list_delete(free_header);
+            break;
+        default:
+            tlsf_delete(free_header);
+            break;
+    }
+
+    return true;
+}
+
+void tlsf_check_free_block() {
+    small_list_check_free_blocks();
+    tlsf_check();
+}
+
+const free_block_policy_t tlsf_policy = {
+    "TLSF",
+    tlsf_initialize_free_block,
+    tlsf_search_free_block,
+    tlsf_insert_free_block,
+    tlsf_delete_free_block,
+    tlsf_check_free_block,
+};
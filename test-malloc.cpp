@@ -1,7 +1,24 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <sys/mman.h>
+#include <thread>
+#include <vector>
 
 #include "allocator.h"
+#include "arena.h"
 #include "linked-list.h"
+#include "policy-allocator.h"
+#include "heap-lock.h"
+#include "huge.h"
+#include "percpu-cache.h"
+#include "quick-list.h"
+#include "slab.h"
+#include "scavenger.h"
+#include "async-free.h"
+#include "tcache.h"
+#include "transfer-cache.h"
 
 //extern int heap_init();
 //extern uint64_t mem_alloc(uint32_t size);
@@ -173,9 +190,12 @@ static void test_get_next_prev() {
         set_allocated(h, allocated);
         set_block_size(h, block_size);
 
-        f = h + block_size - 4;
-        set_allocated(f, allocated);
-        set_block_size(f, block_size);
+        // only free blocks have footers
+        if (allocated == 0) {
+            f = h + block_size - 4;
+            set_block_size(f, block_size);
+            set_allocated(f, allocated);
+        }
 
         h = h + block_size;
     }
@@ -196,33 +216,186 @@ static void test_get_next_prev() {
         i += 1;
     }
 
-    // check get_prev
-    h = get_last_block();
-    i = counter - 1;
-    while (h != 0 && get_first_block() <= h) {
+    // check get_prev: only a free previous block can be found by its footer
+    assert(get_last_block() == (collection_allocated[counter - 1] == 0 ? collection_headeraddr[counter - 1] : 0));
+    for (i = counter - 1; i > 0; --i) {
+        h = collection_headeraddr[i];
+        uint64_t prev = get_prev_header(h);
 //        printf("now header = %lld\n", h);
-        assert(0 <= i);
-        assert(h == collection_headeraddr[i]);
-        assert(get_block_size(h) == collection_block_size[i]);
-        assert(get_allocated(h) == collection_allocated[i]);
+        if (collection_allocated[i - 1] == 1) {
+            assert(prev == 0);
+            continue;
+        }
 
-        h = get_prev_header(h);
-        i -= 1;
+        assert(prev == collection_headeraddr[i - 1]);
+        assert(get_block_size(prev) == collection_block_size[i - 1]);
+        assert(get_allocated(prev) == collection_allocated[i - 1]);
     }
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
 
-static void test_malloc_free() {
-#if defined(IMPLICIT_FREE_LIST)
-    printf("Testing implicit list malloc & free ...\n");
-#endif
+// 已分配的块没有 footer，下一个 header 的 PA bit 记录其已分配
+static void test_footer_elision() {
+    printf("Testing footer elision of allocated blocks ...\n");
 
-#if defined(EXPLICIT_FREE_LIST)
-    printf("Testing explicit list malloc & free ...\n");
-#endif
+    heap_t h;
+    assert(heap_init(&h, 1 << 24, EXPLICIT_FREE_LIST_STRATEGY));
+    HEAP_GUARD guard(&h);
 
-    heap_init();
+    assert(get_alloc_block_size(4) == 8);
+    assert(get_alloc_block_size(12) == 16);
+    assert(get_alloc_block_size(13) == 24);
+
+    // payload 12 只需要 16 Byte 的 block，写满 payload 不会破坏下一个 header
+    uint64_t p[4];
+    for (int i = 0; i < 4; ++i) {
+        p[i] = mem_alloc(12);
+        memset(&heap[p[i]], 0xAB, 12);
+    }
+    for (int i = 1; i < 4; ++i) {
+        assert(p[i] - p[i - 1] == 16);
+        assert(get_block_size(get_header(p[i])) == 16);
+        assert(get_allocated(get_header(p[i])) == ALLOCATED);
+        assert(get_prev_header(get_header(p[i])) == NIL);
+    }
+    check_heap_correctness();
+
+    // 释放之后写入 footer，下一个块可以找到前一个空闲块
+    mem_free(p[1]);
+    assert(get_prev_header(get_header(p[2])) == get_header(p[1]));
+    assert(heap[p[2]] == 0xAB && heap[p[2] + 11] == 0xAB);
+
+    // 8-Byte 空闲块由 footer 中的 B8 标记找到
+    uint64_t small = mem_alloc(4);
+    uint64_t guard_block = mem_alloc(4);
+    assert(guard_block - small == 8);
+    mem_free(small);
+    assert(get_prev_header(get_header(guard_block)) == get_header(small));
+    assert(get_block_size(get_header(small)) == 8);
+
+    // 合并之后仍然可以全部回到一个空闲块
+    mem_free(p[0]);
+    mem_free(p[3]);
+    mem_free(p[2]);
+    mem_free(guard_block);
+    check_heap_correctness();
+    assert(is_last_block(get_first_block()) == true);
+    assert(get_allocated(get_first_block()) == FREE);
+    assert(get_last_block() == get_first_block());
+
+    heap_destroy(&h);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 超出 4 GB 的 heap 以 vaddr >> 3 保存空闲块之间的指针，没有 8-Byte block
+static void test_wide_heap() {
+    printf("Testing wide heap beyond 4 GB ...\n");
+
+    uint64_t header_vaddr = ((uint64_t)5 << 30) + 4;
+    assert(decompress_header_ptr(compress_ptr(header_vaddr)) == header_vaddr);
+    assert(decompress_payload_ptr(compress_ptr(header_vaddr + 4)) == header_vaddr + 4);
+    assert(decompress_header_ptr(compress_ptr(NIL)) == NIL);
+
+    heap_t h;
+    assert(heap_init(&h, (uint64_t)12 << 30, REDBLACK_TREE_STRATEGY));
+    assert(h.wide == true);
+    HEAP_GUARD guard(&h);
+
+    assert(get_min_block_size() == 16);
+    assert(get_alloc_block_size(4) == 16);
+    assert(get_alloc_block_size(12) == 16);
+
+    // 一个 block 的大小不能超过 32-bit
+    assert(mem_alloc((size_t)5 << 30) == NIL);
+
+    // 两个 3 GB 的块之后的地址都超出 4 GB
+    uint64_t a = mem_alloc((size_t)3 << 30);
+    uint64_t b = mem_alloc((size_t)3 << 30);
+    assert(a != NIL && b != NIL);
+
+    uint64_t p[64];
+    for (int i = 0; i < 64; ++i) {
+        p[i] = mem_alloc(i % 2 == 0 ? 4 : 100);
+        assert(p[i] > HEAP_NARROW_LIMIT);
+        assert(get_block_size(get_header(p[i])) >= 16);
+    }
+    check_heap_correctness();
+
+    // 高地址的空闲块进入 explicit list 与红黑树
+    for (int i = 0; i < 64; i += 3) {
+        mem_free(p[i]);
+    }
+    check_heap_correctness();
+    for (int i = 0; i < 64; i += 3) {
+        p[i] = mem_alloc(i % 2 == 0 ? 4 : 100);
+        assert(p[i] > HEAP_NARROW_LIMIT);
+    }
+    check_heap_correctness();
+
+    // 合并后超过 HEAP_MAX_BLOCK_SIZE 的相邻空闲块保持分开
+    mem_free(a);
+    mem_free(b);
+    check_heap_correctness();
+    assert(get_allocated(get_header(a)) == FREE && get_allocated(get_header(b)) == FREE);
+    assert(get_block_size(get_header(a)) + (uint64_t)get_block_size(get_header(b)) > HEAP_MAX_BLOCK_SIZE);
+
+    // trim 缩短末尾块之后与前一个空闲块合并
+    for (int i = 0; i < 64; ++i) {
+        mem_free(p[i]);
+    }
+    check_heap_correctness();
+    assert(get_last_block() == get_header(a));
+
+    heap_destroy(&h);
+    assert(h.wide == false);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// splice 将另一个链表的全部节点接到末尾，顺序不变
+static void test_linked_list_splice() {
+    printf("Testing linked list splice ...\n");
+
+    INT_LINKED_LIST a(NULL_LIST_NODE, 0);
+    INT_LINKED_LIST b(NULL_LIST_NODE, 0);
+
+    // 空链表
+    assert(a.splice(b) == true);
+    assert(a.count() == 0 && a.head() == NULL_LIST_NODE);
+
+    // 头插法: a = [2, 1, 0], b = [5, 4, 3]
+    for (int i = 0; i < 3; ++i) {
+        a.insert_node((uint64_t)(new INT_LINKED_LIST_NODE(i)));
+        b.insert_node((uint64_t)(new INT_LINKED_LIST_NODE(i + 3)));
+    }
+
+    assert(a.splice(b) == true);
+    assert(a.count() == 6);
+    assert(b.count() == 0 && b.head() == NULL_LIST_NODE);
+
+    int expected[6] = {2, 1, 0, 5, 4, 3};
+    uint64_t node = a.head();
+    for (int i = 0; i < 6; ++i) {
+        assert(((int_linked_list_node_t *)node)->value == expected[i]);
+        node = a.get_next_node(node);
+    }
+    // 仍然是一个环
+    assert(node == a.head());
+    assert(((int_linked_list_node_t *)a.get_prev_node(a.head()))->value == 3);
+
+    // 接到空链表上
+    assert(b.splice(a) == true);
+    assert(b.count() == 6 && a.count() == 0);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void test_malloc_free(free_block_strategy_t strategy) {
+    printf("Testing %s malloc & free ...\n", get_free_block_policy(strategy)->name);
+
+    heap_init(strategy);
 
     srand(42);
 
@@ -276,14 +449,1361 @@ static void test_malloc_free() {
     printf("\033[32;1m\tPass\033[0m\n");
 }
 
+static void test_trim() {
+    printf("Testing heap trim ...\n");
+
+    heap_init();
+
+    // 申请足够多的块，让heap扩展到远大于 HEAP_TRIM_THRESHOLD
+    const int n = 256;
+    uint64_t ptrs[n];
+    for (int i = 0; i < n; ++i) {
+        ptrs[i] = mem_alloc(4000);
+        assert(ptrs[i] != NIL);
+    }
+    uint64_t peak_end_vaddr = cur_heap->end_vaddr;
+    assert(peak_end_vaddr - cur_heap->start_vaddr >= n * 4000);
+
+    // 从后往前释放：末尾空闲块超过阈值时自动归还到 HEAP_TOP_PAD，因此heap不会超过阈值
+    for (int i = n - 1; i >= 0; --i) {
+        mem_free(ptrs[i]);
+    }
+    assert(cur_heap->end_vaddr < peak_end_vaddr);
+    assert(cur_heap->end_vaddr - cur_heap->start_vaddr < HEAP_TRIM_THRESHOLD + 4096);
+
+    // 手动 trim 后只剩下初始的一个page
+    mem_trim(0);
+    assert(cur_heap->end_vaddr - cur_heap->start_vaddr == 4096);
+    assert(is_last_block(get_first_block()) == true);
+    assert(get_allocated(get_first_block()) == FREE);
+
+    // 归还后的地址空间可以被重新提交
+    uint64_t p = mem_alloc(8000);
+    assert(p != NIL);
+    *reinterpret_cast<uint64_t *>(&heap[p + 7992 - 8]) = 0xdeadbeef;
+    mem_free(p);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void test_purge() {
+    printf("Testing purge free block ...\n");
+
+    // 只有 rbt 中的空闲块会被 purge
+    heap_init(REDBLACK_TREE_STRATEGY);
+
+    // a 夹在两个已分配块之间，释放后进入rbt，其内部的页被 purge
+    uint64_t a = mem_alloc(HEAP_PURGE_THRESHOLD * 2);
+    uint64_t b = mem_alloc(64);
+    assert(a != NIL && b != NIL);
+    memset(&heap[a], 0xff, HEAP_PURGE_THRESHOLD * 2);
+
+    mem_free(a);
+    assert(cur_heap->stats.purge_count == 1);
+    assert(cur_heap->stats.purged_pages >= HEAP_PURGE_THRESHOLD * 2 / 4096 - 2);
+
+    // purge 之后的页不再驻留在物理内存中
+    uint64_t begin = round_up(a + 4096, 4096);
+    unsigned char resident[4];
+    assert(mincore(&heap[begin], 4 * 4096, resident) == 0);
+    for (int i = 0; i < 4; ++i) {
+        assert((resident[i] & 0x1) == 0);
+    }
+
+    // 从被 purge 的块中分配：剩余部分仍然被视为 purge 过，不会再次 purge
+    uint64_t c = mem_alloc(4000);
+    assert(c == a);
+    assert(cur_heap->stats.purge_count == 1);
+    memset(&heap[c], 0xff, 4000);
+
+    mem_free(c);
+    mem_free(b);
+
+    assert(is_last_block(get_first_block()) == true);
+    assert(get_allocated(get_first_block()) == FREE);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void test_heap_instances() {
+    printf("Testing independent heap instances ...\n");
+
+    heap_t a, b;
+    assert(heap_init(&a, 1 << 24, EXPLICIT_FREE_LIST_STRATEGY));
+    assert(heap_init(&b, 1 << 24, REDBLACK_TREE_STRATEGY));
+
+    // 两个 heap 的地址区间互不重叠
+    assert(a.start_vaddr + a.max_size <= b.start_vaddr || b.start_vaddr + b.max_size <= a.start_vaddr);
+
+    srand(7);
+    const int n = 1000;
+    uint64_t pa[n], pb[n];
+    for (int i = 0; i < n; ++i) {
+        pa[i] = mem_alloc(&a, rand() % 512 + 1);
+        pb[i] = mem_alloc(&b, rand() % 512 + 1);
+        assert(heap_find(pa[i]) == &a);
+        assert(heap_find(pb[i]) == &b);
+    }
+
+    // 释放其中一个 heap 的全部块，不影响另一个 heap
+    for (int i = 0; i < n; ++i) {
+        mem_free(&a, pa[i]);
+    }
+    {
+        HEAP_GUARD guard(&a);
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+    {
+        HEAP_GUARD guard(&b);
+        assert(get_allocated(get_first_block()) == ALLOCATED);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        mem_free(&b, pb[i]);
+    }
+
+    heap_destroy(&a);
+    heap_destroy(&b);
+    assert(heap_find(pa[0]) == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 页级的请求由 buddy system 分配: buddy block 按页对齐，释放时与 buddy 合并，整个 chunk 空闲时归还
+static void test_buddy() {
+    printf("Testing buddy system ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+    assert(heap_buddy_stats(&h) == nullptr);
+    assert(heap_enable_buddy(&h));
+    const buddy_stats_t *stats = heap_buddy_stats(&h);
+
+    // 同一个 chunk 中依次切分出的单页 block
+    uint64_t p[4];
+    for (int i = 0; i < 4; ++i) {
+        p[i] = mem_alloc(&h, 4096);
+        assert(p[i] % 4096 == 0);
+        assert(p[i] == p[0] + i * 4096);
+    }
+    assert(stats->chunk_count == 1 && stats->block_count == 4);
+
+    // 5000 Byte 向上取整为 2 页，来自 [4, 8) 页的 buddy 对
+    uint64_t q = mem_alloc(&h, 5000);
+    assert(q == p[0] + 4 * 4096);
+    assert(stats->requested_bytes == 4 * 4096 + 5000);
+    assert(stats->allocated_bytes == 6 * 4096);
+    assert(buddy_internal_fragmentation(stats) > 0.0);
+
+    // 小请求以及超过一个 chunk 的请求由 boundary tag allocator 分配
+    uint64_t small = mem_alloc(&h, 100);
+    uint64_t large = mem_alloc(&h, BUDDY_MAX_BLOCKSIZE + 1);
+    assert(small != NIL && large != NIL);
+    assert(stats->block_count == 5);
+    mem_free(&h, small);
+    mem_free(&h, large);
+
+    // 全部释放后合并为整个 chunk，唯一的 chunk 被保留
+    mem_free(&h, p[1]);
+    mem_free(&h, q);
+    mem_free(&h, p[3]);
+    mem_free(&h, p[0]);
+    mem_free(&h, p[2]);
+    assert(stats->chunk_count == 1 && stats->block_count == 0);
+    assert(h.buddy->bitmap == (1u << BUDDY_MAX_ORDER));
+
+    // 需要多个 chunk 的随机测试，空闲的 chunk 被归还给 boundary tag allocator
+    srand(42);
+
+    const int n = 64;
+    uint64_t ptrs[n] = {0};
+    for (int i = 0; i < 4000; ++i) {
+        int k = rand() % n;
+        if (ptrs[k] == NIL) {
+            uint32_t size = (rand() & 0x1) ? 4096 + rand() % (256 * 1024) : rand() % 1024 + 1;
+            ptrs[k] = mem_alloc(&h, size);
+            assert(ptrs[k] != NIL);
+        } else {
+            mem_free(&h, ptrs[k]);
+            ptrs[k] = NIL;
+        }
+
+        if (i % 100 == 0) {
+            HEAP_GUARD guard(&h);
+            check_heap_correctness();
+            buddy_check();
+        }
+    }
+    assert(stats->chunk_count > 1);
+
+    for (int k = 0; k < n; ++k) {
+        mem_free(&h, ptrs[k]);
+    }
+    assert(stats->chunk_count == 1);
+    assert(stats->block_count == 0);
+    assert(stats->requested_bytes == 0 && stats->allocated_bytes == 0);
+
+    heap_destroy(&h);
+    assert(h.buddy == nullptr);
+
+    // 编译期确定空闲块管理方式的 allocator 同样可以启用 buddy system
+    ALLOCATOR<TLSF_INDEX> a;
+    assert(a.init(1 << 24));
+    assert(a.enable_buddy());
+    uint64_t r = a.alloc(3 * 4096);
+    assert(r % 4096 == 0);
+    assert(heap_buddy_stats(a.get_heap())->allocated_bytes == 4 * 4096);
+    a.check();
+    a.free(r);
+    a.check();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 多个线程在同一个 heap 上随机 alloc/free，每个块写满各自的字节，free 之前检查没有被其他块覆盖
+static void thread_safe_worker(heap_t *h, unsigned int seed, int ops) {
+    const int n = 256;
+    uint64_t ptrs[n] = {0};
+    uint32_t sizes[n] = {0};
+
+    for (int i = 0; i < ops; ++i) {
+        int k = rand_r(&seed) % n;
+        if (ptrs[k] == NIL) {
+            uint32_t r = rand_r(&seed) % 100;
+            uint32_t size = rand_r(&seed) % 512 + 1;
+            if (r < 20) {
+                size = rand_r(&seed) % 4 + 1;
+            } else if (r < 23) {
+                size = 4096 + rand_r(&seed) % (64 * 1024);
+            } else if (r == 23) {
+                size = 200 * 1024;
+            }
+
+            ptrs[k] = mem_alloc(h, size);
+            assert(ptrs[k] != NIL);
+            sizes[k] = size;
+            memset(&heap[ptrs[k]], (int)((seed ^ k) & 0xFF), size);
+        } else {
+            uint8_t pattern = heap[ptrs[k]];
+            for (uint32_t j = 0; j < sizes[k]; ++j) {
+                assert(heap[ptrs[k] + j] == pattern);
+            }
+            mem_free(h, ptrs[k]);
+            ptrs[k] = NIL;
+        }
+
+        if (i % 1000 == 0) {
+            mem_trim(h, 0);
+        }
+    }
+
+    for (int k = 0; k < n; ++k) {
+        mem_free(h, ptrs[k]);
+    }
+}
+
+static void test_thread_safe(free_block_strategy_t strategy, bool buddy) {
+    printf("Testing thread-safe %s%s ...\n", get_free_block_policy(strategy)->name, buddy ? " with buddy system" : "");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 28, strategy));
+    if (buddy) {
+        assert(heap_enable_buddy(&h));
+    }
+    assert(heap_enable_thread_safe(&h));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(thread_safe_worker, &h, 42 + t, 20000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    {
+        HEAP_GUARD guard(&h);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        buddy_check();
+
+        // 没有 buddy system 保留的 chunk 时，全部释放后只剩一个空闲块
+        if (!buddy) {
+            assert(is_last_block(get_first_block()) == true);
+            assert(get_allocated(get_first_block()) == FREE);
+        }
+    }
+
+    heap_destroy(&h);
+    assert(h.locks == nullptr);
+
+    // 隐式空闲链表需要遍历整个 heap，不支持多线程
+    heap_t implicit;
+    assert(heap_init(&implicit, 1 << 24, IMPLICIT_FREE_LIST_STRATEGY));
+    assert(!heap_enable_thread_safe(&implicit));
+    heap_destroy(&implicit);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 小对象由 slab allocator 分配，object 没有 header/footer
+static void test_slab() {
+    printf("Testing slab allocator ...\n");
+
+    heap_t plain;
+    assert(heap_init(&plain, 1 << 26, REDBLACK_TREE_STRATEGY));
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+    assert(heap_enable_slab(&h));
+
+    const int n = 40000;
+    std::vector<uint64_t> ptrs;
+    for (int i = 0; i < n; ++i) {
+        assert(mem_alloc(&plain, 16) != NIL);
+        ptrs.push_back(mem_alloc(&h, 16));
+    }
+
+    {
+        HEAP_GUARD heap_guard(&h);
+        // 同一页中相邻的 object 相差 16 Byte，boundary tag allocator 中需要 24 Byte
+        assert(slab_owns(ptrs[0]) && ptrs[1] - ptrs[0] == 16);
+        assert(slab_get_object_size(ptrs[0]) == 16);
+        assert(h.end_vaddr - h.start_vaddr < (plain.end_vaddr - plain.start_vaddr) * 4 / 5);
+
+        const slab_stats_t *stats = heap_slab_stats(&h);
+        assert(stats->object_count == n && stats->object_bytes == n * 16);
+
+        // 每个 size class 各一些
+        for (uint32_t size = 1; size <= SLAB_MAX_OBJECT_SIZE; ++size) {
+            uint64_t p = mem_alloc(size);
+            assert(slab_owns(p) && p % 8 == 0);
+            assert(slab_get_object_size(p) == round_up(size, 8));
+            memset(&heap[p], 0xCD, size);
+            ptrs.push_back(p);
+        }
+        // 更大的请求仍然由 boundary tag allocator 分配
+        uint64_t large = mem_alloc(SLAB_MAX_OBJECT_SIZE + 1);
+        assert(!slab_owns(large));
+        ptrs.push_back(large);
+
+        slab_check();
+        check_heap_correctness();
+        h.policy->check_free_block();
+
+        srand(17);
+        for (size_t i = ptrs.size() - 1; i > 0; --i) {
+            std::swap(ptrs[i], ptrs[rand() % (i + 1)]);
+        }
+        for (uint64_t p : ptrs) {
+            mem_free(p);
+        }
+
+        // 全部空闲后每个 size class 最多保留一页
+        assert(stats->object_count == 0 && stats->page_count <= SLAB_CLASS_NUM);
+        assert(1 <= stats->span_count && stats->span_count <= SLAB_CLASS_NUM);
+        slab_check();
+        check_heap_correctness();
+        h.policy->check_free_block();
+    }
+
+    heap_destroy(&plain);
+    heap_destroy(&h);
+    assert(h.slab == nullptr);
+
+    // 多线程模式下与 tcache、buddy system 同时使用
+    assert(heap_init(&h, 1 << 28, SEGREGATED_FIT_STRATEGY));
+    assert(heap_enable_thread_safe(&h));
+    assert(heap_enable_slab(&h));
+    assert(heap_enable_buddy(&h));
+    assert(heap_enable_tcache(&h));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(thread_safe_worker, &h, 211 + t, 20000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    transfer_cache_flush(&h);
+
+    {
+        HEAP_GUARD heap_guard(&h);
+        assert(heap_slab_stats(&h)->object_count == 0);
+        slab_check();
+        buddy_check();
+        check_heap_correctness();
+        h.policy->check_free_block();
+    }
+
+    heap_destroy(&h);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 每个线程拥有自己的 arena，跨线程的 free 进入所属 arena 的 remote free 队列
+static void test_arenas() {
+    printf("Testing per-thread arenas ...\n");
+
+    uint64_t p = arena_alloc(100);
+    ARENA *self = arena_self();
+    assert(self != nullptr && arena_find(p) == self);
+
+    ARENA *other = nullptr;
+    std::thread t1([&other]() {
+        uint64_t q = arena_alloc(100);
+        other = arena_self();
+        assert(arena_find(q) == other);
+        arena_free(q);
+    });
+    t1.join();
+    assert(other != nullptr && other != self);
+
+    // 线程退出后其 arena 被新的线程接管
+    int count = arena_count();
+    std::thread t2([other]() {
+        arena_free(arena_alloc(100));
+        assert(arena_self() == other);
+    });
+    t2.join();
+    assert(arena_count() == count);
+
+    // producer/consumer: 主线程分配，另一个线程释放
+    srand(42);
+    const int n = 1000;
+    std::vector<uint64_t> ptrs(n);
+    for (int i = 0; i < n; ++i) {
+        uint32_t size = rand() % 256 + 1;
+        ptrs[i] = arena_alloc(size);
+        memset(&heap[ptrs[i]], 0xAB, size);
+    }
+
+    arena_stats_t before = arena_stats(self);
+    std::thread consumer([&ptrs]() {
+        for (uint64_t q : ptrs) {
+            arena_free(q);
+        }
+        assert(arena_self() == nullptr);
+    });
+    consumer.join();
+    assert(arena_stats(self).remote_free_count == before.remote_free_count + n);
+    assert(self->remote_free_head.load() != NIL);
+
+    // 下一次分配时释放 remote free 队列中的全部块
+    arena_free(arena_alloc(1));
+    assert(self->remote_free_head.load() == NIL);
+    assert(arena_stats(self).remote_drain_count == before.remote_drain_count + n);
+
+    arena_free(p);
+    {
+        HEAP_GUARD guard(&self->heap);
+        check_heap_correctness();
+        self->heap.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 小请求经过线程私有的 tcache，线程退出时归还其中的块
+static void test_tcache() {
+    printf("Testing thread-local cache ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, SEGREGATED_FIT_STRATEGY));
+    assert(heap_enable_tcache(&h));
+
+    // 第一次分配时从 heap 补充一批，之后同一个 bin 的请求直接命中
+    tcache_stats_t before = *tcache_stats();
+    uint64_t p = mem_alloc(&h, 24);
+    assert(tcache_stats()->misses == before.misses + 1);
+    mem_free(&h, p);
+    assert(mem_alloc(&h, 28) == p);
+    assert(tcache_stats()->hits == before.hits + 1);
+    mem_free(&h, p);
+
+    // bin 满时将一批块整体放入 transfer cache，8-Byte block 直接归还给 heap
+    const int n = 2 * TCACHE_BIN_CAPACITY;
+    uint64_t ptrs[n];
+    for (int i = 0; i < n; ++i) {
+        ptrs[i] = mem_alloc(&h, 24);
+    }
+    for (int i = 0; i < n; ++i) {
+        mem_free(&h, ptrs[i]);
+    }
+    assert(tcache_stats()->batch_inserts > before.batch_inserts);
+
+    for (int i = 0; i < n; ++i) {
+        ptrs[i] = mem_alloc(&h, 4);
+    }
+    for (int i = 0; i < n; ++i) {
+        mem_free(&h, ptrs[i]);
+    }
+    assert(tcache_stats()->flushes > before.flushes);
+
+    // 另一个线程的 bin 为空时从 transfer cache 整体取出
+    std::thread t([&h]() {
+        tcache_stats_t other = *tcache_stats();
+        mem_free(&h, mem_alloc(&h, 24));
+        assert(tcache_stats()->batch_removes == other.batch_removes + 1);
+    });
+    t.join();
+
+    // tcache 与 transfer cache 中的块在 heap 看来仍然是已分配的，flush 之后全部合并
+    {
+        HEAP_GUARD guard(&h);
+        check_heap_correctness();
+        tcache_flush();
+        transfer_cache_flush();
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    // 多线程模式: 各个线程的 tcache 在线程退出时归还
+    assert(heap_enable_thread_safe(&h));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(thread_safe_worker, &h, 7 + t, 20000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    transfer_cache_flush(&h);
+
+    {
+        HEAP_GUARD guard(&h);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    // 销毁 heap 时丢弃当前线程中属于它的块
+    mem_free(&h, mem_alloc(&h, 8));
+    heap_destroy(&h);
+    assert(!h.tcache_enabled && h.transfer_cache == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 多个线程反复分配、释放 8-Byte block，栈顶的 ABA 由 tag 检测
+static void small_stack_worker(heap_t *h, int iterations) {
+    const int n = 16;
+    uint64_t ptrs[n];
+    for (int i = 0; i < iterations; ++i) {
+        for (int k = 0; k < n; ++k) {
+            ptrs[k] = mem_alloc(h, 4);
+            assert(ptrs[k] != NIL);
+            *reinterpret_cast<uint32_t *>(&heap[ptrs[k]]) = (uint32_t)ptrs[k];
+        }
+        for (int k = 0; k < n; ++k) {
+            // 同一个块不会同时分配给两个线程
+            assert(*reinterpret_cast<uint32_t *>(&heap[ptrs[k]]) == (uint32_t)ptrs[k]);
+            mem_free(h, ptrs[k]);
+        }
+    }
+}
+
+// 8-Byte block 经过无锁的 Treiber 栈，trim 时合并
+static void test_small_stack() {
+    printf("Testing lock-free 8-Byte stack ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, EXPLICIT_FREE_LIST_STRATEGY));
+    assert(heap_enable_thread_safe(&h));
+    assert(heap_enable_small_stack(&h));
+
+    // 释放的 8-Byte block 仍然是已分配的，下一次请求直接弹出
+    uint64_t p = mem_alloc(&h, 4);
+    uint64_t q = mem_alloc(&h, 100);
+    mem_free(&h, p);
+    mem_free(&h, q);
+    assert(h.small_stack->count.load() == 1);
+    assert(mem_alloc(&h, 1) == p);
+    assert(h.small_stack->count.load() == 0);
+    mem_free(&h, p);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(small_stack_worker, &h, 5000);
+        threads.emplace_back(thread_safe_worker, &h, 123 + t, 10000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    assert(h.small_stack->count.load() <= SMALL_STACK_CAPACITY);
+
+    // trim 时栈中的块全部合并
+    mem_trim(&h, 0);
+    assert(h.small_stack->count.load() == 0);
+    {
+        HEAP_GUARD guard(&h);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    heap_destroy(&h);
+    assert(h.small_stack == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 启用 quick list 之后，[16, 256] Byte block 释放时不合并，在 search 失败、达到阈值或 trim 时才合并
+static void test_quick_lists() {
+    printf("Testing quick lists with deferred coalescing ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+    assert(heap_enable_quick_lists(&h));
+
+    {
+        HEAP_GUARD heap_guard(&h);
+
+        // 同样大小的请求直接取回，不分割也不合并
+        uint64_t p = mem_alloc(100);
+        uint64_t splits = h.stats.split_count;
+        mem_free(p);
+        assert(get_allocated(get_header(p)) == ALLOCATED);
+        assert(mem_alloc(100) == p);
+        assert(h.stats.split_count == splits && h.stats.coalesce_count == 0);
+        // 8-Byte block 与 256 Byte 以上的块仍然立即合并
+        assert(!quick_list_is_suitable(4) && !quick_list_is_suitable(253));
+        mem_free(p);
+
+        quick_list_stats_t stats = heap_quick_list_stats(&h);
+        assert(stats.hits == 1 && stats.pushes == 2 && stats.consolidations == 0);
+
+        // search 失败时，拓展 heap 之前先合并
+        const int n = 100;
+        uint64_t ptrs[n];
+        for (int i = 0; i < n; ++i) {
+            ptrs[i] = mem_alloc(200);
+        }
+        // 8-Byte block 不经过 quick list
+        uint64_t guard = mem_alloc(4);
+        // 末尾的空闲块不足一页，之后的请求只能由合并后的块满足
+        mem_trim(0);
+        uint64_t consolidations = heap_quick_list_stats(&h).consolidations;
+        for (int i = 0; i < n; ++i) {
+            mem_free(ptrs[i]);
+        }
+        uint64_t end_vaddr = h.end_vaddr;
+        uint64_t large = mem_alloc(n * 200);
+        assert(large != NIL && h.end_vaddr == end_vaddr);
+        assert(h.stats.coalesce_count > 0);
+        assert(heap_quick_list_stats(&h).consolidations == consolidations + 1);
+        assert(quick_list_is_empty());
+        check_heap_correctness();
+        h.policy->check_free_block();
+        mem_free(large);
+        mem_free(guard);
+
+        // 达到 QUICK_LISTS_MAX_BLOCKS 时合并
+        std::vector<uint64_t> blocks;
+        for (uint32_t i = 0; i < QUICK_LISTS_MAX_BLOCKS; ++i) {
+            blocks.push_back(mem_alloc(16 + i % 200));
+        }
+        for (uint64_t b : blocks) {
+            mem_free(b);
+        }
+        assert(heap_quick_list_stats(&h).consolidations == consolidations + 2);
+        assert(quick_list_is_empty());
+        check_heap_correctness();
+        h.policy->check_free_block();
+    }
+
+    // 多线程模式下与 small stack 同时使用
+    assert(heap_enable_thread_safe(&h));
+    assert(heap_enable_small_stack(&h));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(thread_safe_worker, &h, 101 + t, 20000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    {
+        HEAP_GUARD heap_guard(&h);
+        // trim 时合并 quick list 中剩余的块
+        mem_trim(0);
+        assert(quick_list_is_empty());
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    heap_destroy(&h);
+    assert(h.quick_lists == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 小请求经过当前 CPU 的缓存，缓存的块数只与 CPU 的个数有关
+static void test_percpu_cache(bool use_rseq) {
+    printf("Testing per-CPU cache%s ...\n", use_rseq ? " with rseq" : " with locks");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, TLSF_STRATEGY));
+    // 缓存在线程之间共享，heap 需要处于多线程模式
+    assert(!heap_enable_percpu_cache(&h, use_rseq));
+    assert(heap_enable_thread_safe(&h));
+    assert(heap_enable_percpu_cache(&h, use_rseq));
+    assert(use_rseq || !h.percpu_cache->use_rseq);
+
+    // 第一次分配时从 heap 补充一批，之后同一个 CPU 上的请求直接命中
+    // 固定在当前 CPU 上，迁移到其他 CPU 时第一次访问其缓存也是 miss；无法固定时只检查 misses 的上限
+    cpu_set_t old_mask;
+    assert(sched_getaffinity(0, sizeof(old_mask), &old_mask) == 0);
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(sched_getcpu(), &mask);
+    bool pinned = sched_setaffinity(0, sizeof(mask), &mask) == 0;
+
+    percpu_stats_t before = *percpu_stats();
+    uint64_t p = mem_alloc(&h, 100);
+    mem_free(&h, p);
+    for (int i = 0; i < 1000; ++i) {
+        mem_free(&h, mem_alloc(&h, 100));
+    }
+    if (pinned) {
+        assert(percpu_stats()->misses == before.misses + 1);
+        assert(percpu_stats()->hits >= before.hits + 1000);
+        sched_setaffinity(0, sizeof(old_mask), &old_mask);
+    } else {
+        assert(percpu_stats()->misses <= before.misses + 16);
+        assert(percpu_stats()->hits >= before.hits + 1000 - 16);
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back(thread_safe_worker, &h, 99 + t, 10000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    // 线程退出后其块仍然留在 CPU 的缓存中，总数不超过 CPU 个数 * bin 的容量
+    uint64_t cached = 0;
+    for (uint32_t cpu = 0; cpu < h.percpu_cache->cpu_count; ++cpu) {
+        for (uint32_t bin = 0; bin < TCACHE_BIN_NUM; ++bin) {
+            assert(h.percpu_cache->slabs[cpu].tops[bin] <= PERCPU_BIN_CAPACITY);
+            cached += h.percpu_cache->slabs[cpu].tops[bin];
+        }
+    }
+    assert(cached <= (uint64_t)h.percpu_cache->cpu_count * TCACHE_BIN_NUM * PERCPU_BIN_CAPACITY);
+
+    percpu_cache_flush(&h);
+    {
+        HEAP_GUARD guard(&h);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    heap_destroy(&h);
+    assert(h.percpu_cache == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 启用 scavenger 之后，mem_free 不再归还内存，由后台的扫描 trim 并 purge 空闲块
+static void test_scavenger() {
+    printf("Testing background scavenger ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+    assert(!heap_start_scavenger(&h));
+    assert(heap_enable_thread_safe(&h));
+
+    // 间隔足够长，下面的扫描都由 heap_scavenge 进行
+    scavenger_config_t config = SCAVENGER_DEFAULT_CONFIG;
+    config.interval_ms = 60 * 1000;
+    assert(heap_start_scavenger(&h, config));
+
+    // [big][guard][...]: big 释放之后不是末尾的块，只能被 purge
+    uint64_t big = mem_alloc(&h, 256 * 1024);
+    uint64_t guard = mem_alloc(&h, 100);
+    const int n = 256;
+    uint64_t ptrs[n];
+    for (int i = 0; i < n; ++i) {
+        ptrs[i] = mem_alloc(&h, 4000);
+    }
+    uint64_t peak_end_vaddr = h.end_vaddr;
+
+    mem_free(&h, big);
+    for (int i = n - 1; i >= 0; --i) {
+        mem_free(&h, ptrs[i]);
+    }
+    // mem_free 没有 trim，也没有 purge
+    assert(h.end_vaddr == peak_end_vaddr);
+    assert(h.stats.purge_count == 0);
+
+    // 第一次扫描: trim 末尾的空闲块，big 第一次被看到
+    heap_scavenge(&h);
+    assert(h.end_vaddr < peak_end_vaddr);
+    scavenger_stats_t stats = heap_scavenger_stats(&h);
+    assert(stats.passes == 1 && stats.trims == 1 && stats.purged_blocks == 0);
+
+    // 第二次扫描: big 连续两次没有变化，purge
+    heap_scavenge(&h);
+    stats = heap_scavenger_stats(&h);
+    assert(stats.passes == 2 && stats.purged_blocks == 1 && stats.purged_pages > 0);
+    {
+        HEAP_GUARD heap_guard(&h);
+        assert(is_block_purged(get_header(big)));
+        check_heap_correctness();
+        h.policy->check_free_block();
+    }
+    mem_free(&h, guard);
+
+    // 每次扫描最多访问 scan_blocks 个块，从上一次停下的位置继续
+    heap_stop_scavenger(&h);
+    config.scan_blocks = 4;
+    assert(heap_start_scavenger(&h, config));
+    big = mem_alloc(&h, 256 * 1024);
+    guard = mem_alloc(&h, 100);
+    for (int i = 0; i < 16; ++i) {
+        ptrs[i] = mem_alloc(&h, 100);
+    }
+    memset(&heap[big], 0xBB, 256 * 1024);
+    mem_free(&h, big);
+    for (int pass = 1; heap_scavenger_stats(&h).purged_blocks == 0; ++pass) {
+        assert(pass <= 64);
+        heap_scavenge(&h);
+    }
+    stats = heap_scavenger_stats(&h);
+    assert(stats.rounds >= 1 && stats.passes > 2);
+    assert(stats.scanned_blocks <= stats.passes * config.scan_blocks);
+    {
+        HEAP_GUARD heap_guard(&h);
+        assert(is_block_purged(get_header(big)));
+        check_heap_correctness();
+    }
+    mem_free(&h, guard);
+    for (int i = 0; i < 16; ++i) {
+        mem_free(&h, ptrs[i]);
+    }
+
+    // 后台线程与其他线程同时运行
+    heap_stop_scavenger(&h);
+    assert(h.scavenger == nullptr);
+    config.scan_blocks = 64;
+    config.interval_ms = 1;
+    assert(heap_start_scavenger(&h, config));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(thread_safe_worker, &h, 77 + t, 10000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    assert(heap_scavenger_stats(&h).passes > 0);
+
+    // 扫描改变 tcache_epoch 之后，上一个 epoch 中没有使用过的 bin 在下一次 alloc/free 时归还
+    assert(heap_enable_tcache(&h));
+    mem_free(&h, mem_alloc(&h, 100));
+    heap_scavenge(&h);
+    uint64_t other = mem_alloc(&h, 200);
+    uint64_t flushes = tcache_stats()->flushes;
+    heap_scavenge(&h);
+    mem_free(&h, other);
+    assert(tcache_stats()->flushes >= flushes + TCACHE_BATCH);
+    tcache_flush();
+
+    heap_scavenge(&h);
+    {
+        HEAP_GUARD heap_guard(&h);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    heap_destroy(&h);
+    assert(h.scavenger == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 一半的块在 alloc 之后立即 mem_free_async，其余的随机释放
+static void async_free_worker(heap_t *h, unsigned int seed, int ops) {
+    const int n = 128;
+    uint64_t ptrs[n] = {0};
+
+    for (int i = 0; i < ops; ++i) {
+        int k = rand_r(&seed) % n;
+        if (ptrs[k] == NIL) {
+            uint32_t size = rand_r(&seed) % 1024 + 1;
+            ptrs[k] = mem_alloc(h, size);
+            assert(ptrs[k] != NIL);
+            memset(&heap[ptrs[k]], 0xAB, size);
+            if (rand_r(&seed) % 2 == 0) {
+                mem_free_async(h, ptrs[k]);
+                ptrs[k] = NIL;
+            }
+        } else {
+            mem_free_async(h, ptrs[k]);
+            ptrs[k] = NIL;
+        }
+    }
+
+    for (int k = 0; k < n; ++k) {
+        mem_free_async(h, ptrs[k]);
+    }
+}
+
+// mem_free_async 只是放入当前线程的环形缓冲区，由后台线程批量释放
+static void test_async_free() {
+    printf("Testing asynchronous free ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+
+    // 没有启动后台线程时同步释放
+    assert(!heap_start_async_free(&h));
+    uint64_t p = mem_alloc(&h, 100);
+    mem_free_async(&h, p);
+    {
+        HEAP_GUARD heap_guard(&h);
+        assert(get_allocated(get_header(p)) == FREE);
+    }
+
+    assert(heap_enable_thread_safe(&h));
+    // 间隔足够长，且放入的块不超过缓冲区的一半，不会唤醒后台线程
+    assert(heap_start_async_free(&h, 60 * 1000));
+
+    const int n = 100;
+    uint64_t ptrs[n];
+    for (int i = 0; i < n; ++i) {
+        ptrs[i] = mem_alloc(&h, 64 + i);
+    }
+    for (int i = 0; i < n; ++i) {
+        mem_free_async(&h, ptrs[i]);
+    }
+    {
+        HEAP_GUARD heap_guard(&h);
+        for (int i = 0; i < n; ++i) {
+            assert(get_allocated(get_header(ptrs[i])) == ALLOCATED);
+        }
+    }
+
+    async_free_drain(&h);
+    async_free_stats_t stats = async_free_stats(&h);
+    assert(stats.freed == n && stats.batches == 1 && stats.overflows == 0);
+    {
+        HEAP_GUARD heap_guard(&h);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+    }
+
+    // 启用 tcache 时，drain 释放的块不进入 drain 线程的 tcache
+    assert(heap_enable_tcache(&h));
+    for (int i = 0; i < n; ++i) {
+        ptrs[i] = mem_alloc(&h, 64 + i);
+    }
+    tcache_flush();
+    for (int i = 0; i < n; ++i) {
+        mem_free_async(&h, ptrs[i]);
+    }
+    async_free_drain(&h);
+    {
+        HEAP_GUARD heap_guard(&h);
+        check_heap_correctness();
+        assert(is_last_block(get_first_block()) == true);
+    }
+
+    // 多个线程同时 mem_free_async，后两个线程复用前两个线程退出后的缓冲区
+    heap_stop_async_free(&h);
+    assert(h.async_free == nullptr);
+    assert(heap_start_async_free(&h, 1));
+
+    for (int round = 0; round < 2; ++round) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 2; ++t) {
+            threads.emplace_back(async_free_worker, &h, 31 + round * 2 + t, 20000);
+        }
+        for (std::thread &t : threads) {
+            t.join();
+        }
+    }
+    assert(h.async_free->rings.size() == 2);
+
+    async_free_drain(&h);
+    stats = async_free_stats(&h);
+    assert(stats.freed > 0);
+
+    // 停止时释放全部剩余的块
+    mem_free_async(&h, mem_alloc(&h, 8));
+    heap_stop_async_free(&h);
+    tcache_flush();
+    {
+        HEAP_GUARD heap_guard(&h);
+        mem_trim(0);
+        check_heap_correctness();
+        h.policy->check_free_block();
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    heap_destroy(&h);
+    assert(h.async_free == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void huge_worker(heap_t *h, int seed, int n) {
+    srand(seed);
+    uint64_t huge = NIL;
+    for (int i = 0; i < n; ++i) {
+        uint64_t p = mem_alloc(h, rand() % 1000 + 1);
+        if (huge != NIL) {
+            mem_free(h, huge);
+        }
+        huge = mem_alloc(h, 256 * 1024 + rand() % 65536);
+        assert(huge != NIL);
+        heap[huge] = 0xEE;
+        mem_free(h, p);
+    }
+    mem_free(h, huge);
+}
+
+// 超过阈值的请求在 heap 区间的顶端单独映射，释放时直接解除映射
+static void test_huge_mappings() {
+    printf("Testing huge mappings ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+    assert(heap_enable_huge_mappings(&h, 256 * 1024));
+    HEAP_GUARD guard(&h);
+    const uint64_t top = h.start_vaddr + h.max_size;
+
+    // 低于阈值的请求仍然由 boundary tag allocator 分配
+    uint64_t small = mem_alloc(1000);
+    assert(small < h.end_vaddr && !huge_owns(small));
+
+    // 从顶端向下映射，break 不移动
+    uint64_t end = h.end_vaddr;
+    uint64_t a = mem_alloc(300 * 1024);
+    uint64_t b = mem_alloc(1 << 20);
+    assert(a == top - 300 * 1024 && b == a - (1 << 20));
+    assert(h.end_vaddr == end);
+    assert(huge_get_size(a) == 300 * 1024 && huge_get_size(small) == 0);
+    memset(&heap[a], 0x5A, 300 * 1024);
+    memset(&heap[b], 0xA5, 1 << 20);
+
+    huge_stats_t stats = heap_huge_stats(&h);
+    assert(stats.mapping_count == 2 && stats.mapped_bytes == 300 * 1024 + (1 << 20));
+
+    // a 上方没有空闲区间，移动到 b 的下方，数据不变
+    uint64_t a2 = huge_realloc(a, 600 * 1024);
+    assert(a2 == b - 600 * 1024);
+    assert(heap[a2] == 0x5A && heap[a2 + 300 * 1024 - 1] == 0x5A && heap[a2 + 300 * 1024] == 0);
+    assert(heap_huge_stats(&h).remap_count == 1);
+
+    // a 原来的区间已经空闲，b 原地增长；缩小时归还末尾的页
+    assert(huge_realloc(b, (1 << 20) + 300 * 1024) == b);
+    assert(heap[b] == 0xA5 && heap[b + (1 << 20) - 1] == 0xA5 && heap[b + (1 << 20)] == 0);
+    assert(huge_realloc(b, 100) == b && huge_get_size(b) == 4096);
+
+    mem_free(a2);
+    mem_free(b);
+    mem_free(small);
+    stats = heap_huge_stats(&h);
+    assert(stats.mapping_count == 0 && stats.mapped_bytes == 0);
+    assert(!huge_owns(top - 4096));
+
+    // break 不能进入 mapping 的区域，放不下的请求也不能拓展 heap
+    uint64_t c = mem_alloc(48 << 20);
+    assert(c == top - (48 << 20));
+    assert(mem_alloc(32 << 20) == NIL);
+    mem_free(c);
+    c = mem_alloc(32 << 20);
+    assert(c == top - (32 << 20));
+    mem_free(c);
+    check_heap_correctness();
+
+    // 多线程模式下与 heap 的拓展同时进行
+    assert(heap_enable_thread_safe(&h));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(huge_worker, &h, 41 + t, 2000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    assert(heap_huge_stats(&h).mapping_count == 0);
+    assert(h.huge->low.load() == top);
+    check_heap_correctness();
+
+    heap_destroy(&h);
+    assert(h.huge == nullptr);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void realloc_worker(heap_t *h, int seed, int n) {
+    srand(seed);
+    const int m = 16;
+    uint64_t ptrs[m] = {0};
+    uint32_t sizes[m] = {0};
+    uint8_t tags[m] = {0};
+    for (int i = 0; i < n; ++i) {
+        int k = rand() % m;
+        uint32_t size = rand() % 4000 + 1;
+
+        uint64_t p = mem_realloc(h, ptrs[k], size);
+        assert(p != NIL);
+        if (ptrs[k] != NIL) {
+            // 保留的部分与原来相同
+            assert(heap[p] == tags[k]);
+            assert(size < sizes[k] || heap[p + sizes[k] - 1] == tags[k]);
+        }
+        ptrs[k] = p;
+        sizes[k] = size;
+        tags[k] = (uint8_t)(seed + i);
+        heap[p] = tags[k];
+        heap[p + size - 1] = tags[k];
+    }
+    for (int k = 0; k < m; ++k) {
+        mem_free(h, ptrs[k]);
+    }
+}
+
+// 原地缩小、吸收后面的空闲块、拓展 heap，都不满足时再移动并复制
+static void test_realloc() {
+    printf("Testing realloc ...\n");
+
+    heap_t h;
+    assert(heap_init(&h, 1 << 26, REDBLACK_TREE_STRATEGY));
+    HEAP_GUARD guard(&h);
+
+    assert(mem_realloc(NIL, 0) == NIL);
+    uint64_t a = mem_realloc(NIL, 1000);
+    uint64_t b = mem_alloc(1000);
+    uint64_t c = mem_alloc(1000);
+    assert(a != NIL && b != NIL && c != NIL);
+    memset(&heap[a], 0x11, 1000);
+
+    // 缩小时分割出末尾的空闲块
+    assert(mem_realloc(a, 100) == a);
+    assert(get_block_size(get_header(a)) == get_alloc_block_size(100));
+    assert(get_allocated(get_next_header(get_header(a))) == FREE);
+    check_heap_correctness();
+
+    // 增长时吸收后面的空闲块，数据不变
+    assert(mem_realloc(a, 1000) == a);
+    assert(heap[a] == 0x11 && heap[a + 99] == 0x11);
+    mem_free(b);
+    assert(mem_realloc(a, (uint32_t)(c - a - 4)) == a);
+    assert(get_next_header(get_header(a)) == get_header(c));
+    check_heap_correctness();
+
+    // 后面的块已分配时移动并复制
+    uint64_t moved = mem_realloc(a, 3000);
+    assert(moved != a && moved != NIL);
+    assert(heap[moved] == 0x11 && heap[moved + 99] == 0x11);
+    check_heap_correctness();
+
+    // 最后一块拓展 heap
+    uint64_t last = get_header(moved);
+    assert(get_next_header(last) == get_last_block() || get_next_header(last) == get_epilogue());
+    uint64_t end = h.end_vaddr;
+    uint32_t grown = (uint32_t)(end - moved) + 8192;
+    assert(mem_realloc(moved, grown) == moved);
+    assert(h.end_vaddr > end && get_block_size(last) >= grown);
+    assert(heap[moved] == 0x11 && heap[moved + 99] == 0x11);
+    heap[moved + grown - 1] = 0x22;
+    check_heap_correctness();
+
+    // 8-Byte block
+    uint64_t small = mem_alloc(4);
+    assert(mem_realloc(small, 4) == small);
+    heap[small] = 0x33;
+    small = mem_realloc(small, 200);
+    assert(small != NIL && heap[small] == 0x33);
+
+    assert(mem_realloc(c, 0) == NIL);
+    mem_free(small);
+    mem_free(moved);
+    check_heap_correctness();
+
+    // huge mapping 以 huge_realloc 调整，回到阈值以下时复制到 heap 中
+    assert(heap_enable_huge_mappings(&h, 256 * 1024));
+    uint64_t p = mem_alloc(2000);
+    memset(&heap[p], 0x44, 2000);
+    uint64_t q = mem_realloc(p, 300 * 1024);
+    assert(huge_get_size(q) == 300 * 1024 && heap[q + 1999] == 0x44);
+    q = mem_realloc(q, 600 * 1024);
+    assert(huge_get_size(q) == 600 * 1024 && heap[q] == 0x44);
+    p = mem_realloc(q, 1000);
+    assert(!huge_owns(p) && heap[p] == 0x44 && heap[p + 999] == 0x44);
+    assert(heap_huge_stats(&h).mapping_count == 0);
+    mem_free(p);
+    check_heap_correctness();
+
+    // 多线程模式下与其他线程的 alloc/free 同时进行
+    assert(heap_enable_thread_safe(&h));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(realloc_worker, &h, 61 + t, 20000);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    check_heap_correctness();
+    heap_destroy(&h);
+
+    // slab object 只能在 object size 以内原地调整
+    heap_t s;
+    assert(heap_init(&s, 1 << 26, REDBLACK_TREE_STRATEGY));
+    assert(heap_enable_slab(&s));
+    {
+        HEAP_GUARD slab_guard(&s);
+        uint64_t o = mem_alloc(16);
+        assert(slab_owns(o));
+        heap[o] = 0x55;
+        assert(mem_realloc(o, 10) == o);
+        uint64_t o2 = mem_realloc(o, 1000);
+        assert(o2 != o && !slab_owns(o2) && heap[o2] == 0x55);
+        mem_free(o2);
+        check_heap_correctness();
+    }
+    heap_destroy(&s);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// TLSF 的 (fl, sl) 映射: 相邻的 block size 映射到相同或下一个 (fl, sl)，且 (fl, sl) 不越界
+static void test_tlsf_mapping() {
+    printf("Testing TLSF mapping ...\n");
+
+    int fl = 0, sl = 0;
+    tlsf_mapping_insert(16, fl, sl);
+    assert(fl == 0 && sl == 2);
+    tlsf_mapping_insert(120, fl, sl);
+    assert(fl == 0 && sl == 15);
+    tlsf_mapping_insert(128, fl, sl);
+    assert(fl == 1 && sl == 0);
+    tlsf_mapping_insert(460, fl, sl);
+    assert(fl == 2 && sl == 12);
+    tlsf_mapping_insert(0xfffffff8, fl, sl);
+    assert(fl == TLSF_FL_INDEX_COUNT - 1 && sl == TLSF_SL_INDEX_COUNT - 1);
+
+    int last = 0;
+    for (uint32_t size = 16; size <= (1 << 24); size += 8) {
+        tlsf_mapping_insert(size, fl, sl);
+        assert(0 <= fl && fl < TLSF_FL_INDEX_COUNT);
+        assert(0 <= sl && sl < TLSF_SL_INDEX_COUNT);
+
+        int cell = fl * TLSF_SL_INDEX_COUNT + sl;
+        assert(cell == last || cell == last + 1 || size == 16);
+        last = cell;
+    }
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// 编译期确定空闲块管理方式的 allocator，与运行时选择的策略使用同样的 block 格式
+template <class FreeIndex>
+static void test_policy_allocator(const char *name) {
+    printf("Testing ALLOCATOR<%s> malloc & free ...\n", name);
+
+    ALLOCATOR<FreeIndex> a;
+    assert(a.init(1 << 24));
+
+    srand(42);
+
+    const int n = 512;
+    uint64_t ptrs[n] = {0};
+    for (int i = 0; i < 20000; ++i) {
+        int k = rand() % n;
+        if (ptrs[k] == NIL) {
+            ptrs[k] = a.alloc(rand() % 1024 + 1);
+            assert(ptrs[k] != NIL);
+            assert(heap_find(ptrs[k]) == a.get_heap());
+        } else if (rand() % 2 == 0) {
+            ptrs[k] = a.realloc(ptrs[k], rand() % 1024 + 1);
+            assert(ptrs[k] != NIL);
+        } else {
+            a.free(ptrs[k]);
+            ptrs[k] = NIL;
+        }
+
+        if (i % 100 == 0) {
+            a.check();
+        }
+    }
+
+    for (int k = 0; k < n; ++k) {
+        a.free(ptrs[k]);
+    }
+    a.check();
+
+    // finally there should be only one free block
+    {
+        HEAP_GUARD guard(a.get_heap());
+        assert(is_last_block(get_first_block()) == true);
+        assert(get_allocated(get_first_block()) == FREE);
+    }
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
 int main() {
+    // heap 的物理页需要在 heap_init 中提交之后才能访问
+    // 下面几个测试直接读写 header/footer，需要从全0的 heap 开始
+    heap_init();
+    memset(&heap[cur_heap->start_vaddr], 0, cur_heap->end_vaddr - cur_heap->start_vaddr);
+
     test_roundup();
     test_get_block_size_allocated();
     test_set_block_size_allocated();
     test_get_header_payload_addr();
     test_get_next_prev();
+    test_footer_elision();
+    test_wide_heap();
+    test_linked_list_splice();
 
-    test_malloc_free();
+    test_malloc_free(IMPLICIT_FREE_LIST_STRATEGY);
+    test_malloc_free(EXPLICIT_FREE_LIST_STRATEGY);
+    test_malloc_free(REDBLACK_TREE_STRATEGY);
+    test_malloc_free(SEGREGATED_FIT_STRATEGY);
+    test_malloc_free(TLSF_STRATEGY);
+    test_trim();
+    test_purge();
+    test_heap_instances();
+    test_buddy();
+    test_thread_safe(EXPLICIT_FREE_LIST_STRATEGY, false);
+    test_thread_safe(REDBLACK_TREE_STRATEGY, true);
+    test_thread_safe(SEGREGATED_FIT_STRATEGY, false);
+    test_thread_safe(TLSF_STRATEGY, true);
+    test_arenas();
+    test_tcache();
+    test_percpu_cache(true);
+    test_percpu_cache(false);
+    test_small_stack();
+    test_quick_lists();
+    test_slab();
+    test_scavenger();
+    test_async_free();
+    test_huge_mappings();
+    test_realloc();
+    test_tlsf_mapping();
+    test_policy_allocator<IMPLICIT_LIST_INDEX>("implicit free list");
+    test_policy_allocator<EXPLICIT_LIST_INDEX>("explicit free list");
+    test_policy_allocator<REDBLACK_TREE_INDEX>("red-black tree");
+    test_policy_allocator<SEGREGATED_LIST_INDEX>("segregated fit");
+    test_policy_allocator<TLSF_INDEX>("TLSF");
 
     return 0;
 }
\ No newline at end of file
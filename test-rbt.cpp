@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cassert>
 #include <memory>
 #include <vector>
@@ -82,7 +83,7 @@ void rbt_verify(const shared_ptr<RBT_INT> rbt) {
     rbt_verify_dfs(root, tree_bh, tree_min, tree_max);
 }
 
-bool rbt_compare(const std::shared_ptr<RBT> lhs, const std::shared_ptr<RBT> rhs) {
+bool rbt_compare(const std::shared_ptr<RBT_INT> lhs, const std::shared_ptr<RBT_INT> rhs) {
     if (lhs == nullptr && rhs == nullptr) {
         return true;
     }
@@ -92,9 +93,8 @@ bool rbt_compare(const std::shared_ptr<RBT> lhs, const std::shared_ptr<RBT> rhs)
         return false;
     }
 
-    // 仅仅作为接口传入进去，用于访问RBT中的相关函数
-    shared_ptr<RBT_INT> interface = make_shared<RBT_INT>(NULL_NODE);
-    bool res = rbt_compare(lhs->get_root(), rhs->get_root(), interface);
+    // 仅仅作为接口传入进去，用于访问RBT_INT中的相关函数
+    bool res = rbt_compare(lhs->get_root(), rhs->get_root(), *lhs);
 
     return res;
 }
@@ -765,7 +765,7 @@ static void test_delete() {
 static void test_insert_delete() {
     printf("Testing Red-Black Tree insertion and deletion ...\n");
 
-    std::shared_ptr<RBT_INT> tree = make_shared<RBT_INT>(NULL_NODE);
+    std::shared_ptr<RBT_INT> tree = make_shared<RBT_INT>(NULL_TREE_NODE);
 
     // insert
     int loops = 50000;
@@ -809,7 +809,7 @@ static void test_insert_delete() {
         }
     }
 
-    assert(tree->get_root() == NULL_NODE);
+    assert(tree->get_root() == NULL_TREE_NODE);
 
     printf("\033[32;1m\tPass\033[0m\n");
 }